@@ -0,0 +1,72 @@
+#ifndef CHANNEL_COUNTERS_H
+#define CHANNEL_COUNTERS_H
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+
+// Hit counters for all 256 possible channels (Hit::channel).
+//
+// Every counter sits in its own cache line and is updated with relaxed
+// atomics, so the writer never contends with readers or with the counters of
+// other channels. Readers take a Snapshot and compute rates from the
+// difference of two snapshots.
+class ChannelCounters {
+  public:
+    static const unsigned channels = 256;
+
+    struct Snapshot {
+      std::chrono::steady_clock::time_point time;
+      std::array<uint64_t, channels> counts;
+
+      // Hits per second in each channel between `before` and this snapshot.
+      // A counter reset in between counts from zero.
+      std::array<double, channels> Rates(const Snapshot& before) const {
+        std::array<double, channels> rates;
+        double seconds = std::chrono::duration<double>(time - before.time).count();
+        for (unsigned i = 0; i < channels; ++i) {
+          uint64_t delta = counts[i] >= before.counts[i]
+                         ? counts[i] - before.counts[i]
+                         : counts[i];
+          rates[i] = seconds > 0 ? delta / seconds : 0.0;
+        };
+        return rates;
+      };
+    };
+
+    ChannelCounters() { Reset(); };
+
+    void Add(uint8_t channel, uint64_t n = 1) {
+      counters[channel].value.fetch_add(n, std::memory_order_relaxed);
+    };
+
+    uint64_t Get(uint8_t channel) const {
+      return counters[channel].value.load(std::memory_order_relaxed);
+    };
+
+    void Reset() {
+      for (auto& counter : counters)
+        counter.value.store(0, std::memory_order_relaxed);
+    };
+
+    Snapshot Take() const {
+      Snapshot snapshot;
+      snapshot.time = std::chrono::steady_clock::now();
+      for (unsigned i = 0; i < channels; ++i) snapshot.counts[i] = Get(i);
+      return snapshot;
+    };
+
+  private:
+    // Padded rather than aligned to 64 bytes: DataModel is allocated with a
+    // C++11 new, which does not honour extended alignment. With a 64 byte
+    // stride no two 8 byte counters can share a cache line anyway.
+    struct Counter {
+      std::atomic<uint64_t> value;
+      char pad[64 - sizeof(std::atomic<uint64_t>)];
+    };
+
+    Counter counters[channels];
+};
+
+#endif
@@ -0,0 +1,173 @@
+#include "DataModel.h"
+#include "ChannelStats.h"
+
+const unsigned ChannelStats::channels;
+const unsigned ChannelStats::charge_bins;
+const unsigned ChannelStats::charge_bin_width;
+const unsigned ChannelStats::psd_bins;
+const unsigned ChannelStats::gap_bins;
+
+ChannelStats::ChannelStats(): data(channels) {};
+
+void ChannelStats::Reset() {
+  // value initialisation zeroes the histograms
+  for (auto& channel : data) if (channel) *channel = Channel();
+};
+
+const ChannelStats::Channel& ChannelStats::operator[](uint8_t channel) const {
+  static const Channel empty = Channel();
+  return data[channel] ? *data[channel] : empty;
+};
+
+void ChannelStats::Fill(const Hit& hit) {
+  std::unique_ptr<Channel>& slot = data[hit.channel];
+  if (!slot) slot.reset(new Channel());
+  Channel& channel = *slot;
+
+  if (channel.hits == 0) {
+    channel.first = hit.time;
+  } else {
+    if (hit.time < channel.first) channel.first = hit.time;
+    if (channel.last < hit.time)
+      ++channel.gap[GapBin(hit.time.ns() - channel.last.ns())];
+  };
+  if (channel.hits == 0 || channel.last < hit.time) channel.last = hit.time;
+
+  ++channel.hits;
+  ++channel.charge_long[ChargeBin(hit.charge_long)];
+  ++channel.charge_short[ChargeBin(hit.charge_short)];
+  ++channel.psd[PSDBin(hit)];
+};
+
+void ChannelStats::Fill(const TimeSlice& slice) {
+  for (auto& hit : slice.hits) if (slice.InCore(hit.time)) Fill(hit);
+};
+
+void ChannelStats::Merge(const ChannelStats& other) {
+  for (unsigned c = 0; c < channels; ++c) {
+    if (!other.data[c] || other.data[c]->hits == 0) continue;
+    if (!data[c]) data[c].reset(new Channel());
+    Channel& a = *data[c];
+    const Channel& b = *other.data[c];
+
+    if (a.hits == 0 || b.first < a.first) a.first = b.first;
+    if (a.hits == 0 || a.last < b.last)   a.last  = b.last;
+    a.hits += b.hits;
+    for (unsigned i = 0; i < charge_bins; ++i) {
+      a.charge_long[i]  += b.charge_long[i];
+      a.charge_short[i] += b.charge_short[i];
+    };
+    for (unsigned i = 0; i < psd_bins; ++i) a.psd[i] += b.psd[i];
+    for (unsigned i = 0; i < gap_bins; ++i) a.gap[i] += b.gap[i];
+  };
+};
+
+void ChannelStats::Append(const ChannelStats& later) {
+  for (unsigned c = 0; c < channels; ++c) {
+    if (!data[c] || data[c]->hits == 0) continue;
+    if (!later.data[c] || later.data[c]->hits == 0) continue;
+    Channel& a = *data[c];
+    const Channel& b = *later.data[c];
+    if (a.last < b.first) ++a.gap[GapBin(b.first.ns() - a.last.ns())];
+  };
+  Merge(later);
+};
+
+Time ChannelStats::First() const {
+  Time first;
+  bool any = false;
+  for (auto& channel : data)
+    if (channel && channel->hits && (!any || channel->first < first)) {
+      first = channel->first;
+      any   = true;
+    };
+  return first;
+};
+
+Time ChannelStats::Last() const {
+  Time last;
+  for (auto& channel : data)
+    if (channel && channel->hits && last < channel->last) last = channel->last;
+  return last;
+};
+
+static void write_bins(
+    std::ostream& out, const char* name, unsigned c,
+    const uint64_t* bins, unsigned n
+) {
+  out << name << ' ' << c;
+  for (unsigned i = 0; i < n; ++i)
+    if (bins[i]) out << ' ' << i << ':' << bins[i];
+  out << '\n';
+};
+
+void ChannelStats::Write(std::ostream& out) const {
+  Time first = First();
+  Time last  = Last();
+  double span = last.seconds() - first.seconds();
+
+  out << "# first_s " << first.seconds() << " last_s " << last.seconds() << '\n';
+  out << "# channel hits rate_Hz first_s last_s\n";
+  out << "# charge_long, charge_short: channel bin:count, bin width "
+      << charge_bin_width << '\n';
+  out << "# psd: channel bin:count, charge_short/charge_long in "
+      << psd_bins << " bins over [0, 1]\n";
+  out << "# gap: channel bin:count, bin = floor(log2(ns since the previous hit))\n";
+
+  for (unsigned c = 0; c < channels; ++c) {
+    if (!data[c] || data[c]->hits == 0) continue;
+    const Channel& channel = *data[c];
+    out << "channel " << c
+        << ' ' << channel.hits
+        << ' ' << (span > 0 ? channel.hits / span : 0.0)
+        << ' ' << channel.first.seconds()
+        << ' ' << channel.last.seconds()
+        << '\n';
+    write_bins(out, "charge_long",  c, channel.charge_long,  charge_bins);
+    write_bins(out, "charge_short", c, channel.charge_short, charge_bins);
+    write_bins(out, "psd",          c, channel.psd,          psd_bins);
+    write_bins(out, "gap",          c, channel.gap,          gap_bins);
+  };
+};
+
+// Sparse histogram as [bin, count, bin, count, ...]
+static void write_json_bins(
+    std::ostream& out, const char* name, const uint64_t* bins, unsigned n
+) {
+  out << ",\"" << name << "\":[";
+  bool first = true;
+  for (unsigned i = 0; i < n; ++i) {
+    if (!bins[i]) continue;
+    if (!first) out << ',';
+    out << i << ',' << bins[i];
+    first = false;
+  };
+  out << ']';
+};
+
+void ChannelStats::WriteJSON(std::ostream& out, double seconds) const {
+  if (seconds <= 0) seconds = Last().seconds() - First().seconds();
+
+  out << "{\"seconds\":" << seconds
+      << ",\"charge_bin_width\":" << charge_bin_width
+      << ",\"psd_bins\":" << psd_bins
+      << ",\"channels\":{";
+
+  bool first = true;
+  for (unsigned c = 0; c < channels; ++c) {
+    if (!data[c] || data[c]->hits == 0) continue;
+    const Channel& channel = *data[c];
+    if (!first) out << ',';
+    first = false;
+
+    out << '"' << c << "\":{\"hits\":" << channel.hits
+        << ",\"rate\":" << (seconds > 0 ? channel.hits / seconds : 0.0);
+    write_json_bins(out, "charge_long",  channel.charge_long,  charge_bins);
+    write_json_bins(out, "charge_short", channel.charge_short, charge_bins);
+    write_json_bins(out, "psd",          channel.psd,          psd_bins);
+    write_json_bins(out, "gap",          channel.gap,          gap_bins);
+    out << '}';
+  };
+
+  out << "}}";
+};
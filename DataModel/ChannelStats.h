@@ -0,0 +1,89 @@
+#ifndef CHANNEL_STATS_H
+#define CHANNEL_STATS_H
+
+#include <cstdint>
+#include <memory>
+#include <ostream>
+#include <vector>
+
+#include <TimeSlice.h>
+
+// Per channel hit statistics: hit counts, time span, charge_long and
+// charge_short spectra, PSD ratio and the distribution of the time between
+// consecutive hits of a channel.
+//
+// Accumulators of the same kind are mergeable (Merge adds the counts and
+// widens the time spans), so data can be filled by independent threads into
+// their own ChannelStats and combined at the end. Merge does not count the
+// interval between the last hit seen by one accumulator and the first hit
+// seen by another; Append does, for data split into consecutive time ranges.
+// Only the core hits of a timeslice are counted, the context hits
+// belong to the neighbouring slices.
+//
+// The histograms of a channel (about 17 kB) are allocated when the channel
+// gets its first hit.
+class ChannelStats {
+  public:
+    static const unsigned channels        = 256;
+    static const unsigned charge_bins     = 1024; // of charge_bin_width
+    static const unsigned charge_bin_width = 64;
+    static const unsigned psd_bins        = 128;  // over [0, 1]
+    static const unsigned gap_bins        = 48;   // log2 of the interval in ns
+
+    struct Channel {
+      uint64_t hits;
+      Time     first;
+      Time     last;
+      uint64_t charge_long[charge_bins];
+      uint64_t charge_short[charge_bins];
+      uint64_t psd[psd_bins];
+      uint64_t gap[gap_bins];
+    };
+
+    ChannelStats();
+    ChannelStats(ChannelStats&&) = default;
+
+    void Fill(const Hit& hit);
+    void Fill(const TimeSlice& slice);
+    void Merge(const ChannelStats& other);
+    // Merge the statistics of data following this one in time, counting the
+    // interval between the last hit here and the first hit there
+    void Append(const ChannelStats& later);
+    void Reset();
+
+    // Statistics of a channel, all zero if it had no hits
+    const Channel& operator[](uint8_t channel) const;
+
+    // Earliest and latest hit over all channels
+    Time First() const;
+    Time Last()  const;
+
+    // Compact text summary: one line of counts and rates per channel with
+    // hits, followed by the non empty bins of its histograms
+    void Write(std::ostream& out) const;
+
+    // The same as a compact JSON object, with rates computed over `seconds`
+    // rather than over the time span of the data if it is positive
+    void WriteJSON(std::ostream& out, double seconds = 0) const;
+
+    static unsigned ChargeBin(uint16_t charge) {
+      return charge / charge_bin_width;
+    };
+
+    static unsigned PSDBin(const Hit& hit) {
+      if (hit.charge_long == 0) return psd_bins - 1;
+      unsigned bin = hit.charge_short * psd_bins / hit.charge_long;
+      return bin < psd_bins ? bin : psd_bins - 1;
+    };
+
+    static unsigned GapBin(uint64_t ns) {
+      unsigned bin = 0;
+      while (ns >>= 1) ++bin;
+      return bin < gap_bins ? bin : gap_bins - 1;
+    };
+
+  private:
+    std::vector<std::unique_ptr<Channel>> data;
+};
+
+#endif
@@ -0,0 +1,45 @@
+#include "DataModel.h"
+#include "ChannelStatsShards.h"
+
+ChannelStatsShards::Shard* ChannelStatsShards::local() {
+  // cache of the shard of this thread
+  thread_local ChannelStatsShards* owner = nullptr;
+  thread_local Shard* shard = nullptr;
+  if (owner == this) return shard;
+
+  std::lock_guard<std::mutex> lock(mutex);
+  std::thread::id id = std::this_thread::get_id();
+  shard = nullptr;
+  for (auto& s : shards)
+    if (s->thread == id) {
+      shard = s.get();
+      break;
+    };
+  if (!shard) {
+    shards.emplace_back(new Shard());
+    shard = shards.back().get();
+    shard->thread = id;
+  };
+  owner = this;
+  return shard;
+};
+
+void ChannelStatsShards::Fill(const TimeSlice& slice) {
+  Shard* shard = local();
+  // busy is raised before reading active, so Collect either sees busy or the
+  // filling reads the switched active
+  shard->busy.store(true);
+  shard->stats[shard->active.load()].Fill(slice);
+  shard->busy.store(false, std::memory_order_release);
+};
+
+void ChannelStatsShards::Collect(ChannelStats& stats) {
+  std::lock_guard<std::mutex> lock(mutex);
+  for (auto& shard : shards) {
+    int retired = shard->active.load();
+    shard->active.store(1 - retired);
+    while (shard->busy.load()) std::this_thread::yield();
+    stats.Merge(shard->stats[retired]);
+    shard->stats[retired].Reset();
+  };
+};
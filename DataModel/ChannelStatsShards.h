@@ -0,0 +1,43 @@
+#ifndef CHANNEL_STATS_SHARDS_H
+#define CHANNEL_STATS_SHARDS_H
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <ChannelStats.h>
+
+// ChannelStats filled concurrently by the pipeline threads and collected
+// periodically by the monitoring.
+//
+// Every thread fills its own shard, so filling takes no lock and shares no
+// cache lines with other threads. A shard holds two ChannelStats: the thread
+// fills the active one while Collect switches the shard to the other one and
+// merges the retired one once the thread is no longer filling it.
+class ChannelStatsShards {
+  public:
+    // Fill the core hits of a slice into the shard of the calling thread
+    void Fill(const TimeSlice& slice);
+
+    // Merge what was filled since the last Collect into `stats`
+    void Collect(ChannelStats& stats);
+
+  private:
+    struct Shard {
+      Shard(): active(0), busy(false) {};
+
+      std::thread::id   thread;
+      ChannelStats      stats[2];
+      std::atomic<int>  active;
+      std::atomic<bool> busy;
+    };
+
+    Shard* local();
+
+    std::mutex mutex; // guards `shards`, taken only when a thread fills for the first time and by Collect
+    std::vector<std::unique_ptr<Shard>> shards;
+};
+
+#endif
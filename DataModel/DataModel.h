@@ -1,6 +1,7 @@
 #ifndef DATAMODEL_H
 #define DATAMODEL_H
 
+#include <atomic>
 #include <map>
 #include <string>
 #include <vector>
@@ -14,6 +15,11 @@
 #include "DAQLogging.h"
 #include "DAQUtilities.h"
 #include "TimeSlice.h"
+#include "ChannelStatsShards.h"
+#include "ChannelCounters.h"
+#include "StageProfiler.h"
+#include "SliceBudget.h"
+#include "SliceSampler.h"
 
 
 #include <zmq.hpp>
@@ -42,6 +48,11 @@ class DataModel : public DAQDataModelBase {
   bool run_start     = false;
   bool run_stop      = false;
   bool change_config = false;
+
+  // Run stop drain: RunControl sets draining and waits for FileWriter to set
+  // drained once every slice in flight is written and the part is closed
+  std::atomic<bool> draining{false};
+  std::atomic<bool> drained{false};
   bool running;
   bool load_config;
   bool sub_run;
@@ -77,6 +88,25 @@ class DataModel : public DAQDataModelBase {
   std::queue<std::unique_ptr<TimeSlice>> readout;
   std::mutex readout_mutex;
 
+  // Memory of the slices in flight from readout to the FileWriter. Configured
+  // by Reformatter, dropped hits are reported by Monitoring and in the part
+  // file manifests.
+  SliceBudget slice_budget;
+
+  // Slices sent to the SliceWorkers by SliceDispatcher and neither returned to
+  // the SliceCollector of this toolchain nor given up by it. They leave
+  // slice_budget when sent, so the FileWriter waits for both before reporting
+  // a run drained.
+  std::atomic<long> slices_at_workers{0};
+
+  // Hits that reached the Reformatter after their timeslice was cut, in
+  // batches per cut. Written by the FileWriter to separate late part files.
+  std::queue<std::unique_ptr<TimeSlice>> late_readout;
+  std::mutex late_readout_mutex;
+
+  // Late hits per channel, counted by Reformatter
+  ChannelCounters late_hits;
+
   std::queue<std::unique_ptr<TimeSlice>> sorted_readout;
   std::mutex sorted_readout_mutex;
 
@@ -86,11 +116,22 @@ class DataModel : public DAQDataModelBase {
   std::queue<std::unique_ptr<TimeSlice>> final_readout;
   std::mutex final_readout_mutex;
 
+  // Written slices selected by monitoring_sampler, published by Monitoring
   std::queue<std::unique_ptr<TimeSlice>> monitoring_readout;
   std::mutex monitoring_readout_mutex;
+  SliceSampler monitoring_sampler;
 
   
-  std::vector<size_t> channel_hits;
+  // Hits per channel, counted by Reformatter
+  ChannelCounters channel_hits;
+
+  // Per channel rates and spectra of the triggered data, filled by the
+  // Trigger jobs and published by Monitoring
+  ChannelStatsShards channel_stats;
+
+  // CPU, lock wait and sleep time of the pipeline stages, published by
+  // Monitoring
+  StageProfiler profiler;
   
 
 private:
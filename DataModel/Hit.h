@@ -16,12 +16,11 @@ class Time : SerialisableObject{
     Time(const Time& t): time(t.time) {};
 
     // See Table 2.3 in UM2580_DPSD_UserManual_rev9
-    explicit Time(long double seconds) {
-      seconds /= 2e-9; // Tsampl
-      time = seconds; // Tcoarse
-      seconds *= 1024;
-      time = time << 10 | static_cast<uint64_t>(seconds) & 0x3ff; // Tfine
-    };
+    // One unit of the fixed point value is 2 ns / 1024 = 1/512 ns, so the
+    // conversion is a single multiplication.
+    explicit Time(long double seconds):
+      time(static_cast<uint64_t>(seconds * 512e9L))
+    {};
 
     // Construct Time from CAEN digitizer output data.
     // tag is the trigger time tag, extras provides the most and the least significant bits.
@@ -36,11 +35,20 @@ class Time : SerialisableObject{
   
   Time(uint64_t time): time(time) {}
 
+  // Coarse and fine parts are converted separately: both fit into the
+  // double mantissa exactly, so no long double arithmetic is needed.
   double seconds() const {
-      return (
-            static_cast<long double>(time >> 10)
-          + static_cast<long double>(time & 0x3ff) / 1024.0L
-      ) * 2e-9L;
+      return static_cast<double>(time >> 10) * 2e-9
+           + static_cast<double>(time & 0x3ff) * (2e-9 / 1024);
+    };
+
+    // Integer number of nanoseconds (truncated)
+    uint64_t ns() const {
+      return time >> 9;
+    };
+
+    static Time from_ns(uint64_t ns) {
+      return Time(ns << 9);
     };
 
     uint64_t bits() const {
@@ -0,0 +1,117 @@
+#include <cstring>
+
+#include <zlib.h>
+
+#include "DataModel.h"
+#include "JournalReader.h"
+#include "PartFile.h"
+#include "SliceCodec.h"
+
+JournalReader::JournalReader():
+  file(nullptr), version(0), level(0), blocks(0), valid(0), crc(0), clean(false)
+{};
+
+JournalReader::~JournalReader() {
+  Close();
+};
+
+bool JournalReader::Open(const std::string& filename) {
+  Close();
+
+  file = fopen(filename.c_str(), "rb");
+  if (!file) return false;
+
+  uint64_t magic;
+  uint32_t version_;
+  uint32_t level_;
+  if (
+         fread(&magic,    sizeof(magic),    1, file) != 1
+      || fread(&version_, sizeof(version_), 1, file) != 1
+      || fread(&level_,   sizeof(level_),   1, file) != 1
+      || magic    != PartFile::journal_magic
+      || version_ <  1
+      || version_ >  PartFile::journal_version
+  ) {
+    Close();
+    return false;
+  };
+
+  version = version_;
+  level  = level_;
+  blocks = 0;
+  valid  = sizeof(magic) + sizeof(version_) + sizeof(level_);
+  crc    = crc32(0, Z_NULL, 0);
+  clean  = false;
+  return true;
+};
+
+void JournalReader::Close() {
+  if (file) fclose(file);
+  file = nullptr;
+};
+
+bool JournalReader::NextBlock(uint64_t& raw_size, std::string& payload) {
+  if (!file) return false;
+
+  // versions 2 and 3: raw size (64 bit), payload size, checksum
+  // version 1: payload size, raw size (32 bit), checksum
+  char header[PartFile::journal_block_header];
+  size_t header_size = version == 1 ? 3 * sizeof(uint32_t) : sizeof(header);
+  size_t n = fread(header, 1, header_size, file);
+  if (n == 0 && feof(file)) {
+    clean = true;
+    Close();
+    return false;
+  };
+
+  uint32_t payload_size;
+  uint32_t checksum;
+  if (version == 1) {
+    uint32_t raw_size32;
+    memcpy(&payload_size, header,                        sizeof(payload_size));
+    memcpy(&raw_size32,   header +     sizeof(uint32_t), sizeof(raw_size32));
+    memcpy(&checksum,     header + 2 * sizeof(uint32_t), sizeof(checksum));
+    raw_size = raw_size32;
+  } else {
+    memcpy(&raw_size,     header,                                       sizeof(raw_size));
+    memcpy(&payload_size, header + sizeof(uint64_t),                    sizeof(payload_size));
+    memcpy(&checksum,     header + sizeof(uint64_t) + sizeof(uint32_t), sizeof(checksum));
+  };
+
+  // a block is valid only if it is complete and its checksum matches
+  if (n != header_size || payload_size > PartFile::journal_max_block) {
+    Close();
+    return false;
+  };
+  payload.resize(payload_size);
+  if (payload_size && fread(&payload[0], payload_size, 1, file) != 1) {
+    Close();
+    return false;
+  };
+
+  uLong sum = crc32(0, Z_NULL, 0);
+  sum = crc32(sum, reinterpret_cast<const Bytef*>(header), header_size - sizeof(checksum));
+  sum = crc32(sum, reinterpret_cast<const Bytef*>(payload.data()), payload.size());
+  if (sum != checksum) {
+    Close();
+    return false;
+  };
+
+  crc = crc32(crc, reinterpret_cast<const Bytef*>(header), header_size);
+  crc = crc32(crc, reinterpret_cast<const Bytef*>(payload.data()), payload.size());
+  valid += header_size + payload.size();
+  ++blocks;
+  return true;
+};
+
+bool JournalReader::Next(TimeSlice& slice) {
+  uint64_t raw_size;
+  std::string payload;
+  if (!NextBlock(raw_size, payload)) return false;
+
+  if (level == 0) return SliceCodec::decode(payload, slice);
+
+  std::string raw;
+  return SliceCodec::decompress(payload, raw_size, raw)
+      && SliceCodec::decode(raw, slice);
+};
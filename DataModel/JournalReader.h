@@ -0,0 +1,51 @@
+#ifndef JOURNAL_READER_H
+#define JOURNAL_READER_H
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+
+#include <TimeSlice.h>
+
+// Sequential reader of journal part files written by PartFile::OpenJournal.
+//
+// Blocks are read until the end of the file or the first block that is
+// truncated or fails its checksum, which is where a crashed writer stopped.
+// ValidBytes then gives the length of the intact part of the file, to which
+// it can be truncated and appended to again. Journals of versions 1 to 3 are
+// read.
+class JournalReader {
+  public:
+    JournalReader();
+    ~JournalReader();
+
+    // Returns false if the file cannot be opened or is not a journal
+    bool Open(const std::string& filename);
+    void Close();
+
+    // Read the next block as stored: `payload` is compressed if Level() > 0
+    bool NextBlock(uint64_t& raw_size, std::string& payload);
+
+    // Read and decode the next timeslice
+    bool Next(TimeSlice& slice);
+
+    uint32_t Version()    const { return version; };
+    int      Level()      const { return level; };
+    uint64_t Blocks()     const { return blocks; };
+    uint64_t ValidBytes() const { return valid; };
+    // CRC-32 of the blocks up to ValidBytes
+    unsigned long Crc()   const { return crc; };
+    // Whether reading stopped at the end of the file rather than at a damaged block
+    bool Clean()          const { return clean; };
+
+  private:
+    FILE*         file;
+    uint32_t      version;
+    int           level;
+    uint64_t      blocks;
+    uint64_t      valid;
+    unsigned long crc;
+    bool          clean;
+};
+
+#endif
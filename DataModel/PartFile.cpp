@@ -0,0 +1,274 @@
+#include <cerrno>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <zlib.h>
+
+#include "DataModel.h"
+#include "JournalReader.h"
+#include "PartFile.h"
+
+const uint64_t PartFile::journal_magic;
+const uint32_t PartFile::journal_version;
+const uint32_t PartFile::journal_max_block;
+const size_t   PartFile::journal_block_header;
+
+PartFile::PartFile():
+  fd(-1), journal(false), refused(false),
+  bytes(0), slices(0), hits(0), unsynced(0), crc(0)
+{};
+
+PartFile::~PartFile() {
+  if (fd >= 0) Close();
+};
+
+bool PartFile::write_all(const void* data, size_t size, off_t offset) {
+  const char* p = static_cast<const char*>(data);
+  while (size > 0) {
+    ssize_t n = pwrite(fd, p, size, offset);
+    if (n < 0) {
+      if (errno == EINTR) continue;
+      return false;
+    };
+    p      += n;
+    size   -= n;
+    offset += n;
+  };
+  return true;
+};
+
+bool PartFile::open(
+    const std::string& filename_, int flags, uint64_t preallocate
+) {
+  refused = false;
+  if (fd >= 0 && !Close()) return false;
+
+  filename = filename_;
+  fd = ::open(filename.c_str(), O_WRONLY | O_CREAT | flags, 0644);
+  refused = fd < 0 && errno == EEXIST;
+  if (fd < 0) return false;
+
+  // Best effort: not all file systems support fallocate. KEEP_SIZE leaves the
+  // file length alone so that a crashed part contains no trailing zeros.
+  if (preallocate > 0)
+    fallocate(fd, FALLOC_FL_KEEP_SIZE, 0, header.size() + preallocate);
+
+  bytes    = 0;
+  slices   = 0;
+  hits     = 0;
+  unsynced = 0;
+  first    = Time();
+  last     = Time();
+  crc      = crc32(0, Z_NULL, 0);
+  manifest.Delete();
+  return true;
+};
+
+bool PartFile::Open(
+    const std::string& filename_,
+    const std::string& header_,
+    uint64_t preallocate
+) {
+  unsigned long count = 0;
+  header = header_;
+  header.append(reinterpret_cast<const char*>(&count), sizeof(count));
+  journal = false;
+
+  if (!open(filename_, O_EXCL, preallocate)) return false;
+
+  if (!write_all(header.data(), header.size(), 0)) {
+    close(fd);
+    fd = -1;
+    return false;
+  };
+  bytes = header.size();
+
+  return true;
+};
+
+bool PartFile::OpenJournal(
+    const std::string& filename_,
+    int level,
+    uint64_t preallocate
+) {
+  uint64_t magic   = journal_magic;
+  uint32_t version = journal_version;
+  uint32_t level_  = level;
+  header.clear();
+  header.append(reinterpret_cast<const char*>(&magic),   sizeof(magic));
+  header.append(reinterpret_cast<const char*>(&version), sizeof(version));
+  header.append(reinterpret_cast<const char*>(&level_),  sizeof(level_));
+  journal = true;
+
+  // Resume an existing part after its last intact block. The blocks are
+  // decoded to restore the counts and the time range for the manifest.
+  JournalReader reader;
+  bool resume = reader.Open(filename_)
+             && reader.Version() == journal_version
+             && reader.Level() == level;
+  uint64_t resumed_slices = 0;
+  uint64_t resumed_hits   = 0;
+  Time resumed_first;
+  Time resumed_last;
+  if (resume) {
+    TimeSlice slice;
+    while (reader.Next(slice)) {
+      Time end = slice.end == Time() && !slice.hits.empty()
+               ? slice.hits.back().time
+               : slice.end;
+      if (resumed_slices == 0 || slice.time < resumed_first)
+        resumed_first = slice.time;
+      if (resumed_slices == 0 || resumed_last < end) resumed_last = end;
+      ++resumed_slices;
+      resumed_hits += slice.hits.size();
+      slice.hits.clear();
+      slice.triggers.clear();
+    };
+    resume = reader.Blocks() == resumed_slices;
+  };
+
+  // anything else that exists is left alone
+  if (!open(filename_, resume ? 0 : O_EXCL, preallocate)) return false;
+
+  if (resume) {
+    if (ftruncate(fd, reader.ValidBytes()) != 0) {
+      close(fd);
+      fd = -1;
+      return false;
+    };
+    bytes  = reader.ValidBytes();
+    slices = resumed_slices;
+    hits   = resumed_hits;
+    first  = resumed_first;
+    last   = resumed_last;
+    crc    = reader.Crc();
+    return true;
+  };
+
+  if (!write_all(header.data(), header.size(), 0)) {
+    close(fd);
+    fd = -1;
+    return false;
+  };
+  bytes = header.size();
+
+  return true;
+};
+
+void PartFile::add(const TimeSlice& slice) {
+  Time begin = slice.time;
+  Time end   = slice.end;
+  if (end == Time() && !slice.hits.empty()) end = slice.hits.back().time;
+  if (slices == 0 || begin < first) first = begin;
+  if (slices == 0 || last < end)    last  = end;
+
+  ++slices;
+  hits += slice.hits.size();
+};
+
+bool PartFile::Write(const std::string& data, const TimeSlice& slice) {
+  if (fd < 0 || journal) return false;
+  if (!write_all(data.data(), data.size(), bytes)) return false;
+
+  bytes += data.size();
+  crc = crc32(crc, reinterpret_cast<const Bytef*>(data.data()), data.size());
+  add(slice);
+  return true;
+};
+
+bool PartFile::WriteBlock(
+    uint64_t raw_size, const std::string& payload, const TimeSlice& slice
+) {
+  if (fd < 0 || !journal || payload.size() > journal_max_block) return false;
+
+  uint32_t payload_size = payload.size();
+  std::string data;
+  data.reserve(journal_block_header + payload.size());
+  data.append(reinterpret_cast<const char*>(&raw_size),     sizeof(raw_size));
+  data.append(reinterpret_cast<const char*>(&payload_size), sizeof(payload_size));
+  uLong sum = crc32(0, Z_NULL, 0);
+  sum = crc32(sum, reinterpret_cast<const Bytef*>(data.data()), data.size());
+  sum = crc32(sum, reinterpret_cast<const Bytef*>(payload.data()), payload.size());
+  uint32_t checksum = sum;
+  data.append(reinterpret_cast<const char*>(&checksum), sizeof(checksum));
+
+  // one write per block so that a crash leaves at most one partial block
+  data += payload;
+  if (!write_all(data.data(), data.size(), bytes)) return false;
+
+  bytes += data.size();
+  crc = crc32(crc, reinterpret_cast<const Bytef*>(data.data()), data.size());
+  ++unsynced;
+  add(slice);
+  return true;
+};
+
+bool PartFile::Sync() {
+  if (fd < 0) return false;
+  if (fdatasync(fd) != 0) return false;
+  unsynced = 0;
+  return true;
+};
+
+bool PartFile::Close() {
+  if (fd < 0) return false;
+
+  bool ok = true;
+  std::string final_header = header;
+  if (!journal) {
+    // fill in the count
+    unsigned long count = slices;
+    size_t offset = header.size() - sizeof(count);
+    final_header.replace(
+        offset, sizeof(count), reinterpret_cast<const char*>(&count), sizeof(count)
+    );
+    ok = write_all(&count, sizeof(count), offset);
+  };
+
+  // release the unused preallocation
+  ok = ftruncate(fd, bytes) == 0 && ok;
+  ok = fdatasync(fd) == 0 && ok;
+  ok = close(fd) == 0 && ok;
+  fd = -1;
+  unsynced = 0;
+
+  uLong file_crc = crc32(0, Z_NULL, 0);
+  file_crc = crc32(
+      file_crc,
+      reinterpret_cast<const Bytef*>(final_header.data()),
+      final_header.size()
+  );
+  file_crc = crc32_combine(file_crc, crc, bytes - header.size());
+
+  manifest.Set("file",     filename);
+  manifest.Set("journal",  journal);
+  manifest.Set("bytes",    bytes);
+  manifest.Set("crc32",    file_crc);
+  manifest.Set("slices",   slices);
+  manifest.Set("hits",     hits);
+  manifest.Set("first_ns", first.ns());
+  manifest.Set("last_ns",  last.ns());
+
+  std::string json;
+  manifest >> json;
+  json += '\n';
+
+  std::string sidecar = filename + ".json";
+  int mfd = ::open(sidecar.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (mfd < 0) return false;
+  const char* p = json.data();
+  size_t size = json.size();
+  while (size > 0) {
+    ssize_t n = write(mfd, p, size);
+    if (n < 0) {
+      if (errno == EINTR) continue;
+      close(mfd);
+      return false;
+    };
+    p    += n;
+    size -= n;
+  };
+  ok = close(mfd) == 0 && ok;
+
+  return ok;
+};
@@ -0,0 +1,123 @@
+#ifndef PART_FILE_H
+#define PART_FILE_H
+
+#include <cstdint>
+#include <string>
+
+#include <sys/types.h>
+
+#include <Store.h>
+#include <TimeSlice.h>
+
+using namespace ToolFramework;
+
+// Output part file written through a plain file descriptor.
+//
+// A part opened with Open is laid out as `header`, the number of timeslices
+// (unsigned long) and the serialised timeslices appended with Write, i.e. the
+// same layout as a BinaryStream holding the header, the count and the slices.
+// The count is not known while the part is open and is filled in by Close
+// with pwrite, so a part can be closed after any slice, but a part left by a
+// crashed writer has a wrong count.
+//
+// A part opened with OpenJournal is append only and has no count:
+//   uint64_t journal_magic
+//   uint32_t journal_version
+//   uint32_t compression level of the blocks (0 for none)
+//   per timeslice, appended with WriteBlock:
+//     uint64_t encoded size (see SliceCodec)
+//     uint32_t payload size
+//     uint32_t CRC-32 of the two sizes and the payload
+//     payload: SliceCodec encoding, zlib compressed if the level is not 0
+// Version 1 blocks stored the payload size, a 32 bit encoded size and the
+// CRC-32. Version 3 blocks are laid out as version 2 ones, their payload
+// carries the run stamp (SliceCodec version 3). JournalReader reads all three
+// versions.
+// The number of slices is the number of valid blocks. Sync makes the blocks
+// written so far durable, so after a crash the part is intact up to the last
+// synced block; JournalReader finds the end of the intact part and
+// OpenJournal resumes appending there if the part already exists with the
+// same version and compression level.
+//
+// An existing file is never overwritten: Open, and OpenJournal when it cannot
+// resume the part, fail with Refused set, and the writer moves on to another
+// file name.
+//
+// Open and OpenJournal reserve the expected size with fallocate to keep the
+// part contiguous on disk; Close releases whatever was not used. Close also
+// writes a JSON manifest next to the part (`<filename>.json`) with the slice
+// and hit counts, the time range of the data, the size and the CRC-32 of the
+// whole part, plus any fields set in `manifest` by the writer after opening.
+class PartFile {
+  public:
+    static const uint64_t journal_magic   = 0x4c4e524a4e545542ULL; // "BUTNJRNL"
+    static const uint32_t journal_version = 3;
+    static const uint32_t journal_max_block = 1u << 30;
+    static const size_t   journal_block_header = sizeof(uint64_t) + 2 * sizeof(uint32_t);
+
+    PartFile();
+    ~PartFile();
+
+    bool Open(
+        const std::string& filename,
+        const std::string& header,
+        uint64_t preallocate = 0
+    );
+
+    bool OpenJournal(
+        const std::string& filename,
+        int level,
+        uint64_t preallocate = 0
+    );
+
+    // Append one serialised timeslice to a part opened with Open
+    bool Write(const std::string& data, const TimeSlice& slice);
+
+    // Append one SliceCodec block to a part opened with OpenJournal
+    bool WriteBlock(
+        uint64_t raw_size, const std::string& payload, const TimeSlice& slice
+    );
+
+    // Flush the data written so far to the disk
+    bool Sync();
+
+    bool Close();
+
+    bool IsOpen()    const { return fd >= 0; };
+    bool IsJournal() const { return journal; };
+    // Whether the last Open or OpenJournal failed because the file exists
+    bool Refused()   const { return refused; };
+
+    const std::string& Filename() const { return filename; };
+    uint64_t Bytes()    const { return bytes; };
+    uint64_t Slices()   const { return slices; };
+    uint64_t Hits()     const { return hits; };
+    // Blocks written since the last Sync
+    uint64_t Unsynced() const { return unsynced; };
+
+    // Time span of the data written so far
+    Time First() const { return first; };
+    Time Last()  const { return last; };
+
+    Store manifest;
+
+  private:
+    bool write_all(const void* data, size_t size, off_t offset);
+    bool open(const std::string& filename, int flags, uint64_t preallocate);
+    void add(const TimeSlice& slice);
+
+    int         fd;
+    bool        journal;
+    bool        refused;
+    std::string filename;
+    std::string header;     // bytes before the data, including the count
+    uint64_t    bytes;
+    uint64_t    slices;
+    uint64_t    hits;
+    uint64_t    unsynced;
+    Time        first;
+    Time        last;
+    unsigned long crc;      // CRC-32 of the data after the header
+};
+
+#endif
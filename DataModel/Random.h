@@ -0,0 +1,46 @@
+#ifndef RANDOM_H
+#define RANDOM_H
+
+#include <cmath>
+#include <cstdint>
+
+// Counter based pseudo random number generator.
+//
+// The n-th number of a stream is a pure function of the stream key and n
+// (SplitMix64 finaliser applied to key + n * golden ratio), so there is no
+// shared state: every job can create its own generator on the stack, and a
+// stream keyed by e.g. the run number and the timeslice time gives the same
+// numbers whichever worker thread processes the slice.
+class CounterRNG {
+  public:
+    CounterRNG(uint64_t key, uint64_t stream = 0):
+      key(mix(key ^ mix(stream + 0x9e3779b97f4a7c15ULL))),
+      counter(0)
+    {};
+
+    static uint64_t mix(uint64_t x) {
+      x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+      x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+      return x ^ (x >> 31);
+    };
+
+    uint64_t next() {
+      return mix(key + ++counter * 0x9e3779b97f4a7c15ULL);
+    };
+
+    // Uniform in [0, 1)
+    double uniform() {
+      return (next() >> 11) * (1.0 / 9007199254740992.0); // 2^-53
+    };
+
+    // Exponentially distributed with the given rate
+    double exponential(double rate) {
+      return -std::log1p(-uniform()) / rate;
+    };
+
+  private:
+    uint64_t key;
+    uint64_t counter;
+};
+
+#endif
@@ -0,0 +1,207 @@
+#include <cstddef>
+#include <cstring>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "DataModel.h"
+#include "SharedRing.h"
+#include "SliceCodec.h"
+
+const uint64_t SharedRing::magic;
+const uint32_t SharedRing::version;
+
+static const size_t header_size = 64;
+
+SharedRing::SharedRing():
+  header(nullptr), length(0), writer(false),
+  next(0), current(0), sequence(0), lost(0)
+{};
+
+SharedRing::~SharedRing() {
+  Detach();
+};
+
+SharedRing::Slot* SharedRing::slot(uint64_t n) const {
+  return reinterpret_cast<Slot*>(
+      reinterpret_cast<char*>(header)
+      + header_size
+      + n % header->slots * header->stride
+  );
+};
+
+bool SharedRing::Create(
+    const std::string& name_, uint32_t slots, uint64_t slot_size
+) {
+  Detach();
+  if (slots == 0 || slot_size == 0) return false;
+
+  uint64_t stride = (offsetof(Slot, data) + slot_size + 63) / 64 * 64;
+  length = header_size + slots * stride;
+
+  // replace a ring left by a previous run, attached readers keep the old one
+  shm_unlink(name_.c_str());
+  int fd = shm_open(name_.c_str(), O_RDWR | O_CREAT | O_EXCL, 0644);
+  if (fd < 0) return false;
+  if (ftruncate(fd, length) != 0) {
+    close(fd);
+    shm_unlink(name_.c_str());
+    return false;
+  };
+
+  void* p = mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if (p == MAP_FAILED) {
+    shm_unlink(name_.c_str());
+    return false;
+  };
+
+  // the object is zero filled, so all slot sequences start at 0 (empty)
+  header            = static_cast<Header*>(p);
+  header->slots     = slots;
+  header->slot_size = slot_size;
+  header->stride    = stride;
+  header->published.store(0, std::memory_order_relaxed);
+  header->oversized.store(0, std::memory_order_relaxed);
+  header->version   = version;
+  std::atomic_thread_fence(std::memory_order_release);
+  header->magic     = magic;
+
+  name   = name_;
+  writer = true;
+  return true;
+};
+
+bool SharedRing::Attach(const std::string& name_) {
+  Detach();
+
+  int fd = shm_open(name_.c_str(), O_RDONLY, 0);
+  if (fd < 0) return false;
+
+  struct stat st;
+  if (fstat(fd, &st) != 0 || static_cast<size_t>(st.st_size) < header_size) {
+    close(fd);
+    return false;
+  };
+  length = st.st_size;
+
+  void* p = mmap(nullptr, length, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (p == MAP_FAILED) return false;
+
+  header = static_cast<Header*>(p);
+  if (
+         header->magic   != magic
+      || header->version != version
+      || header_size + header->slots * header->stride > length
+  ) {
+    Detach();
+    return false;
+  };
+
+  name     = name_;
+  writer   = false;
+  next     = header->published.load(std::memory_order_acquire);
+  current  = 0;
+  sequence = 0;
+  lost     = 0;
+  return true;
+};
+
+void SharedRing::Detach() {
+  if (!header) return;
+  munmap(header, length);
+  if (writer) shm_unlink(name.c_str());
+  header = nullptr;
+  length = 0;
+  writer = false;
+};
+
+bool SharedRing::Publish(const std::string& encoded) {
+  if (!header || !writer) return false;
+
+  if (encoded.size() > header->slot_size) {
+    header->oversized.fetch_add(1, std::memory_order_relaxed);
+    return false;
+  };
+
+  uint64_t n = header->published.load(std::memory_order_relaxed);
+  Slot* s = slot(n);
+  s->sequence.store(2 * n + 1, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+  s->size = encoded.size();
+  memcpy(s->data, encoded.data(), encoded.size());
+  s->sequence.store(2 * n + 2, std::memory_order_release);
+  header->published.store(n + 1, std::memory_order_release);
+  return true;
+};
+
+bool SharedRing::Next(const char*& data, size_t& size) {
+  if (!header) return false;
+
+  while (true) {
+    uint64_t published = header->published.load(std::memory_order_acquire);
+    if (next >= published) return false;
+
+    // the slots older than the last `slots` slices have been overwritten
+    if (published - next > header->slots) {
+      lost += published - header->slots - next;
+      next  = published - header->slots;
+    };
+
+    Slot* s = slot(next);
+    uint64_t seq = s->sequence.load(std::memory_order_acquire);
+    if (seq != 2 * next + 2) {
+      // overwritten since `published` was read
+      ++lost;
+      ++next;
+      continue;
+    };
+
+    current  = next++;
+    sequence = seq;
+    size     = s->size;
+    data     = s->data;
+    if (size > header->slot_size || !Valid()) {
+      ++lost;
+      continue;
+    };
+    return true;
+  };
+};
+
+bool SharedRing::Valid() const {
+  if (!header) return false;
+  std::atomic_thread_fence(std::memory_order_acquire);
+  return slot(current)->sequence.load(std::memory_order_relaxed) == sequence;
+};
+
+bool SharedRing::Read(TimeSlice& slice) {
+  const char* data;
+  size_t size;
+  while (Next(data, size)) {
+    slice.hits.clear();
+    slice.triggers.clear();
+    if (SliceCodec::decode(data, size, slice) && Valid()) return true;
+    ++lost;
+  };
+  return false;
+};
+
+uint32_t SharedRing::Slots() const {
+  return header ? header->slots : 0;
+};
+
+uint64_t SharedRing::SlotSize() const {
+  return header ? header->slot_size : 0;
+};
+
+uint64_t SharedRing::Published() const {
+  return header ? header->published.load(std::memory_order_acquire) : 0;
+};
+
+uint64_t SharedRing::Oversized() const {
+  return header ? header->oversized.load(std::memory_order_relaxed) : 0;
+};
@@ -0,0 +1,93 @@
+#ifndef SHARED_RING_H
+#define SHARED_RING_H
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+#include <TimeSlice.h>
+
+// Ring of timeslices in POSIX shared memory for local online analysis.
+//
+// The DAQ creates the ring and publishes every timeslice into it (SliceCodec
+// encoding, one slice per slot). Readers attach read only, so they can never
+// slow down or corrupt the writer: the writer always overwrites the oldest
+// slot, and a reader that falls behind skips the slices it lost and counts
+// them.
+//
+// Every slot carries a sequence number which is odd while the slot is being
+// written (a seqlock). Next gives a reader a pointer straight into the shared
+// memory; Valid tells whether the slot was overwritten while it was being
+// used, in which case whatever was read from it must be discarded.
+//
+// Layout: a 64 byte header followed by `slots` slots of
+//   uint64_t sequence  2n+1 while slice n is written, 2n+2 once it is complete
+//   uint64_t size of the encoded slice
+//   char     data[slot_size]
+// padded to 64 bytes.
+class SharedRing {
+  public:
+    static const uint64_t magic   = 0x474e49524e545542ULL; // "BUTNRING"
+    static const uint32_t version = 2; // 2: slices carry the run stamp
+
+    SharedRing();
+    ~SharedRing();
+
+    // Writer: create (or replace) the shared memory object `name`
+    bool Create(const std::string& name, uint32_t slots, uint64_t slot_size);
+    // Reader: attach to an existing ring, starting with the next slice published
+    bool Attach(const std::string& name);
+    // Unmap the ring. The writer also removes the shared memory object.
+    void Detach();
+
+    // Writer: returns false if the slice does not fit in a slot
+    bool Publish(const std::string& encoded);
+
+    // Reader: zero copy view of the next slice, false if there is none yet
+    bool Next(const char*& data, size_t& size);
+    // Reader: whether the slice returned by the last Next is still intact
+    bool Valid() const;
+    // Reader: decode the next intact slice
+    bool Read(TimeSlice& slice);
+
+    bool IsOpen() const { return header != nullptr; };
+
+    uint32_t Slots()     const;
+    uint64_t SlotSize()  const;
+    uint64_t Published() const; // slices published since the ring was created
+    uint64_t Oversized() const; // slices not published for not fitting in a slot
+    uint64_t Lost()      const { return lost; }; // slices this reader missed
+
+  private:
+    struct Header {
+      uint64_t magic;
+      uint32_t version;
+      uint32_t slots;
+      uint64_t slot_size;
+      uint64_t stride;
+      std::atomic<uint64_t> published;
+      std::atomic<uint64_t> oversized;
+    };
+    static_assert(sizeof(Header) <= 64, "SharedRing header must fit in 64 bytes");
+
+    struct Slot {
+      std::atomic<uint64_t> sequence;
+      uint64_t size;
+      char data[1];
+    };
+
+    Slot* slot(uint64_t n) const;
+
+    std::string name;
+    Header*     header;
+    size_t      length;
+    bool        writer;
+
+    // reader state
+    uint64_t next;
+    uint64_t current;
+    uint64_t sequence;
+    uint64_t lost;
+};
+
+#endif
@@ -0,0 +1,131 @@
+#include "DataModel.h"
+#include "SliceBudget.h"
+
+SliceBudget::SliceBudget():
+  max_bytes(0),
+  policy_(Policy::block),
+  shed_bytes(0),
+  zero_bias_prescale(1),
+  used(0),
+  peak(0),
+  dropped_slices(0),
+  shed_untriggered(0),
+  shed_zero_bias(0),
+  zero_bias_seen(0),
+  blocked_ns(0)
+{};
+
+void SliceBudget::Configure(
+    uint64_t max_bytes,
+    Policy   policy,
+    double   shed_fraction,
+    unsigned zero_bias_prescale
+) {
+  this->max_bytes          = max_bytes;
+  this->policy_            = policy;
+  this->shed_bytes         = max_bytes * shed_fraction;
+  this->zero_bias_prescale = zero_bias_prescale ? zero_bias_prescale : 1;
+  // waiting producers re-check against the new limit
+  released.notify_all();
+};
+
+uint64_t SliceBudget::Size(const TimeSlice& slice) {
+  uint64_t size = sizeof(TimeSlice);
+  size += slice.hits.capacity() * sizeof(Hit);
+  for (auto& hit : slice.hits)
+    size += hit.waveform.capacity() * sizeof(uint16_t);
+  size += slice.triggers.capacity() * sizeof(TriggerInfo);
+  size += slice.index.offsets.capacity() * sizeof(uint32_t);
+  return size;
+};
+
+void SliceBudget::add(TimeSlice& slice, uint64_t size) {
+  slice.budget_bytes = size;
+  uint64_t now  = used.fetch_add(size, std::memory_order_relaxed) + size;
+  uint64_t high = peak.load(std::memory_order_relaxed);
+  while (now > high && !peak.compare_exchange_weak(high, now, std::memory_order_relaxed));
+};
+
+bool SliceBudget::Reserve(TimeSlice& slice, std::chrono::milliseconds wait) {
+  return Reserve(slice, Size(slice), wait);
+};
+
+bool SliceBudget::Reserve(
+    TimeSlice& slice, uint64_t size, std::chrono::milliseconds wait
+) {
+  if (!max_bytes || used.load(std::memory_order_relaxed) + size <= max_bytes) {
+    add(slice, size);
+    return true;
+  };
+
+  if (policy_ != Policy::block) return false;
+
+  // A slice larger than the whole budget is let through once the pipeline is
+  // empty, otherwise it would block forever.
+  auto start = std::chrono::steady_clock::now();
+  bool fits;
+  {
+    std::unique_lock<std::mutex> lock(mutex);
+    fits = released.wait_for(
+        lock,
+        wait,
+        [this, size]() -> bool {
+          uint64_t u = used.load(std::memory_order_relaxed);
+          return !max_bytes || u + size <= max_bytes || u == 0;
+        }
+    );
+  };
+  blocked_ns.fetch_add(
+      std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now() - start
+      ).count(),
+      std::memory_order_relaxed
+  );
+
+  if (fits) add(slice, size);
+  return fits;
+};
+
+void SliceBudget::Force(TimeSlice& slice) {
+  add(slice, Size(slice));
+};
+
+void SliceBudget::Force(TimeSlice& slice, uint64_t size) {
+  add(slice, size);
+};
+
+void SliceBudget::Release(TimeSlice& slice) {
+  if (!slice.budget_bytes) return;
+  used.fetch_sub(slice.budget_bytes, std::memory_order_relaxed);
+  slice.budget_bytes = 0;
+  if (policy_ == Policy::block) {
+    // taking the mutex orders the update with a producer about to wait
+    std::lock_guard<std::mutex> lock(mutex);
+    released.notify_all();
+  };
+};
+
+bool SliceBudget::Shed(const TimeSlice& slice) {
+  if (!max_bytes || used.load(std::memory_order_relaxed) <= shed_bytes)
+    return false;
+
+  if (slice.triggers.empty()) {
+    shed_untriggered.fetch_add(1, std::memory_order_relaxed);
+    return true;
+  };
+
+  for (auto& trigger : slice.triggers)
+    if (trigger.type != TriggerType::zero_bias) return false;
+
+  if (zero_bias_seen.fetch_add(1, std::memory_order_relaxed) % zero_bias_prescale == 0)
+    return false;
+  shed_zero_bias.fetch_add(1, std::memory_order_relaxed);
+  return true;
+};
+
+void SliceBudget::Drop(TimeSlice& slice) {
+  for (auto& hit : slice.hits)
+    if (slice.InCore(hit.time)) dropped_hits.Add(hit.channel);
+  dropped_slices.fetch_add(1, std::memory_order_relaxed);
+  Release(slice);
+};
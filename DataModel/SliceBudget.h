@@ -0,0 +1,98 @@
+#ifndef SLICE_BUDGET_H
+#define SLICE_BUDGET_H
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+
+#include "ChannelCounters.h"
+#include "TimeSlice.h"
+
+// Memory budget of the TimeSlices in flight between the Reformatter and the
+// FileWriter.
+//
+// The Reformatter reserves the heap footprint of every slice before queueing
+// it, the consumer at the end of the pipeline releases it. When the budget is
+// exhausted the Reformatter either blocks until memory is released (`block`)
+// or drops the new slice (`drop`). Before that point is reached the Trigger
+// jobs shed load once the usage exceeds `shed_fraction` of the budget:
+// untriggered slices are dropped first, and slices with only zero bias
+// triggers are prescaled by `zero_bias_prescale`.
+//
+// Only the core hits of a dropped slice are counted in `dropped_hits`, so
+// every lost hit is counted exactly once per channel.
+class SliceBudget {
+  public:
+    enum class Policy { block, drop };
+
+    SliceBudget();
+
+    // max_bytes == 0 disables the budget and the shedding
+    void Configure(
+        uint64_t max_bytes,
+        Policy   policy,
+        double   shed_fraction,
+        unsigned zero_bias_prescale
+    );
+
+    Policy policy() const { return policy_; };
+
+    // Heap footprint of a slice
+    static uint64_t Size(const TimeSlice&);
+
+    // Account the slice if it fits. With the block policy wait up to `wait`
+    // for the consumers to release memory. Returns false if the slice was not
+    // accounted.
+    bool Reserve(TimeSlice&, std::chrono::milliseconds wait);
+
+    // Same with the size given, for a slice that is not filled yet
+    bool Reserve(TimeSlice&, uint64_t size, std::chrono::milliseconds wait);
+
+    // Account the slice regardless of the budget, e.g. while stopping
+    void Force(TimeSlice&);
+    void Force(TimeSlice&, uint64_t size);
+
+    // Return the memory of a slice leaving the pipeline
+    void Release(TimeSlice&);
+
+    // Whether a triggered slice should be dropped to relieve memory pressure.
+    // Counts the decision in the shed counters.
+    bool Shed(const TimeSlice&);
+
+    // Count the core hits of a slice that is being discarded and release it
+    void Drop(TimeSlice&);
+
+    uint64_t Used()           const { return used.load(std::memory_order_relaxed); };
+    uint64_t Peak()           const { return peak.load(std::memory_order_relaxed); };
+    uint64_t Max()            const { return max_bytes; };
+    uint64_t DroppedSlices()  const { return dropped_slices.load(std::memory_order_relaxed); };
+    uint64_t ShedUntriggered() const { return shed_untriggered.load(std::memory_order_relaxed); };
+    uint64_t ShedZeroBias()   const { return shed_zero_bias.load(std::memory_order_relaxed); };
+    double   BlockedSeconds() const { return blocked_ns.load(std::memory_order_relaxed) * 1e-9; };
+
+    ChannelCounters dropped_hits;
+
+  private:
+    uint64_t max_bytes;
+    Policy   policy_;
+    uint64_t shed_bytes;
+    unsigned zero_bias_prescale;
+
+    std::atomic<uint64_t> used;
+    std::atomic<uint64_t> peak;
+    std::atomic<uint64_t> dropped_slices;
+    std::atomic<uint64_t> shed_untriggered;
+    std::atomic<uint64_t> shed_zero_bias;
+    std::atomic<uint64_t> zero_bias_seen;
+    std::atomic<uint64_t> blocked_ns;
+
+    // the block policy waits on this for Release
+    std::mutex              mutex;
+    std::condition_variable released;
+
+    void add(TimeSlice&, uint64_t size);
+};
+
+#endif
@@ -0,0 +1,214 @@
+#include <algorithm>
+
+#include <zlib.h>
+
+#include "DataModel.h"
+#include "SliceCodec.h"
+
+const uint64_t SliceCodec::magic;
+const uint32_t SliceCodec::version;
+const uint64_t SliceCodec::stamp_tag;
+const uint64_t SliceCodec::max_ratio;
+
+static void put_varint(std::string& out, uint64_t value) {
+  while (value >= 0x80) {
+    out.push_back(static_cast<char>(value | 0x80));
+    value >>= 7;
+  };
+  out.push_back(static_cast<char>(value));
+};
+
+static uint64_t zigzag(int64_t value) {
+  return static_cast<uint64_t>(value) << 1 ^ static_cast<uint64_t>(value >> 63);
+};
+
+static int64_t unzigzag(uint64_t value) {
+  return static_cast<int64_t>(value >> 1) ^ -static_cast<int64_t>(value & 1);
+};
+
+namespace {
+  class Input {
+    public:
+      Input(const char* data, size_t size):
+        p(reinterpret_cast<const uint8_t*>(data)),
+        end(p + size)
+      {};
+
+      bool varint(uint64_t& value) {
+        value = 0;
+        for (int shift = 0; shift < 64 && p < end; shift += 7) {
+          uint8_t byte = *p++;
+          value |= static_cast<uint64_t>(byte & 0x7f) << shift;
+          if (!(byte & 0x80)) return true;
+        };
+        return false;
+      };
+
+      template <typename Int>
+      bool varint(Int& value) {
+        uint64_t v;
+        if (!varint(v)) return false;
+        value = static_cast<Int>(v);
+        return true;
+      };
+
+      bool byte(uint8_t& value) {
+        if (p >= end) return false;
+        value = *p++;
+        return true;
+      };
+
+      bool done() const { return p == end; };
+
+    private:
+      const uint8_t* p;
+      const uint8_t* end;
+  };
+}
+
+void SliceCodec::encode(const TimeSlice& slice, std::string& raw) {
+  raw.clear();
+  raw.reserve(slice.hits.size() * 12);
+
+  put_varint(raw, stamp_tag);
+  put_varint(raw, slice.run);
+  put_varint(raw, slice.sub_run);
+  put_varint(raw, slice.time.bits());
+  put_varint(raw, slice.end.bits());
+
+  put_varint(raw, slice.triggers.size());
+  for (auto& trigger : slice.triggers) {
+    put_varint(raw, static_cast<uint64_t>(trigger.type));
+    put_varint(raw, zigzag(trigger.time.bits() - slice.time.bits()));
+  };
+
+  put_varint(raw, slice.hits.size());
+
+  uint64_t time = slice.time.bits();
+  for (auto& hit : slice.hits) {
+    put_varint(raw, zigzag(hit.time.bits() - time));
+    time = hit.time.bits();
+  };
+
+  for (auto& hit : slice.hits) raw.push_back(static_cast<char>(hit.channel));
+  for (auto& hit : slice.hits) put_varint(raw, hit.charge_short);
+  for (auto& hit : slice.hits) put_varint(raw, hit.charge_long);
+  for (auto& hit : slice.hits) put_varint(raw, hit.baseline);
+  for (auto& hit : slice.hits) put_varint(raw, hit.waveform.size());
+
+  for (auto& hit : slice.hits) {
+    int64_t sample = 0;
+    for (uint16_t s : hit.waveform) {
+      put_varint(raw, zigzag(s - sample));
+      sample = s;
+    };
+  };
+};
+
+bool SliceCodec::decode(const std::string& raw, TimeSlice& slice) {
+  return decode(raw.data(), raw.size(), slice);
+};
+
+bool SliceCodec::decode(const char* raw, size_t length, TimeSlice& slice) {
+  Input in(raw, length);
+  uint64_t value;
+  size_t size;
+
+  if (!in.varint(value)) return false;
+  if (value & stamp_tag) {
+    uint64_t run, sub_run;
+    if (value != stamp_tag) return false;
+    if (!in.varint(run) || !in.varint(sub_run) || !in.varint(value))
+      return false;
+    slice.run     = run;
+    slice.sub_run = sub_run;
+  };
+  slice.time = Time(value);
+  if (!in.varint(value)) return false;
+  slice.end = Time(value);
+
+  // every element takes at least one byte, which also guards the allocations
+  // against corrupted sizes
+  if (!in.varint(size) || size > length) return false;
+  slice.triggers.resize(size);
+  for (auto& trigger : slice.triggers) {
+    if (!in.varint(value)) return false;
+    trigger.type = static_cast<TriggerType>(value);
+    if (!in.varint(value)) return false;
+    trigger.time = Time(slice.time.bits() + unzigzag(value));
+  };
+
+  if (!in.varint(size) || size > length) return false;
+  slice.hits.resize(size);
+
+  uint64_t time = slice.time.bits();
+  for (auto& hit : slice.hits) {
+    if (!in.varint(value)) return false;
+    time += unzigzag(value);
+    hit.time = Time(time);
+  };
+
+  for (auto& hit : slice.hits) if (!in.byte(hit.channel)) return false;
+  for (auto& hit : slice.hits) if (!in.varint(hit.charge_short)) return false;
+  for (auto& hit : slice.hits) if (!in.varint(hit.charge_long)) return false;
+  for (auto& hit : slice.hits) if (!in.varint(hit.baseline)) return false;
+  for (auto& hit : slice.hits) {
+    if (!in.varint(size) || size > length) return false;
+    hit.waveform.resize(size);
+  };
+
+  for (auto& hit : slice.hits) {
+    int64_t sample = 0;
+    for (auto& s : hit.waveform) {
+      if (!in.varint(value)) return false;
+      sample += unzigzag(value);
+      s = static_cast<uint16_t>(sample);
+    };
+  };
+
+  if (!in.done()) return false;
+
+  slice.index.clear();
+  if (std::is_sorted(
+        slice.hits.begin(),
+        slice.hits.end(),
+        [](const Hit& a, const Hit& b) -> bool { return a.time < b.time; }
+      ))
+    slice.BuildIndex();
+
+  return true;
+};
+
+bool SliceCodec::compress(
+    const std::string& raw, std::string& compressed, int level
+) {
+  uLongf size = compressBound(raw.size());
+  compressed.resize(size);
+  int status = compress2(
+      reinterpret_cast<Bytef*>(&compressed[0]),
+      &size,
+      reinterpret_cast<const Bytef*>(raw.data()),
+      raw.size(),
+      level
+  );
+  if (status != Z_OK) return false;
+  compressed.resize(size);
+  return true;
+};
+
+bool SliceCodec::decompress(
+    const std::string& compressed, uint64_t raw_size, std::string& raw
+) {
+  // the size is read from the file, do not allocate what cannot be right
+  if (raw_size > compressed.size() * max_ratio) return false;
+
+  raw.resize(raw_size);
+  uLongf size = raw_size;
+  int status = uncompress(
+      reinterpret_cast<Bytef*>(&raw[0]),
+      &size,
+      reinterpret_cast<const Bytef*>(compressed.data()),
+      compressed.size()
+  );
+  return status == Z_OK && size == raw_size;
+};
@@ -0,0 +1,53 @@
+#ifndef SLICE_CODEC_H
+#define SLICE_CODEC_H
+
+#include <cstdint>
+#include <string>
+
+#include <TimeSlice.h>
+
+// Compact encoding of TimeSlices for the compressed part files.
+//
+// A block starts with stamp_tag and the run and sub run of the slice, then the
+// slice time, end and triggers. Blocks written before version 3 start with the
+// slice time: times fit in 57 bits, so a word with bit 63 set cannot be one,
+// and decode leaves the run and sub run of such blocks as they are.
+//
+// Hits are stored column by column: times as zigzag varint deltas from the
+// previous hit (small and positive after sorting), channels as bytes, charges
+// and baselines as varints, and waveform samples as zigzag varint deltas from
+// the previous sample. The encoded block is then deflated with zlib.
+//
+// A compressed part file written by FileWriter is a BinaryStream holding:
+//   uint64_t    SliceCodec::magic
+//   uint32_t    SliceCodec::version (3 since the run stamp)
+//   uint64_t    number of timeslices
+//   per timeslice:
+//     uint64_t    encoded size (uint32_t in version 1)
+//     std::string compressed block
+// Uncompressed part files start directly with the number of timeslices.
+class SliceCodec {
+  public:
+    static const uint64_t magic   = 0x52504d434e545542ULL; // "BUTNCMPR"
+    static const uint32_t version = 3;
+    static const uint64_t stamp_tag = 1ULL << 63;
+    // deflate expands by at most this factor, a larger encoded size is corrupt
+    static const uint64_t max_ratio = 1032;
+
+    // Delta encode a TimeSlice into `raw`
+    static void encode(const TimeSlice& slice, std::string& raw);
+
+    // Decode a block produced by `encode`. Returns false on malformed data.
+    static bool decode(const std::string& raw, TimeSlice& slice);
+    static bool decode(const char* raw, size_t length, TimeSlice& slice);
+
+    // zlib level 1 (fastest) to 9 (smallest)
+    static bool compress(const std::string& raw, std::string& compressed, int level);
+    // Returns false on malformed data, including a `raw_size` that the
+    // compressed block cannot expand to
+    static bool decompress(
+        const std::string& compressed, uint64_t raw_size, std::string& raw
+    );
+};
+
+#endif
@@ -0,0 +1,65 @@
+#include "DataModel.h"
+#include "SliceSampler.h"
+
+const size_t SliceSampler::trigger_types;
+
+SliceSampler::SliceSampler():
+  policy(Policy::none),
+  every(1),
+  candidates(0),
+  seen(0),
+  selected(0)
+{
+  prescales.fill(1);
+  type_counts.fill(0);
+};
+
+void SliceSampler::Configure(
+    Policy policy,
+    uint64_t every,
+    const std::array<uint64_t, trigger_types>& prescales
+) {
+  std::lock_guard<std::mutex> lock(mutex);
+  this->policy    = policy;
+  this->every     = every ? every : 1;
+  this->prescales = prescales;
+};
+
+bool SliceSampler::Select(const TimeSlice& slice) {
+  seen.fetch_add(1, std::memory_order_relaxed);
+
+  bool select = false;
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    switch (policy) {
+      case Policy::none:
+        break;
+
+      case Policy::triggered:
+        if (slice.triggers.empty()) break;
+        // fall through
+      case Policy::nth:
+        select = candidates++ % every == 0;
+        break;
+
+      case Policy::prescaled:
+        {
+          std::array<bool, trigger_types> present;
+          present.fill(false);
+          for (auto& trigger : slice.triggers) {
+            size_t type = static_cast<size_t>(trigger.type);
+            if (type < trigger_types) present[type] = true;
+          };
+          for (size_t type = 0; type < trigger_types; ++type) {
+            if (!present[type]) continue;
+            uint64_t count = type_counts[type]++;
+            if (prescales[type] && count % prescales[type] == 0) select = true;
+          };
+        };
+        break;
+    };
+  };
+
+  if (select) selected.fetch_add(1, std::memory_order_relaxed);
+  return select;
+};
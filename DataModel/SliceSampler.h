@@ -0,0 +1,54 @@
+#ifndef SLICE_SAMPLER_H
+#define SLICE_SAMPLER_H
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+
+#include "TimeSlice.h"
+
+// Selection of the written TimeSlices handed to Monitoring for publishing.
+//
+// The FileWriter asks for every slice it writes, so slices that are not
+// selected are freed right away instead of queueing for Monitoring, which
+// configures the policy:
+//   none       no slices (until Monitoring is configured)
+//   nth        every `every`-th slice
+//   triggered  every `every`-th slice with at least one trigger
+//   prescaled  slices with a trigger type whose count, over the slices
+//              carrying it, is a multiple of its prescale; prescale 0 never
+//              selects that type
+class SliceSampler {
+  public:
+    enum class Policy { none, nth, triggered, prescaled };
+
+    static const size_t trigger_types = static_cast<size_t>(TriggerType::psd) + 1;
+
+    SliceSampler();
+
+    void Configure(
+        Policy policy,
+        uint64_t every,
+        const std::array<uint64_t, trigger_types>& prescales
+    );
+
+    bool Select(const TimeSlice&);
+
+    uint64_t Seen()     const { return seen.load(std::memory_order_relaxed); };
+    uint64_t Selected() const { return selected.load(std::memory_order_relaxed); };
+
+  private:
+    std::mutex mutex;
+    Policy policy;
+    uint64_t every;
+    std::array<uint64_t, trigger_types> prescales;
+
+    uint64_t candidates; // counted by the nth and triggered policies
+    std::array<uint64_t, trigger_types> type_counts;
+
+    std::atomic<uint64_t> seen;
+    std::atomic<uint64_t> selected;
+};
+
+#endif
@@ -0,0 +1,185 @@
+#include <cstring>
+
+#include "DataModel.h"
+#include "SliceCodec.h"
+#include "StageLink.h"
+
+const uint32_t StageLink::magic;
+const uint32_t StageLink::version;
+const uint32_t StageLink::slice_magic;
+const uint32_t StageLink::slice_version;
+
+template <typename T>
+static void put(std::string& out, T value) {
+  out.append(reinterpret_cast<const char*>(&value), sizeof(value));
+};
+
+namespace {
+  class Reader {
+    public:
+      Reader(const char* data, size_t size): p(data), end(data + size) {};
+
+      template <typename T>
+      bool get(T& value) {
+        if (static_cast<size_t>(end - p) < sizeof(value)) return false;
+        memcpy(&value, p, sizeof(value));
+        p += sizeof(value);
+        return true;
+      };
+
+      bool get(uint16_t* values, size_t n) {
+        if (static_cast<size_t>(end - p) / sizeof(uint16_t) < n) return false;
+        memcpy(values, p, n * sizeof(uint16_t));
+        p += n * sizeof(uint16_t);
+        return true;
+      };
+
+      size_t left() const { return end - p; };
+
+    private:
+      const char* p;
+      const char* end;
+  };
+}
+
+void StageLink::EncodeHeader(
+    std::string& batch,
+    unsigned long run,
+    unsigned long sub_run,
+    uint32_t boards
+) {
+  put<uint32_t>(batch, magic);
+  put<uint32_t>(batch, version);
+  put<uint64_t>(batch, run);
+  put<uint64_t>(batch, sub_run);
+  put<uint32_t>(batch, boards);
+};
+
+void StageLink::EncodeBoard(std::string& batch, const std::vector<Hit>& hits) {
+  put<uint32_t>(batch, hits.size());
+  for (auto& hit : hits) {
+    put<uint64_t>(batch, hit.time.bits());
+    put<uint16_t>(batch, hit.charge_short);
+    put<uint16_t>(batch, hit.charge_long);
+    put<uint16_t>(batch, hit.baseline);
+    put<uint8_t> (batch, hit.channel);
+    put<uint32_t>(batch, hit.waveform.size());
+    batch.append(
+        reinterpret_cast<const char*>(hit.waveform.data()),
+        hit.waveform.size() * sizeof(uint16_t)
+    );
+  };
+};
+
+bool StageLink::Decode(
+    const char* batch,
+    size_t size,
+    unsigned long& run,
+    unsigned long& sub_run,
+    std::list<std::unique_ptr<std::vector<Hit>>>& boards
+) {
+  Reader in(batch, size);
+  uint32_t value;
+  if (!in.get(value) || value != magic) return false;
+  if (!in.get(value) || value != version) return false;
+
+  uint64_t r, s;
+  uint32_t n;
+  if (!in.get(r) || !in.get(s) || !in.get(n)) return false;
+
+  // the smallest hit takes 19 bytes, which also guards the allocations
+  // against corrupted counts
+  static const size_t hit_size = 19;
+
+  std::list<std::unique_ptr<std::vector<Hit>>> decoded;
+  for (uint32_t b = 0; b < n; ++b) {
+    uint32_t nhits;
+    if (!in.get(nhits) || nhits > in.left() / hit_size) return false;
+    std::unique_ptr<std::vector<Hit>> hits(new std::vector<Hit>(nhits));
+    for (auto& hit : *hits) {
+      uint64_t time;
+      uint32_t samples;
+      if (
+          !in.get(time)
+          || !in.get(hit.charge_short)
+          || !in.get(hit.charge_long)
+          || !in.get(hit.baseline)
+          || !in.get(hit.channel)
+          || !in.get(samples)
+          || samples > in.left() / sizeof(uint16_t)
+         )
+        return false;
+      hit.time = Time(time);
+      hit.waveform.resize(samples);
+      if (!in.get(hit.waveform.data(), samples)) return false;
+    };
+    decoded.push_back(std::move(hits));
+  };
+  if (in.left()) return false;
+
+  run     = r;
+  sub_run = s;
+  boards.splice(boards.end(), decoded);
+  return true;
+};
+
+void StageLink::EncodeSlice(std::string& frame, const TimeSlice& slice) {
+  std::string encoded;
+  SliceCodec::encode(slice, encoded);
+  frame.clear();
+  frame.reserve(8 + encoded.size());
+  put<uint32_t>(frame, slice_magic);
+  put<uint32_t>(frame, slice_version);
+  frame.append(encoded);
+};
+
+bool StageLink::DecodeSlice(const char* frame, size_t size, TimeSlice& slice) {
+  Reader in(frame, size);
+  uint32_t value;
+  if (!in.get(value) || value != slice_magic) return false;
+  if (!in.get(value) || value != slice_version) return false;
+  return SliceCodec::decode(frame + size - in.left(), in.left(), slice);
+};
+
+bool StageLink::SendSlice(zmq::socket_t* sock, const TimeSlice& slice, int flags) {
+  std::string frame;
+  EncodeSlice(frame, slice);
+  zmq::message_t message(frame.data(), frame.size());
+  return sock->send(message, flags);
+};
+
+bool StageLink::ReceiveSlice(zmq::socket_t* sock, TimeSlice& slice) {
+  zmq::message_t message;
+  if (!sock->recv(&message)) return false;
+  if (!message.more())
+    return DecodeSlice(
+        static_cast<const char*>(message.data()), message.size(), slice
+    );
+
+  for (bool more = true; more;) {
+    zmq::message_t rest;
+    sock->recv(&rest);
+    more = rest.more();
+  };
+  return false;
+};
+
+bool StageLink::ReceiveSliceHeader(zmq::socket_t* sock, SliceHeader& header) {
+  zmq::message_t message;
+  if (!sock->recv(&message)) return false;
+  bool valid
+    =  message.more()
+    && message.size() == sizeof(header)
+    && static_cast<const SliceHeader*>(message.data())->magic == slice_magic;
+  if (valid) {
+    memcpy(&header, message.data(), sizeof(header));
+    return true;
+  };
+
+  for (bool more = message.more(); more;) {
+    zmq::message_t rest;
+    sock->recv(&rest);
+    more = rest.more();
+  };
+  return false;
+};
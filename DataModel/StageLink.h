@@ -0,0 +1,114 @@
+#ifndef STAGE_LINK_H
+#define STAGE_LINK_H
+
+#include <chrono>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <zmq.hpp>
+
+#include "TimeSlice.h"
+
+// Wire format of the link carrying raw readouts between toolchains, from a
+// RawSender (ROUTER, on the digitizer node) to RawReceivers (DEALER, on the
+// reformatting nodes).
+//
+// A batch is a single message holding the readouts of several boards:
+//
+//   uint32 magic, uint32 version, uint64 run, uint64 sub run, uint32 boards
+//   per board: uint32 hits
+//     per hit: uint64 time, uint16 charge_short, uint16 charge_long,
+//              uint16 baseline, uint8 channel, uint32 samples,
+//              uint16 waveform[samples]
+//
+// in host byte order (all nodes are x86). The run and sub run are those
+// current when the sender took the readouts from the Digitizer; a batch never
+// spans a run change.
+//
+// Flow control is credit based. A receiver grants batches by sending a Credit
+// with the total number of batches it accepts since it connected (`granted`,
+// the batches received plus its window), and repeats it every second as a
+// heartbeat. The sender never has more than `granted` batches sent to a
+// receiver, so a slow reformatting node holds back the data on the digitizer
+// node instead of queueing it in the network buffers. Since the total is
+// absolute, lost or repeated credits are harmless, and a restarted sender
+// starts over from `granted - window`.
+//
+// Complete TimeSlices fanned out to trigger worker processes (SliceDispatcher
+// to SliceWorkers to a SliceCollector) travel as a SliceHeader frame followed
+// by a slice frame. The worker echoes the header with the slice it returns, so
+// the collector can restore the dispatch order and time the round trip.
+// Monitoring publishes bare slice frames. A slice frame is
+//
+//   uint32 slice_magic, uint32 slice_version,
+//   the slice encoded by SliceCodec::encode (not compressed), run stamp included
+//
+// The index and the budget reservation of the slice are not sent; the index
+// is rebuilt on arrival.
+class StageLink {
+  public:
+    static const uint32_t magic       = 0x4b4e494c; // "LINK"
+    static const uint32_t version     = 1;
+    static const uint32_t slice_magic = 0x45434c53; // "SLCE"
+    static const uint32_t slice_version = 2;
+
+    struct Credit {
+      uint64_t granted;
+      uint64_t window;
+    };
+
+    struct SliceHeader {
+      uint32_t magic;
+      uint32_t worker;        // index of the worker in the dispatcher
+      uint64_t session;       // start time of the dispatcher, us
+      uint64_t sequence;      // dispatch order within the session
+      uint64_t dispatched_us; // system clock of the dispatcher
+      uint64_t worker_us;     // time spent in the worker, filled by it
+    };
+
+    // system clock, us
+    static uint64_t Microseconds() {
+      return std::chrono::duration_cast<std::chrono::microseconds>(
+          std::chrono::system_clock::now().time_since_epoch()
+      ).count();
+    };
+
+    // Reads the header frame. Returns false and skips the remaining frames of
+    // a foreign message.
+    static bool ReceiveSliceHeader(zmq::socket_t* sock, SliceHeader&);
+
+    // Sends the slice frame. `flags` as for zmq::socket_t::send, e.g.
+    // ZMQ_DONTWAIT; returns false if the socket did not take it.
+    static bool SendSlice(zmq::socket_t* sock, const TimeSlice&, int flags = 0);
+
+    // Reads a slice frame. Returns false on a corrupt or foreign message,
+    // whose remaining frames are skipped.
+    static bool ReceiveSlice(zmq::socket_t* sock, TimeSlice&);
+
+    static void EncodeSlice(std::string& frame, const TimeSlice&);
+    static bool DecodeSlice(const char* frame, size_t size, TimeSlice&);
+
+    static void EncodeHeader(
+        std::string& batch,
+        unsigned long run,
+        unsigned long sub_run,
+        uint32_t boards
+    );
+
+    static void EncodeBoard(std::string& batch, const std::vector<Hit>& hits);
+
+    // Appends the boards of the batch to `boards`. Returns false on a corrupt
+    // or foreign batch, leaving `boards` unchanged.
+    static bool Decode(
+        const char* batch,
+        size_t size,
+        unsigned long& run,
+        unsigned long& sub_run,
+        std::list<std::unique_ptr<std::vector<Hit>>>& boards
+    );
+};
+
+#endif
@@ -0,0 +1,161 @@
+#include <iomanip>
+
+#include <time.h>
+
+#include "DataModel.h"
+#include "StageProfiler.h"
+
+static const char* stage_names[StageProfiler::stages] = {
+  "digitizer",
+  "reformatter",
+  "sorter",
+  "trigger",
+  "window_builder",
+  "file_writer",
+  "monitoring"
+};
+
+const char* StageProfiler::name(Stage stage) {
+  return stage_names[stage];
+};
+
+uint64_t StageProfiler::cpu_now() {
+  timespec ts;
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+  return static_cast<uint64_t>(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+};
+
+uint64_t StageProfiler::wall_now() {
+  timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return static_cast<uint64_t>(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+};
+
+StageProfiler::Scope::Scope(StageProfiler& profiler, Stage stage):
+  profiler(profiler),
+  stage(stage),
+  cpu(cpu_now()),
+  wall(wall_now())
+{};
+
+StageProfiler::Scope::~Scope() {
+  Counters& counters = profiler.counters[stage];
+  counters.cpu_ns.fetch_add(cpu_now() - cpu, std::memory_order_relaxed);
+  counters.wall_ns.fetch_add(wall_now() - wall, std::memory_order_relaxed);
+  counters.calls.fetch_add(1, std::memory_order_relaxed);
+};
+
+StageProfiler::StageProfiler() {
+  for (auto& c : counters) {
+    c.cpu_ns.store(0, std::memory_order_relaxed);
+    c.wall_ns.store(0, std::memory_order_relaxed);
+    c.lock_ns.store(0, std::memory_order_relaxed);
+    c.sleep_ns.store(0, std::memory_order_relaxed);
+    c.calls.store(0, std::memory_order_relaxed);
+  };
+};
+
+void StageProfiler::Lock(std::mutex& mutex, Stage stage) {
+  // uncontended locks cost no clock reads
+  if (mutex.try_lock()) return;
+  uint64_t start = wall_now();
+  mutex.lock();
+  counters[stage].lock_ns.fetch_add(
+      wall_now() - start, std::memory_order_relaxed
+  );
+};
+
+void StageProfiler::Sleep(useconds_t usec, Stage stage) {
+  uint64_t start = wall_now();
+  usleep(usec);
+  counters[stage].sleep_ns.fetch_add(
+      wall_now() - start, std::memory_order_relaxed
+  );
+};
+
+void StageProfiler::Wait(
+    std::condition_variable& condition,
+    std::unique_lock<std::mutex>& lock,
+    const std::function<bool()>& ready,
+    Stage stage
+) {
+  if (ready()) return;
+  uint64_t start = wall_now();
+  condition.wait(lock, ready);
+  counters[stage].sleep_ns.fetch_add(
+      wall_now() - start, std::memory_order_relaxed
+  );
+};
+
+StageProfiler::Snapshot StageProfiler::Take() const {
+  Snapshot snapshot;
+  snapshot.time = std::chrono::steady_clock::now();
+  for (int i = 0; i < stages; ++i) {
+    const Counters& c = counters[i];
+    Totals& t = snapshot.totals[i];
+    t.cpu_ns   = c.cpu_ns.load(std::memory_order_relaxed);
+    t.wall_ns  = c.wall_ns.load(std::memory_order_relaxed);
+    t.lock_ns  = c.lock_ns.load(std::memory_order_relaxed);
+    t.sleep_ns = c.sleep_ns.load(std::memory_order_relaxed);
+    t.calls    = c.calls.load(std::memory_order_relaxed);
+  };
+  return snapshot;
+};
+
+void StageProfiler::Publish(
+    const Snapshot& before, const Snapshot& now, ToolFramework::Store& store
+) {
+  double ns = std::chrono::duration<double, std::nano>(
+      now.time - before.time
+  ).count();
+  if (ns <= 0) return;
+
+  for (int i = 0; i < stages; ++i) {
+    const Totals& a = before.totals[i];
+    const Totals& b = now.totals[i];
+    if (b.wall_ns == a.wall_ns && b.lock_ns == a.lock_ns && b.sleep_ns == a.sleep_ns)
+      continue;
+
+    std::string key = std::string("stage_") + stage_names[i];
+    store.Set(key + "_cpu",          100.0 * (b.cpu_ns   - a.cpu_ns)   / ns);
+    store.Set(key + "_busy",         100.0 * (b.wall_ns  - a.wall_ns)  / ns);
+    store.Set(key + "_lock_wait",    100.0 * (b.lock_ns  - a.lock_ns)  / ns);
+    store.Set(key + "_sleep",        100.0 * (b.sleep_ns - a.sleep_ns) / ns);
+    store.Set(key + "_calls_per_s",  1e9   * (b.calls    - a.calls)    / ns);
+  };
+};
+
+void StageProfiler::Write(std::ostream& output) const {
+  Snapshot snapshot = Take();
+  output
+    << std::left << std::setw(16) << "stage" << std::right
+    << std::setw(12) << "cpu_s"
+    << std::setw(12) << "busy_s"
+    << std::setw(12) << "lock_s"
+    << std::setw(12) << "sleep_s"
+    << std::setw(14) << "calls"
+    << '\n'
+    << std::fixed << std::setprecision(3);
+  for (int i = 0; i < stages; ++i) {
+    const Totals& t = snapshot.totals[i];
+    output
+      << std::left << std::setw(16) << stage_names[i] << std::right
+      << std::setw(12) << t.cpu_ns   * 1e-9
+      << std::setw(12) << t.wall_ns  * 1e-9
+      << std::setw(12) << t.lock_ns  * 1e-9
+      << std::setw(12) << t.sleep_ns * 1e-9
+      << std::setw(14) << t.calls
+      << '\n';
+  };
+};
+
+void StageProfiler::NameThread(pthread_t thread, const std::string& name) {
+  pthread_setname_np(thread, name.substr(0, 15).c_str());
+};
+
+void StageProfiler::NameThread(const std::string& name) {
+  static thread_local std::string current;
+  if (name == current) return;
+  current = name;
+  NameThread(pthread_self(), name);
+};
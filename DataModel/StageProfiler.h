@@ -0,0 +1,127 @@
+#ifndef STAGE_PROFILER_H
+#define STAGE_PROFILER_H
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <ostream>
+#include <string>
+
+#include <pthread.h>
+#include <unistd.h>
+
+#include "Store.h"
+
+// Time accounting of the pipeline stages.
+//
+// Every stage accumulates the CPU time of its threads (CLOCK_THREAD_CPUTIME_ID)
+// and the wall time spent in its work scopes, the time spent waiting for
+// mutexes and the time spent sleeping in the polling loops. The counters are
+// relaxed atomics padded to a cache line per stage, so worker threads of one
+// stage do not contend with other stages; the cost of a Scope is two clock
+// reads at each end.
+//
+// Monitoring turns the difference of two snapshots into a per second load of
+// each stage (Publish), and dumps the running totals on the ProfileDump slow
+// control command (Write).
+class StageProfiler {
+  public:
+    enum Stage {
+      digitizer,
+      reformatter,
+      sorter,
+      trigger,
+      window_builder,
+      file_writer,
+      monitoring,
+      stages
+    };
+
+    static const char* name(Stage);
+
+    struct Totals {
+      uint64_t cpu_ns;   // thread CPU time in work scopes
+      uint64_t wall_ns;  // wall time in work scopes
+      uint64_t lock_ns;  // waiting for contended mutexes
+      uint64_t sleep_ns; // sleeping in polling loops
+      uint64_t calls;    // work scopes completed
+    };
+
+    struct Snapshot {
+      std::chrono::steady_clock::time_point time;
+      std::array<Totals, stages> totals;
+    };
+
+    // Accounts the CPU and wall time from construction to destruction to a
+    // stage. Scopes may nest across stages, the inner time is then counted in
+    // both.
+    class Scope {
+      public:
+        Scope(StageProfiler& profiler, Stage stage);
+        ~Scope();
+
+      private:
+        StageProfiler& profiler;
+        Stage          stage;
+        uint64_t       cpu;
+        uint64_t       wall;
+    };
+
+    StageProfiler();
+
+    // Lock the mutex, counting the time waited if it was contended
+    void Lock(std::mutex&, Stage);
+
+    // usleep, counting the time slept
+    void Sleep(useconds_t usec, Stage);
+
+    // Wait on the condition variable until `ready` holds, counting the time
+    // waited as slept
+    void Wait(
+        std::condition_variable&,
+        std::unique_lock<std::mutex>&,
+        const std::function<bool()>& ready,
+        Stage
+    );
+
+    Snapshot Take() const;
+
+    // Set stage_<name>_cpu, _busy, _lock_wait and _sleep (percent of one
+    // thread) and stage_<name>_calls_per_s of every stage active between
+    // `before` and `now`
+    static void Publish(
+        const Snapshot& before, const Snapshot& now, ToolFramework::Store&
+    );
+
+    // Text table of the totals since construction
+    void Write(std::ostream&) const;
+
+    // Name a thread for top -H, ps and ProcessMetrics. Names are truncated to
+    // the 15 characters allowed by the kernel.
+    static void NameThread(pthread_t, const std::string& name);
+
+    // Name the calling thread. Repeated calls with the same name are free,
+    // which lets the pool jobs label their worker with the current stage.
+    static void NameThread(const std::string& name);
+
+  private:
+    struct Counters {
+      std::atomic<uint64_t> cpu_ns;
+      std::atomic<uint64_t> wall_ns;
+      std::atomic<uint64_t> lock_ns;
+      std::atomic<uint64_t> sleep_ns;
+      std::atomic<uint64_t> calls;
+      char pad[64 - 5 * sizeof(std::atomic<uint64_t>)];
+    };
+
+    Counters counters[stages];
+
+    static uint64_t cpu_now();
+    static uint64_t wall_now();
+};
+
+#endif
@@ -3,6 +3,7 @@
 
 #include <vector>
 #include <map>
+#include <algorithm>
 #include <mutex>
 #include <type_traits>
 
@@ -13,7 +14,7 @@
 using namespace ToolFramework;
 
 
-enum class TriggerType {nhits, calib, zero_bias};
+enum class TriggerType {nhits, calib, zero_bias, multiplicity, coincidence, energy_sum, psd};
 
 class TriggerInfo : SerialisableObject{
 
@@ -39,6 +40,18 @@ public:
     case TriggerType::zero_bias:
       return "zero_bias";
       
+    case TriggerType::multiplicity:
+      return "multiplicity";
+      
+    case TriggerType::coincidence:
+      return "coincidence";
+      
+    case TriggerType::energy_sum:
+      return "energy_sum";
+      
+    case TriggerType::psd:
+      return "psd";
+      
     default:
       return "";
     }
@@ -61,19 +74,138 @@ public:
   }
 };
 
+// Coarse index of hit times in a sorted TimeSlice. offsets[i] is the index of
+// the first hit with time >= origin + i * bucket, so a time range lookup is one
+// division plus a scan over at most one bucket.
+class TimeIndex : SerialisableObject{
+
+public:
+
+  Time origin;
+  Time bucket;
+  std::vector<uint32_t> offsets;
+
+  bool empty() const { return offsets.empty(); }
+
+  void clear(){
+    origin = Time();
+    bucket = Time();
+    offsets.clear();
+  }
+
+  // Build the index for hits sorted by time. The bucket is widened for sparse
+  // slices so that the index never has more entries than there are hits.
+  void build(const std::vector<Hit>& hits, Time in_bucket){
+    clear();
+    if(hits.empty() || in_bucket.bits()==0) return;
+
+    origin = hits.front().time;
+    uint64_t span = hits.back().time.bits() - origin.bits();
+    uint64_t width = in_bucket.bits();
+    if(span / width + 1 > hits.size()) width = span / hits.size() + 1;
+    bucket = Time(width);
+
+    offsets.resize(span / width + 2);
+    size_t hit = 0;
+    for(size_t i=0; i<offsets.size(); i++){
+      uint64_t edge = origin.bits() + i * width;
+      while(hit < hits.size() && hits[hit].time.bits() < edge) hit++;
+      offsets[i] = hit;
+    }
+  }
+
+  // Index of the first hit with time >= t
+  size_t lower_bound(const std::vector<Hit>& hits, Time t) const {
+    if(empty()) return std::lower_bound(hits.begin(), hits.end(), t, [](const Hit& hit, Time value){ return hit.time < value; }) - hits.begin();
+    if(t <= origin) return 0;
+    size_t i = (t.bits() - origin.bits()) / bucket.bits();
+    if(i >= offsets.size() - 1) return hits.size();
+    size_t hit = offsets[i];
+    size_t last = offsets[i + 1];
+    while(hit < last && hits[hit].time < t) hit++;
+    return hit;
+  }
+
+  bool Print(){
+    std::cout<<"index: origin="<<origin.bits()<<" bucket="<<bucket.bits()<<" entries="<<offsets.size()<<std::endl;
+    return true;
+  }
+  std::string GetVersion(){return "1.0";};
+  bool Serialise(BinaryStream &bs){
+
+    bs & origin;
+    bs & bucket;
+    bs & offsets;
+
+    return true;
+  }
+
+};
+
+// Hits of a TimeSlice with time in [time, end) form its core. A slice may also
+// carry copies of hits from the neighbouring slices (context) so that triggers
+// and windows near the slice edges see all the data they need. Each trigger is
+// reported only by the slice whose core contains it. end == 0 means the whole
+// slice is core.
 class TimeSlice : SerialisableObject {
 
 public:
   
   Time time;
+  Time end;
   std::vector<Hit> hits;
   std::mutex mutex;
   std::vector<TriggerInfo> triggers;
+  TimeIndex index;
+  uint64_t budget_bytes = 0; // memory reserved in the SliceBudget, not serialised
+
+  // Run and sub run the slice belongs to, stamped when the slice is formed so
+  // that run boundaries travel with the data through the pipeline. They are
+  // stored with the slice from format version 3 (and in SliceCodec blocks from
+  // SliceCodec version 3), so they survive renamed or concatenated parts.
+  unsigned long run = 0;
+  unsigned long sub_run = 0;
+
+  // default index bucket width
+  static Time index_bucket(){ return Time::from_ns(1000); }
+
+  // Build the coarse time index. Hits must be sorted by time.
+  void BuildIndex(Time bucket = index_bucket()){
+    index.build(hits, bucket);
+  }
+
+  bool InCore(Time t) const {
+    return t >= time && (end == Time() || t < end);
+  }
+
+  // Drop triggers outside of the core
+  void TrimTriggers(){
+    triggers.erase(std::remove_if(triggers.begin(), triggers.end(), [this](const TriggerInfo& trigger){ return !InCore(trigger.time); }), triggers.end());
+  }
+
+  // Drop context hits, e.g. before the slice is written out
+  void TrimContext(){
+    if(end == Time()) return;
+    size_t before = hits.size();
+    hits.erase(std::remove_if(hits.begin(), hits.end(), [this](const Hit& hit){ return !InCore(hit.time); }), hits.end());
+    if(hits.size() != before && !index.empty()) BuildIndex(index.bucket);
+  }
+
+  // Indices [first, last) of the hits with begin <= time < end. Hits must be
+  // sorted by time; without an index this falls back to a binary search.
+  std::pair<size_t, size_t> Range(Time begin, Time end) const {
+    size_t first = index.lower_bound(hits, begin);
+    size_t last = index.lower_bound(hits, end);
+    if(last < first) last = first;
+    return std::make_pair(first, last);
+  }
 
   bool Print(){
 
 
     std::cout<<std::endl<<"time="<<time.Print()<<std::endl;
+    std::cout<<" end="<<end.Print()<<std::endl;
+    std::cout<<" run="<<run<<" sub_run="<<sub_run<<std::endl;
     std::cout<<" hits size="<<hits.size()<<std::endl;
 
     for(size_t i=0; i<hits.size(); i++){
@@ -94,86 +226,48 @@ public:
     return true;
   }
 
-  std::string GetVersion(){return "1.0";};
+  // Streams start with format_tag | format_version. Version 1 streams, written
+  // before the tag, start with the slice time instead: times fit in 57 bits,
+  // so a word with the tag bits set cannot be one. Version 2 streams have no
+  // run and sub run, which are then left as they are.
+  static const uint64_t format_mask=0xffffffff00000000ull;
+  static const uint64_t format_tag=0x544d534c00000000ull;
+  static const uint64_t format_version=3;
+
+  std::string GetVersion(){return "3";};
   bool Serialise(BinaryStream &bs){
 
+    // written as is, overwritten by what is in the stream when reading
+    uint64_t format=format_tag | format_version;
+    bs & format;
+
+    if((format & format_mask)!=format_tag){
+      // version 1: time, hits, triggers
+      time=Time(format);
+      end=Time();
+      bs & hits;
+      bs & triggers;
+      index.clear();
+      return true;
+    }
+    uint64_t version=format & ~format_mask;
+    if(version<2 || version>format_version) return false;
+
     bs & time;
+    bs & end;
+    if(version>=3){
+      uint64_t stamps[2]={run, sub_run};
+      bs & stamps[0];
+      bs & stamps[1];
+      run=stamps[0];
+      sub_run=stamps[1];
+    }
     bs & hits;
     bs & triggers;
-    
+    bs & index;
+
     return true;
   }
-
-  void Send(zmq::socket_t* sock){
-
-    zmq::message_t msg1(sizeof(time));
-    memcpy(msg1.data(), &time, sizeof(time));
-    sock->send(msg1, ZMQ_SNDMORE);
-
-    unsigned long size=triggers.size();
-    zmq::message_t msg2(sizeof(size));
-    memcpy(msg2.data(), &size, sizeof(size));
-    sock->send(msg2, ZMQ_SNDMORE);
-
-    if(triggers.size()>0){
-      zmq::message_t msg3(sizeof(TriggerInfo)*triggers.size());
-      memcpy(msg3.data(), triggers.data(), sizeof(TriggerInfo)*triggers.size());
-      sock->send(msg3, ZMQ_SNDMORE);
-    }
-
-    size= hits.size();
-    zmq::message_t msg4(sizeof(size));
-    memcpy(msg4.data(), &size, sizeof(size));
-    if(hits.size()==0){
-      sock->send(msg4);
-      return;
-    }
-      
-    sock->send(msg4, ZMQ_SNDMORE);
-    
-    for(size_t i=0; i<hits.size()-1; i++){
-      hits.at(i).Send(sock, ZMQ_SNDMORE);	
-    }
-    hits.at(hits.size()-1).Send(sock);
-        
-  }
-
-   void Receive(zmq::socket_t* sock){
-
-     zmq::message_t msg1;
-     sock->recv(&msg1);
-     memcpy(&time, msg1.data(), sizeof(time));
-
-     unsigned long size=0;
-     
-     if(msg1.more()){  
-        zmq::message_t msg2;
-	sock->recv(&msg2);
-	memcpy(&size, msg2.data(), sizeof(size));
-	triggers.resize(size);
-	
-	zmq::message_t msg3;
-	if(size>0 && msg2.more()){	  
-	  sock->recv(&msg3);
-	  memcpy(triggers.data(), msg3.data(), sizeof(TriggerInfo)*triggers.size());
-	}
-	
-	if((size==0 && msg2.more()) || (size>0 && msg3.more())){
-	  zmq::message_t msg4;
-	  sock->recv(&msg4);
-	  memcpy(&size, msg4.data(), sizeof(size));
-	  hits.resize(size);
-
-	  for(size_t i=0; i<hits.size()-1; i++){
-	    hits.at(i).Receive(sock); 
-	  }
-	  
-	}
-	   
-
-     }
-
-   }
   
 };
 
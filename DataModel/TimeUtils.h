@@ -0,0 +1,99 @@
+#ifndef TIME_UTILS_H
+#define TIME_UTILS_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include <Hit.h>
+
+// Bulk operations on hit times.
+//
+// Time is a SerialisableObject and therefore carries a vtable pointer, so
+// arrays of Time or Hit are strided. hit_time_bits gathers the raw fixed point
+// values once, and the functions below work on the plain uint64_t arrays with
+// integer and double arithmetic only. The inner loops have no branches and no
+// long double conversions, which lets the compiler vectorise them at -O3.
+//
+// The gather costs about as much as one pass over the hits, so it pays off for
+// loops going over the times repeatedly (several trigger conditions) or for
+// several conversions of the same times. See timebench.cpp for the measured
+// difference.
+
+// Copy raw fixed point values of hit times to `bits`.
+inline void hit_time_bits(const Hit* hits, size_t n, uint64_t* bits) {
+  for (size_t i = 0; i < n; ++i) bits[i] = hits[i].time.bits();
+};
+
+inline std::vector<uint64_t> hit_time_bits(const std::vector<Hit>& hits) {
+  std::vector<uint64_t> bits(hits.size());
+  hit_time_bits(hits.data(), hits.size(), bits.data());
+  return bits;
+};
+
+// Convert raw times to integer nanoseconds (truncated). See Time::ns.
+inline void time_bits_to_ns(const uint64_t* bits, size_t n, uint64_t* ns) {
+  for (size_t i = 0; i < n; ++i) ns[i] = bits[i] >> 9;
+};
+
+// Convert raw times to seconds. See Time::seconds.
+inline void time_bits_to_seconds(
+    const uint64_t* bits, size_t n, double* seconds
+) {
+  for (size_t i = 0; i < n; ++i)
+    seconds[i] = static_cast<double>(bits[i] >> 10) * 2e-9
+               + static_cast<double>(bits[i] & 0x3ff) * (2e-9 / 1024);
+};
+
+// Add `offset` to every time.
+inline void offset_time_bits(uint64_t* bits, size_t n, Time offset) {
+  uint64_t o = offset.bits();
+  for (size_t i = 0; i < n; ++i) bits[i] += o;
+};
+
+// Time of every hit relative to `base` in units of `1 << shift` raw units,
+// e.g. shift = 9 gives nanoseconds. Times before `base` wrap around, callers
+// are expected to pass the earliest time.
+inline void relative_time_bits(
+    const uint64_t* bits, size_t n, Time base, unsigned shift, uint64_t* out
+) {
+  uint64_t b = base.bits();
+  for (size_t i = 0; i < n; ++i) out[i] = (bits[i] - b) >> shift;
+};
+
+// Time from every time to `end`, e.g. the lag behind the latest hit. Times
+// after `end` wrap around.
+inline void time_bits_before(
+    const uint64_t* bits, size_t n, Time end, uint64_t* out
+) {
+  uint64_t e = end.bits();
+  for (size_t i = 0; i < n; ++i) out[i] = e - bits[i];
+};
+
+// Mark times within [begin, end). Returns the number of marked times.
+inline size_t time_bits_in_window(
+    const uint64_t* bits, size_t n, Time begin, Time end, uint8_t* mask
+) {
+  uint64_t b = begin.bits();
+  uint64_t e = end.bits();
+  size_t count = 0;
+  for (size_t i = 0; i < n; ++i) {
+    // (x - b) < (e - b) is a single unsigned comparison for b <= x < e
+    mask[i] = bits[i] - b < e - b;
+    count += mask[i];
+  };
+  return count;
+};
+
+// Number of times within [begin, end).
+inline size_t count_time_bits_in_window(
+    const uint64_t* bits, size_t n, Time begin, Time end
+) {
+  uint64_t b = begin.bits();
+  uint64_t e = end.bits();
+  size_t count = 0;
+  for (size_t i = 0; i < n; ++i) count += bits[i] - b < e - b;
+  return count;
+};
+
+#endif
@@ -57,6 +57,7 @@ void Digitizer::Monitor::monitor() {
 void Digitizer::Monitor::start() {
   mutex.lock();
   thread = std::thread(&Digitizer::Monitor::monitor, this);
+  StageProfiler::NameThread(thread.native_handle(), "DigitizerTemp");
 };
 
 void Digitizer::Monitor::stop() {
@@ -435,6 +436,7 @@ void Digitizer::configure() {
 
 void Digitizer::start_acquisition() {
   acquiring = true;
+  int n = 0;
   for (auto& rt : readout_threads) {
     for (auto board : rt.boards) {
       info()
@@ -451,6 +453,9 @@ void Digitizer::start_acquisition() {
         this,
         rt.boards
     );
+    StageProfiler::NameThread(
+        rt.thread.native_handle(), "Readout" + std::to_string(n++)
+    );
   };
   if (bridge) bridge->startPulser(cvPulserA);
 };
@@ -472,6 +477,8 @@ void Digitizer::stop_acquisition() {
 
 // Read data from the board and put it into m_data.raw_readout
 void Digitizer::readout(Board& board) {
+  StageProfiler::Scope scope(m_data->profiler, StageProfiler::digitizer);
+
   // board.digitizer.sendSWTrigger(); // FIXME: software trigger for testing
   board.digitizer.readData(CAEN_DGTZ_SLAVE_TERMINATED_READOUT_MBLT, board.buffer);
   if (board.digitizer.getNumEvents(board.buffer) == 0) return;
@@ -517,7 +524,8 @@ void Digitizer::readout(Board& board) {
     };
   };
 
-  std::lock_guard<std::mutex> lock(m_data->raw_readout_mutex);
+  m_data->profiler.Lock(m_data->raw_readout_mutex, StageProfiler::digitizer);
+  std::lock_guard<std::mutex> lock(m_data->raw_readout_mutex, std::adopt_lock);
   if (!m_data->raw_readout)
     m_data->raw_readout.reset(new std::list<std::unique_ptr<std::vector<Hit>>>());
   m_data->raw_readout->push_back(std::move(hits));
@@ -13,10 +13,16 @@ if (tool=="DummyTool") ret=new DummyTool;
 if (tool=="FileWriter") ret=new FileWriter;
 if (tool=="HVoltage") ret=new HVoltage;
 if (tool=="JobManager") ret=new JobManager;
+if (tool=="LinkTest") ret=new LinkTest;
 if (tool=="Monitoring") ret=new Monitoring;
 if (tool=="NhitsTrigger") ret=new NhitsTrigger;
+if (tool=="RawReceiver") ret=new RawReceiver;
+if (tool=="RawSender") ret=new RawSender;
 if (tool=="Reformatter") ret=new Reformatter;
 if (tool=="RunControl") ret=new RunControl;
+if (tool=="SliceCollector") ret=new SliceCollector;
+if (tool=="SliceDispatcher") ret=new SliceDispatcher;
+if (tool=="SliceWorker") ret=new SliceWorker;
 if (tool=="Sorter") ret=new Sorter;
 if (tool=="Trigger") ret=new Trigger;
 if (tool=="WindowBuilder") ret=new WindowBuilder;
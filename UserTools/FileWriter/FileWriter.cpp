@@ -1,10 +1,25 @@
 #include "FileWriter.h"
 
+#include <unistd.h>
+
 FileWriter_args::FileWriter_args():Thread_args(){
   data=0;
   file_name=0;
   part_number=0;
   file_writeout_period=0;
+  compression_level=0;
+  part_max_bytes=0;
+  part_max_duration=0;
+  journal=0;
+  journal_sync_blocks=0;
+  shm_ring=0;
+  shm_ring_slots=0;
+  shm_ring_slot_size=0;
+  part_plain_bytes=0;
+  compression_ratio=1;
+  part_run=0;
+  part_sub_run=0;
+  late_part_number=0;
 }
 
 FileWriter_args::~FileWriter_args(){
@@ -12,6 +27,14 @@ FileWriter_args::~FileWriter_args(){
   file_name=0;
   part_number=0;
   file_writeout_period=0;
+  compression_level=0;
+  part_max_bytes=0;
+  part_max_duration=0;
+  journal=0;
+  journal_sync_blocks=0;
+  shm_ring=0;
+  shm_ring_slots=0;
+  shm_ring_slot_size=0;
 }
 
 
@@ -34,8 +57,17 @@ bool FileWriter::Initialise(std::string configfile, DataModel &data){
   args->file_name= &m_file_name;
   args->part_number= &m_part_number;
   args->file_writeout_period= & m_file_writeout_period;
+  args->compression_level= &m_compression_level;
+  args->part_max_bytes= &m_part_max_bytes;
+  args->part_max_duration= &m_part_max_duration;
+  args->journal= &m_journal;
+  args->journal_sync_blocks= &m_journal_sync_blocks;
+  args->shm_ring= &m_shm_ring;
+  args->shm_ring_slots= &m_shm_ring_slots;
+  args->shm_ring_slot_size= &m_shm_ring_slot_size;
   
-  m_util->CreateThread("test", &Thread, args);
+  m_util->CreateThread("FileWriter", &Thread, args);
+  StageProfiler::NameThread(args->thread, "FileWriter");
 
   ExportConfiguration();
   
@@ -51,7 +83,6 @@ bool FileWriter::Execute(){
     ExportConfiguration();
   }
   if(m_data->run_start) LoadConfig();   ///?   oh maybe to ensure file file written before load config happends but this is a crap way of doing it please change Ben
-  if(m_data->run_stop) args->period=boost::posix_time::seconds(10);
 
   m_data->vars.Set("part",m_part_number);
   
@@ -76,9 +107,12 @@ void FileWriter::Thread(Thread_args* arg){
 
   FileWriter_args* args=reinterpret_cast<FileWriter_args*>(arg);
 
+  // at run stop everything still in flight is written out without waiting for the period
+  bool draining=args->data->draining;
+
   args->lapse = args->period -( boost::posix_time::microsec_clock::universal_time() - args->last);
-  if(!args->lapse.is_negative()){
-    usleep(100);
+  if(!args->lapse.is_negative() && !draining){
+    args->data->profiler.Sleep(100, StageProfiler::file_writer);
     return;
   }
   //printf("%d\n", *(args->part_number));
@@ -87,11 +121,25 @@ void FileWriter::Thread(Thread_args* arg){
   //}
   
   args->last= boost::posix_time::microsec_clock::universal_time();
+
+  // journal parts stay open between write outs, close them when they get old; run changes are handled per slice below
+  if(*args->journal && args->part.IsOpen() && args->last - args->part_start >= boost::posix_time::seconds(*args->file_writeout_period)) ClosePart(args);
   
-  args->data->triggered_readout_mutex.lock();
+  WriteLate(args);
+
+  args->data->profiler.Lock(args->data->triggered_readout_mutex, StageProfiler::file_writer);
 
   if(args->data->triggered_readout.size()==0){
     args->data->triggered_readout_mutex.unlock();
+    if(draining){
+      // released by this thread once written, so nothing is left upstream or in here;
+      // slices out at the SliceWorkers are no longer in the budget and counted apart
+      if(args->data->slice_budget.Used()==0 && args->data->slices_at_workers<=0){
+	ClosePart(args);
+	args->data->drained=true;
+      }
+      args->data->profiler.Sleep(1000, StageProfiler::file_writer);
+    }
     return;
   }
 
@@ -101,6 +149,8 @@ void FileWriter::Thread(Thread_args* arg){
 
   std::swap(args->data->triggered_readout, local_readout);
   args->data->triggered_readout_mutex.unlock();
+
+  StageProfiler::Scope scope(args->data->profiler, StageProfiler::file_writer);
   /*
   std::queue<std::unique_ptr<TimeSlice>> local_trimmed_readout;
 
@@ -113,36 +163,293 @@ void FileWriter::Thread(Thread_args* arg){
     local_readout.pop();
   }
   */
-  std::stringstream filename;
-  filename<<(*args->file_name)<<"R"<<args->data->run_number<<"S"<<args->data->sub_run_number<<"P"<<(*args->part_number)<<".dat";
-  BinaryStream output;
-  output.Bopen(filename.str().c_str(), NEW, UNCOMPRESSED);
-
-
   //  unsigned long size=local_trimmed_readout.size();
   unsigned long size=local_readout.size();
-  output<<size;
-  
-  unsigned int mod=1;  
-  if(size>(*args->file_writeout_period)) mod=size/(*(args->file_writeout_period));
+
+  // jobs finish out of order, restore the time order so that the sub run boundary is crossed once
+  std::vector<std::unique_ptr<TimeSlice>> slices;
+  slices.reserve(size);
+  while(local_readout.size()){
+    slices.push_back(std::move(local_readout.front()));
+    local_readout.pop();
+  }
+  std::stable_sort(slices.begin(), slices.end(), [](const std::unique_ptr<TimeSlice>& a, const std::unique_ptr<TimeSlice>& b){
+      if(a->run!=b->run) return a->run<b->run;
+      if(a->sub_run!=b->sub_run) return a->sub_run<b->sub_run;
+      return a->time<b->time;
+    });
   
-  for(unsigned int i=0; i< size; i++){
-    //    output<<local_trimmed_readout.front();
-    //    local_trimmed_readout.pop();
-    output<<*local_readout.front();
-    
-    if(!(i%mod)){
-      args->data->monitoring_readout_mutex.lock();
-      args->data->monitoring_readout.emplace(std::move(local_readout.front()));
+  // shared memory ring for local consumers, created by this thread so that it is only ever touched here
+  if(args->ring_name!=*args->shm_ring){
+    args->ring.Detach();
+    args->ring_name=*args->shm_ring;
+    if(args->ring_name!="" && !args->ring.Create(args->ring_name, *args->shm_ring_slots, *args->shm_ring_slot_size)){
+      args->data->services->SendLog("ERROR: FileWriter failed to create shared memory ring "+args->ring_name, v_error);
+    }
+  }
+
+  // slices are encoded for compressed and journal parts and for the ring
+  bool encode= *args->compression_level || *args->journal || args->ring.IsOpen();
+
+  std::vector<std::unique_ptr<FileWriter_block>> blocks(size);
+  unsigned long expected=0; // expected size of the data in the uncompressed format, for preallocation
+  for(unsigned long i=0; i<size; i++){
+    blocks[i].reset(new FileWriter_block);
+    blocks[i]->time_slice=std::move(slices[i]);
+    blocks[i]->time_slice->TrimContext(); // context hits are stored with the neighbouring slices
+    blocks[i]->plain_size=PlainSize(*blocks[i]->time_slice);
+    blocks[i]->level=*args->compression_level;
+    blocks[i]->profiler=&args->data->profiler;
+    expected+=blocks[i]->plain_size;
+
+    if(!encode) continue;
+
+    // encode and compress the slices on the worker pool, they are written in order below
+    Job* tmp_job= new Job("compressing");
+    tmp_job->data=blocks[i].get();
+    tmp_job->func=CompressBlock;
+    tmp_job->fail_func=FailCompress;
+    if(!args->data->job_queue.AddJob(tmp_job)){
+      delete tmp_job;
+      FailCompress(blocks[i].get());
+    }
+  }
+
+  for(unsigned long i=0; i<size; i++){
+    FileWriter_block* block=blocks[i].get();
+    TimeSlice& time_slice=*block->time_slice;
+
+    BinaryStream serialised(RAM);
+    if(encode){
+      std::unique_lock<std::mutex> lock(block->mutex);
+      args->data->profiler.Wait(block->finished, lock, [block]{ return block->done; }, StageProfiler::file_writer);
+      lock.unlock();
+      block->profiler=0; // a retry runs in this thread, already within its scope
+      if(!block->ok && !CompressBlock(block)){
+	args->data->services->SendLog("ERROR: FileWriter failed to compress a timeslice", v_error);
+	block->compressed.clear();
+	block->raw_size=0;
+      }
+    }
+    const std::string& payload= block->level ? block->compressed : block->raw; // journal block
+    if(!*args->journal && *args->compression_level){
+      serialised<<block->raw_size;
+      serialised<<block->compressed;
+    }
+    else if(!*args->journal) serialised<<time_slice;
+    unsigned long bytes= *args->journal ? payload.size()+PartFile::journal_block_header : serialised.buffer.size();
+
+    // switch files exactly at the run or sub run boundary stamped on the slices
+    if(args->part.IsOpen() && (time_slice.run!=args->part_run || time_slice.sub_run!=args->part_sub_run)) ClosePart(args);
+    if(args->part.IsOpen() && args->part.Slices()){
+      bool full= *args->part_max_bytes && args->part.Bytes()+bytes > *args->part_max_bytes;
+      bool long_enough= args->part_max_duration->bits() && time_slice.time.bits() >= args->part.First().bits()+args->part_max_duration->bits();
+      if(full || long_enough) ClosePart(args);
+    }
+    if(!args->part.IsOpen()) OpenPart(args, expected, time_slice.run, time_slice.sub_run);
+    bool written= args->part.IsOpen() && (*args->journal ? args->part.WriteBlock(block->raw_size, payload, time_slice) : args->part.Write(serialised.buffer, time_slice));
+    if(!written) args->data->services->SendLog("ERROR: FileWriter failed to write to "+args->part.Filename(), v_error);
+    else if(*args->journal && *args->journal_sync_blocks && args->part.Unsynced()>=*args->journal_sync_blocks) args->part.Sync();
+    args->part_plain_bytes+=block->plain_size;
+    expected-=block->plain_size;
+    args->data->slice_budget.Release(time_slice);
+
+    if(args->ring.IsOpen()) args->ring.Publish(block->raw); // oversized slices are counted by the ring
+
+    if(args->data->monitoring_sampler.Select(time_slice)){
+      args->data->profiler.Lock(args->data->monitoring_readout_mutex, StageProfiler::file_writer);
+      args->data->monitoring_readout.emplace(std::move(block->time_slice));
       args->data->monitoring_readout_mutex.unlock();
     }
 
-    local_readout.pop();
+    blocks[i].reset();
+  }
+
+  if(!*args->journal) ClosePart(args);
+  else if(args->part.IsOpen() && args->part.Unsynced()) args->part.Sync(); // checkpoint
+
+  if(args->ring.IsOpen()){
+    args->data->monitoring_store_mtx.lock();
+    args->data->monitoring_store.Set("shm_ring_published", args->ring.Published());
+    args->data->monitoring_store.Set("shm_ring_oversized", args->ring.Oversized());
+    args->data->monitoring_store_mtx.unlock();
   }
   
-  output.Bclose();
+}
+
+void FileWriter::OpenPart(FileWriter_args* args, unsigned long expected, unsigned long run, unsigned long sub_run){
+
+  BinaryStream header(RAM);
+  if(*args->compression_level){
+    uint64_t magic=SliceCodec::magic;
+    uint32_t version=SliceCodec::version;
+    if(!*args->journal){
+      header<<magic;
+      header<<version;
+    }
+    expected/=args->compression_ratio;
+  }
+  if(*args->part_max_bytes && expected>*args->part_max_bytes) expected=*args->part_max_bytes;
+
+  // existing parts are never overwritten, e.g. after a restart of the writer:
+  // the last journal part is resumed if it is intact, any other is skipped
+  unsigned long first=*args->part_number;
+  std::string filename;
+  bool opened=false;
+  while(true){
+    filename=PartName(args, run, sub_run, 'P', *args->part_number);
+    bool last= !*args->journal || access(PartName(args, run, sub_run, 'P', *args->part_number+1).c_str(), F_OK)!=0;
+    if(last){
+      opened= *args->journal ? args->part.OpenJournal(filename, *args->compression_level, expected) : args->part.Open(filename, header.buffer, expected);
+      if(opened || !args->part.Refused()) break;
+    }
+    (*args->part_number)++;
+  }
+  if(*args->part_number!=first){
+    std::stringstream ss;
+    ss<<"Warning: FileWriter: parts "<<first<<" to "<<(*args->part_number-1)<<" of run "<<run<<" sub run "<<sub_run<<" exist, continuing with part "<<*args->part_number;
+    args->data->services->SendLog(ss.str(), v_warning);
+  }
+  if(!opened){
+    args->data->services->SendLog("ERROR: FileWriter failed to open "+filename, v_error);
+    return;
+  }
+
+  args->part.manifest.Set("run", run);
+  args->part.manifest.Set("sub_run", sub_run);
+  args->part.manifest.Set("part", *args->part_number);
+  args->part.manifest.Set("compression_level", *args->compression_level);
+  args->part_start=boost::posix_time::microsec_clock::universal_time();
+  args->part_plain_bytes=0;
+  args->part_run=run;
+  args->part_sub_run=sub_run;
+  args->part_dropped=args->data->slice_budget.dropped_hits.Take();
+  args->part_dropped_slices=args->data->slice_budget.DroppedSlices();
+
+}
+
+void FileWriter::ClosePart(FileWriter_args* args){
+
+  if(!args->part.IsOpen()) return;
+
+  // data lost to the memory budget while the part was open
+  ChannelCounters::Snapshot dropped=args->data->slice_budget.dropped_hits.Take();
+  unsigned long dropped_hits=0;
+  for(unsigned int i=0; i<ChannelCounters::channels; i++){
+    unsigned long hits=dropped.counts[i]-args->part_dropped.counts[i];
+    if(!hits) continue;
+    args->part.manifest.Set("dropped_hits_channel_"+std::to_string(i), hits);
+    dropped_hits+=hits;
+  }
+  args->part.manifest.Set("dropped_hits", dropped_hits);
+  args->part.manifest.Set("dropped_slices", args->data->slice_budget.DroppedSlices()-args->part_dropped_slices);
+
+  if(!args->part.Close()) args->data->services->SendLog("ERROR: FileWriter failed to close "+args->part.Filename(), v_error);
   (*args->part_number)++;
-  
+
+  double seconds=(boost::posix_time::microsec_clock::universal_time() - args->part_start).total_microseconds()/1e6;
+  double bytes=args->part.Bytes();
+  if(*args->compression_level && bytes>0) args->compression_ratio=args->part_plain_bytes/bytes;
+
+  args->data->monitoring_store_mtx.lock();
+  args->data->monitoring_store.Set("file_bytes", args->part.Bytes());
+  if(seconds>0) args->data->monitoring_store.Set("file_write_MBps", bytes/seconds/1e6);
+  if(*args->compression_level) args->data->monitoring_store.Set("file_compression_ratio", args->compression_ratio);
+  args->data->monitoring_store_mtx.unlock();
+
+}
+
+void FileWriter::WriteLate(FileWriter_args* args){
+
+  std::queue<std::unique_ptr<TimeSlice>> late;
+  args->data->late_readout_mutex.lock();
+  std::swap(args->data->late_readout, late);
+  args->data->late_readout_mutex.unlock();
+  if(late.empty()) return;
+
+  StageProfiler::Scope scope(args->data->profiler, StageProfiler::file_writer);
+
+  // uncompressed parts, small and rare enough not to bother
+  PartFile part;
+  unsigned long run=0, sub_run=0;
+  while(late.size()){
+    TimeSlice& time_slice=*late.front();
+    if(part.IsOpen() && (time_slice.run!=run || time_slice.sub_run!=sub_run)){
+      if(!part.Close()) args->data->services->SendLog("ERROR: FileWriter failed to close "+part.Filename(), v_error);
+    }
+    if(!part.IsOpen()){
+      run=time_slice.run;
+      sub_run=time_slice.sub_run;
+      std::string filename;
+      do filename=PartName(args, run, sub_run, 'L', args->late_part_number++);
+      while(!part.Open(filename, "") && part.Refused()); // skip existing late parts
+      if(part.IsOpen()){
+	part.manifest.Set("run", run);
+	part.manifest.Set("sub_run", sub_run);
+	part.manifest.Set("late", true);
+      }
+      else args->data->services->SendLog("ERROR: FileWriter failed to open "+filename, v_error);
+    }
+    BinaryStream serialised(RAM);
+    serialised<<time_slice;
+    if(part.IsOpen() && !part.Write(serialised.buffer, time_slice)) args->data->services->SendLog("ERROR: FileWriter failed to write to "+part.Filename(), v_error);
+    late.pop();
+  }
+  if(part.IsOpen() && !part.Close()) args->data->services->SendLog("ERROR: FileWriter failed to close "+part.Filename(), v_error);
+
+}
+
+std::string FileWriter::PartName(FileWriter_args* args, unsigned long run, unsigned long sub_run, char kind, unsigned long number){
+
+  std::stringstream filename;
+  filename<<(*args->file_name)<<"R"<<run<<"S"<<sub_run<<kind<<number<<".dat";
+  return filename.str();
+}
+
+unsigned long FileWriter::PlainSize(TimeSlice& time_slice){
+
+  // size of the slice in an uncompressed part file
+  unsigned long size=2*sizeof(Time)+sizeof(size_t)*4+3*sizeof(uint64_t); // times, counts, format and run stamp
+  size+=time_slice.triggers.size()*(sizeof(Time)+sizeof(TriggerType));
+  for(size_t i=0; i<time_slice.hits.size(); i++){
+    size+=sizeof(uint64_t)+3*sizeof(uint16_t)+sizeof(uint8_t)+sizeof(size_t);
+    size+=time_slice.hits[i].waveform.size()*sizeof(uint16_t);
+  }
+
+  return size;
+}
+
+bool FileWriter::CompressBlock(void* data){
+
+  FileWriter_block* block=reinterpret_cast<FileWriter_block*>(data);
+  std::unique_ptr<StageProfiler::Scope> scope;
+  if(block->profiler){
+    StageProfiler::NameThread("job:compress");
+    scope.reset(new StageProfiler::Scope(*block->profiler, StageProfiler::file_writer));
+  }
+
+  SliceCodec::encode(*block->time_slice, block->raw);
+  block->raw_size=block->raw.size();
+  block->ok= !block->level || SliceCodec::compress(block->raw, block->compressed, block->level);
+  // the writer frees the block as soon as it sees done, so it is not touched
+  // after the lock is released. A failed compression is reported in ok: the
+  // job itself succeeded, so the pool never calls FailCompress on a block the
+  // writer may already have freed.
+  std::lock_guard<std::mutex> lock(block->mutex);
+  block->done=true;
+  block->finished.notify_one();
+
+  return true;
+}
+
+void FileWriter::FailCompress(void* data){
+
+  FileWriter_block* block=reinterpret_cast<FileWriter_block*>(data);
+  std::lock_guard<std::mutex> lock(block->mutex);
+  block->ok=false;
+  block->done=true;
+  block->finished.notify_one();
+
 }
 
 void FileWriter::LoadConfig(){ // change to bool have a return type
@@ -151,9 +458,35 @@ void FileWriter::LoadConfig(){ // change to bool have a return type
   if(!m_variables.Get("verbose",m_verbose)) m_verbose=1;
   if(!m_variables.Get("file_path",m_file_name)) m_file_name="./data";
   if(!m_variables.Get("file_writeout_period",m_file_writeout_period)) m_file_writeout_period=60;//300;
+  if(!m_variables.Get("compression_level",m_compression_level)) m_compression_level=0;
+  if(m_compression_level<0) m_compression_level=0;
+  if(m_compression_level>9) m_compression_level=9;
+
+  // parts are closed at every write out and when reaching either limit, 0 disables a limit
+  unsigned long part_max_MB=2048;
+  double part_max_seconds=0;
+  m_variables.Get("part_max_MB",part_max_MB);
+  m_variables.Get("part_max_seconds",part_max_seconds);
+  m_part_max_bytes=part_max_MB*1024*1024;
+  m_part_max_duration=Time(static_cast<long double>(part_max_seconds));
+
+  // journal parts are append only with checksummed blocks, written out every journal_flush_ms and synced every journal_sync_blocks blocks
+  if(!m_variables.Get("journal",m_journal)) m_journal=false;
+  if(!m_variables.Get("journal_sync_blocks",m_journal_sync_blocks)) m_journal_sync_blocks=1;
+  unsigned int journal_flush_ms=1000;
+  m_variables.Get("journal_flush_ms",journal_flush_ms);
+
+  // every written slice is also published to this POSIX shared memory ring if set (e.g. /butler_slices), see SharedRing
+  if(!m_variables.Get("shm_ring",m_shm_ring)) m_shm_ring="";
+  if(!m_variables.Get("shm_ring_slots",m_shm_ring_slots) || m_shm_ring_slots==0) m_shm_ring_slots=64;
+  unsigned long shm_ring_slot_kB=4096;
+  m_variables.Get("shm_ring_slot_kB",shm_ring_slot_kB);
+  m_shm_ring_slot_size=shm_ring_slot_kB*1024;
   
+  // parts are numbered from 0 in every run, existing ones are skipped when opening
   m_part_number=0;
   args->last=boost::posix_time::microsec_clock::universal_time();
-  args->period=boost::posix_time::seconds(m_file_writeout_period);
+  if(m_journal) args->period=boost::posix_time::milliseconds(journal_flush_ms);
+  else args->period=boost::posix_time::seconds(m_file_writeout_period);
   
 }
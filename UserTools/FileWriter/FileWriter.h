@@ -3,9 +3,38 @@
 
 #include <string>
 #include <iostream>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
 
 #include "Tool.h"
 #include "DataModel.h"
+#include "SliceCodec.h"
+#include "PartFile.h"
+#include "SharedRing.h"
+
+/**
+ * \struct FileWriter_block
+ *
+ * One TimeSlice waiting to be written to a part file. For compressed and journal part files and the shared memory ring it is encoded (and compressed) by a worker pool job.
+ */
+
+struct FileWriter_block{
+
+  FileWriter_block(): level(1), raw_size(0), plain_size(0), done(false), ok(false), profiler(0){}
+  std::unique_ptr<TimeSlice> time_slice;
+  int level; ///< zlib compression level
+  std::string raw; ///< encoded slice
+  std::string compressed; ///< compressed encoded slice
+  uint64_t raw_size; ///< encoded slice size before compression
+  unsigned long plain_size; ///< size of the slice in the uncompressed file format
+  std::mutex mutex; ///< guards done
+  std::condition_variable finished; ///< notified when done is set
+  bool done; ///< set by the job when finished
+  bool ok; ///< whether compression succeeded
+  StageProfiler* profiler; ///< accounts the compression time to the file_writer stage
+
+};
 
 /**
  * \struct FileWriter_args_args
@@ -27,6 +56,25 @@ struct FileWriter_args:Thread_args{
   boost::posix_time::time_duration period;
   boost::posix_time::time_duration lapse;
   unsigned int* file_writeout_period;
+  int* compression_level;
+  unsigned long* part_max_bytes;
+  Time* part_max_duration;
+  PartFile part; ///< part being written
+  boost::posix_time::ptime part_start;
+  unsigned long part_plain_bytes; ///< size of the part data in the uncompressed format
+  double compression_ratio; ///< of the last compressed part, for preallocation
+  unsigned long part_run; ///< run of the part being written
+  unsigned long part_sub_run; ///< sub run of the part being written
+  ChannelCounters::Snapshot part_dropped; ///< hits lost to the memory budget when the part was opened
+  unsigned long part_dropped_slices; ///< slices lost to the memory budget when the part was opened
+  unsigned long late_part_number; ///< number of the next late part
+  bool* journal;
+  unsigned int* journal_sync_blocks;
+  std::string* shm_ring;
+  unsigned int* shm_ring_slots;
+  unsigned long* shm_ring_slot_size;
+  std::string ring_name; ///< name of the ring currently created
+  SharedRing ring; ///< shared memory ring for local consumers
 
 
 };
@@ -55,6 +103,13 @@ class FileWriter: public Tool {
 
   void LoadConfig();
   static void Thread(Thread_args* arg); ///< Function to be run by the thread in a loop. Make sure not to block in it
+  static void OpenPart(FileWriter_args* args, unsigned long expected, unsigned long run, unsigned long sub_run); ///< Open the next part of a run and sub run, preallocating for `expected` bytes of uncompressed data
+  static void ClosePart(FileWriter_args* args); ///< Close the current part and report its size and write rate to monitoring
+  static std::string PartName(FileWriter_args* args, unsigned long run, unsigned long sub_run, char kind, unsigned long number); ///< File name of a part, kind is P for parts and L for late parts
+  static void WriteLate(FileWriter_args* args); ///< Write the hits that missed their timeslice to late parts, one per run and sub run
+  static unsigned long PlainSize(TimeSlice& time_slice); ///< Size of a TimeSlice in an uncompressed part file
+  static bool CompressBlock(void* data); ///< Worker pool job encoding and compressing one FileWriter_block, always succeeds: a failed compression is reported in the block
+  static void FailCompress(void* data); ///< Worker pool failure function, for a job that never ran or threw before finishing; leaves the block to be compressed by the writer thread
   Utilities* m_util;  ///< Pointer to utilities class to help with threading
   FileWriter_args* args; ///< thread args (also holds pointer to the thread)
 
@@ -62,6 +117,14 @@ class FileWriter: public Tool {
   std::string m_file_name;
   unsigned long m_part_number;
   unsigned int m_file_writeout_period;
+  int m_compression_level; ///< 0 writes uncompressed part files, 1 to 9 the zlib level of compressed ones
+  unsigned long m_part_max_bytes; ///< maximum part size, 0 for no limit
+  Time m_part_max_duration; ///< maximum time span of the data in a part, 0 for no limit
+  bool m_journal; ///< write append only journal parts, see PartFile
+  unsigned int m_journal_sync_blocks; ///< journal blocks between syncs, 0 to sync only at every write out
+  std::string m_shm_ring; ///< name of the shared memory ring, empty for none
+  unsigned int m_shm_ring_slots; ///< slices kept in the ring
+  unsigned long m_shm_ring_slot_size; ///< maximum encoded slice size in the ring
 
 };
 
@@ -0,0 +1,113 @@
+#include "LinkTest.h"
+
+LinkTest::LinkTest():Tool(){}
+
+
+bool LinkTest::Initialise(std::string configfile, DataModel &data){
+
+  InitialiseTool(data);
+  InitialiseConfiguration(configfile);
+  //m_variables.Print();
+
+  if(!m_variables.Get("verbose",m_verbose)) m_verbose=1;
+  std::string role="sink";
+  m_variables.Get("role",role);
+  source= role=="source";
+  if(!source && role!="sink"){
+    Log("ERROR: LinkTest: unknown role "+role, v_error);
+    return false;
+  }
+  if(!m_variables.Get("period_ms",period_ms)) period_ms=10;
+  if(!m_variables.Get("boards",boards) || boards==0 || boards>16) boards=4;
+  if(!m_variables.Get("channels",channels) || channels==0 || channels>16) channels=16;
+  if(!m_variables.Get("hits",hits_per_channel)) hits_per_channel=10;
+  if(!m_variables.Get("wait",wait)) wait=0;
+  if(!m_variables.Get("periods",periods)) periods=500;
+  period=0;
+  readouts=0;
+  hits=0;
+
+  ExportConfiguration();
+
+  return true;
+}
+
+
+bool LinkTest::Execute(){
+
+  usleep(period_ms*1000);
+  if(source) Generate();
+  else Take();
+
+  return true;
+}
+
+
+bool LinkTest::Finalise(){
+
+  if(source){
+    Log("LinkTest: generated "+std::to_string(hits)+" hits in "+std::to_string(readouts)+" board readouts", v_message);
+    return true;
+  }
+
+  Take();
+  std::string ids;
+  for(auto id : digitizers) ids+=" "+std::to_string(id);
+  Log("LinkTest: received "+std::to_string(hits)+" hits in "+std::to_string(readouts)+" board readouts from digitizers"+ids, v_message);
+
+  return true;
+}
+
+void LinkTest::Generate(){
+
+  if(wait){
+    wait--;
+    return;
+  }
+  if(!periods) return;
+  periods--;
+
+  std::list<std::unique_ptr<std::vector<Hit>>> boards_read;
+  uint64_t start=period*period_ms*1000000ull;
+  uint64_t spacing=period_ms*1000000ull/(hits_per_channel+1);
+  for(unsigned int board=0; board<boards; board++){
+    std::unique_ptr<std::vector<Hit>> readout(new std::vector<Hit>());
+    for(unsigned int channel=0; channel<channels; channel++)
+      for(unsigned int i=0; i<hits_per_channel; i++){
+	Hit hit;
+	hit.time=Time::from_ns(start+(i+1)*spacing+channel);
+	hit.channel=board<<4 | channel;
+	hit.charge_short=100;
+	hit.charge_long=400;
+	hit.baseline=0;
+	readout->push_back(hit);
+      }
+    if(readout->empty()) continue;
+    hits+=readout->size();
+    readouts++;
+    boards_read.push_back(std::move(readout));
+  }
+  period++;
+
+  std::lock_guard<std::mutex> lock(m_data->raw_readout_mutex);
+  if(!m_data->raw_readout) m_data->raw_readout.reset(new std::list<std::unique_ptr<std::vector<Hit>>>());
+  m_data->raw_readout->splice(m_data->raw_readout->end(), boards_read);
+
+}
+
+void LinkTest::Take(){
+
+  std::unique_ptr<std::list<std::unique_ptr<std::vector<Hit>>>> readout;
+  m_data->raw_readout_mutex.lock();
+  std::swap(m_data->raw_readout, readout);
+  m_data->raw_readout_mutex.unlock();
+  if(!readout) return;
+
+  for(auto& board : *readout){
+    if(!board || board->empty()) continue;
+    readouts++;
+    hits+=board->size();
+    digitizers.insert(Hit::get_digitizer_id(board->front().channel));
+  }
+
+}
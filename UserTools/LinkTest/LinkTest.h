@@ -0,0 +1,53 @@
+#ifndef LinkTest_H
+#define LinkTest_H
+
+#include <string>
+#include <iostream>
+#include <set>
+
+#include "Tool.h"
+#include "DataModel.h"
+
+/**
+ * \class LinkTest
+ *
+ * Stand in for the Digitizer and for the Reformatter when testing the RawSender to RawReceiver link without hardware, see configfiles/link_test. As a source it puts synthetic board readouts into raw_readout, as a sink it takes and counts them; both log their totals in Finalise. Every Execute takes one readout period, so the Inline count of the toolchain sets how long it runs.
+ *
+ * Configuration: role (source or sink), period_ms (default 10), and for the source boards (default 4), channels (per board, default 16), hits (per channel and period, default 10), wait (periods without data first, e.g. for the receivers to connect, default 0), periods (readout periods with data, default 500).
+ *
+ * $Author: B.Richards $
+ * $Date: 2019/05/28 10:44:00 $
+ */
+
+class LinkTest: public Tool {
+
+
+ public:
+
+  LinkTest(); ///< Simple constructor
+  bool Initialise(std::string configfile,DataModel &data); ///< Initialise Function for setting up Tool resorces. @param configfile The path and name of the dynamic configuration file to read in. @param data A reference to the transient data class used to pass information between Tools.
+  bool Execute(); ///< Generates or takes the readouts of one period
+  bool Finalise(); ///< Logs the totals
+
+
+ private:
+
+  void Generate(); ///< One readout of every board
+  void Take(); ///< Count and free the readouts in raw_readout
+
+  bool source;
+  unsigned int period_ms;
+  unsigned int boards;
+  unsigned int channels;
+  unsigned int hits_per_channel;
+  unsigned long wait; ///< periods left before the first readout
+  unsigned long periods; ///< left to generate
+  unsigned long period; ///< generated so far
+  unsigned long readouts; ///< generated or taken
+  unsigned long hits; ///< generated or taken
+  std::set<unsigned int> digitizers; ///< ids of the boards taken
+
+};
+
+
+#endif
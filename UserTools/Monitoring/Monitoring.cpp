@@ -1,18 +1,13 @@
 #include "Monitoring.h"
 
-int parseLine(char* line){
-  // This assumes that a digit will be found and the line ends in " Kb".
-  int i = strlen(line);
-  const char* p = line;
-  while (*p <'0' || *p > '9') p++;
-  line[i-3] = '\0';
-  i = atoi(p);
-  return i;
-}
-
 Monitoring_args::Monitoring_args():Thread_args(){
 
   sock=0;
+  max_queued=100;
+  max_rate=10;
+  sent=0;
+  dropped_hwm=0;
+  overflow=0;
 }
 
 Monitoring_args::~Monitoring_args(){
@@ -38,15 +33,47 @@ bool Monitoring::Initialise(std::string configfile, DataModel &data){
   args->last =  boost::posix_time::microsec_clock::universal_time();
   args->data = m_data;
   args->last2 =  boost::posix_time::microsec_clock::universal_time();
+  args->stats_start =  boost::posix_time::microsec_clock::universal_time();
+  args->last_hits = m_data->channel_hits.Take();
   args->period2 =  boost::posix_time::seconds(1);
   args->monitoring_readout_mutex = &(m_data->monitoring_readout_mutex);
   args->monitoring_readout = &(m_data->monitoring_readout);
+  args->next_send = args->last;
+
+  std::string address="tcp://*:5656";
+  m_variables.Get("address",address);
+  int hwm=10;
+  m_variables.Get("hwm",hwm);
+  int linger=0;
   args->sock = new zmq::socket_t(*(m_data->context), ZMQ_PUB);
-  args->sock->bind("tcp://*:5656");
+  args->sock->setsockopt(ZMQ_SNDHWM, &hwm, sizeof(hwm));
+  args->sock->setsockopt(ZMQ_LINGER, &linger, sizeof(linger));
+#ifdef ZMQ_XPUB_NODROP
+  // report a full socket instead of dropping silently, so that drops are counted
+  int nodrop=1;
+  args->sock->setsockopt(ZMQ_XPUB_NODROP, &nodrop, sizeof(nodrop));
+#else
+  // before ZMQ 4.1 a PUB socket drops for each subscriber at its high water
+  // mark and always reports success, so there is nothing to count
+  m_data->services->SendLog("Warning: Monitoring: ZMQ "+std::to_string(ZMQ_VERSION_MAJOR)+"."+std::to_string(ZMQ_VERSION_MINOR)+" does not report slices dropped at the high water mark, monitoring_slices_dropped_hwm is not published", v_warning);
+#endif
+  args->sock->bind(address.c_str());
+
+  sampler_args=new Monitoring_sampler_args();
+  sampler_args->data = m_data;
+  sampler_args->last =  boost::posix_time::microsec_clock::universal_time();
+  sampler_args->last_profile = m_data->profiler.Take();
+  if(!sampler_args->metrics.Open()) m_data->services->SendLog("Warning: Monitoring: procfs is not available, process metrics disabled", v_error);
   
   LoadConfig();
   
-  m_util->CreateThread("test", &Thread, args);
+  m_util->CreateThread("Monitoring", &Thread, args);
+  StageProfiler::NameThread(args->thread, "Monitoring");
+  m_util->CreateThread("Sampler", &Sample, sampler_args);
+  StageProfiler::NameThread(sampler_args->thread, "Sampler");
+
+  m_data->sc_vars.Add("ProfileDump",COMMAND, std::bind(&Monitoring::ProfileDump, this,  std::placeholders::_1));
+  m_data->sc_vars["ProfileDump"]->SetValue("command");
 
   ExportConfiguration();
   
@@ -69,60 +96,12 @@ bool Monitoring::Execute(){
   // }
   // }
   
-  struct sysinfo memInfo;
-  sysinfo (&memInfo);
-  /* 
-     mem= (((float) memInfo.totalram - (float)memInfo.freeram)/((float)memInfo.totalram)) * 100;
-  */
-
-  //// Get mem
-  FILE* file2 = fopen("/proc/self/status", "r");
-  int result = -1;
-  char line[128];
-  
-  while (fgets(line, 128, file2) != NULL){
-    if (strncmp(line, "VmRSS:", 6) == 0){
-      result = parseLine(line);
-      break;
-    }
-  }
-  fclose(file2);
-  
-  mem= (((float)result * 1000)/ ((float) memInfo.totalram))*100;
-  while(mem > 100.0) mem= mem/1000.0;
-  
-  
-  // get cpu
-  float percent;
-  FILE* file;
-  unsigned long long totalUser, totalUserLow, totalSys, totalIdle, total;
-
-  file = fopen("/proc/stat", "r");
-  fscanf(file, "cpu %llu %llu %llu %llu", &totalUser, &totalUserLow, &totalSys, &totalIdle);
-  fclose(file);
-  
-  if (totalUser < lastTotalUser || totalUserLow < lastTotalUserLow ||
-      totalSys < lastTotalSys || totalIdle < lastTotalIdle){
-    //Overflow detection. Just skip this value.
-    cpu = -1.0;
-  }
-  else{
-    total = (totalUser - lastTotalUser) + (totalUserLow - lastTotalUserLow) +
-      (totalSys - lastTotalSys);
-    cpu = total;
-    total += (totalIdle - lastTotalIdle);
-    cpu /= total;
-    cpu *= 100;
-  }
-  
-  lastTotalUser = totalUser;
-  lastTotalUserLow = totalUserLow;
-  lastTotalSys = totalSys;
-  lastTotalIdle = totalIdle;
-  
+  // filled in by the sampler thread
+  float mem=0;
+  float cpu=0;
   m_data->monitoring_store_mtx.lock();
-  m_data->monitoring_store.Set("cpu",cpu);
-  m_data->monitoring_store.Set("mem",mem);
+  m_data->monitoring_store.Get("cpu",cpu);
+  m_data->monitoring_store.Get("mem",mem);
   m_data->monitoring_store_mtx.unlock();
     
   std::stringstream tmp;
@@ -133,7 +112,7 @@ bool Monitoring::Execute(){
   m_data->vars.Get("part",part);
   m_data->monitoring_store.Get("pool_threads",workers);
   
-  tmp<< runinfo<<" buffers: unsorted| sorted| triggered| final | monitoring readout = "<<m_data->readout.size()<<"| "<<m_data->sorted_readout.size()<<"| "<<m_data->triggered_readout.size()<<"| "<<m_data->triggered_readout.size()<<"| "<<m_data->triggered_readout.size()<<"| "<<" (files="<<part<<") jobs:workers = "<<m_data->job_queue.size()<<":"<<workers<<" mem="<<mem<<"% cpu="<<cpu<<"%";;
+  tmp<< runinfo<<" buffers: unsorted| sorted| triggered| final | monitoring readout = "<<m_data->readout.size()<<"| "<<m_data->sorted_readout.size()<<"| "<<m_data->triggered_readout.size()<<"| "<<m_data->triggered_readout.size()<<"| "<<m_data->triggered_readout.size()<<"| "<<" (files="<<part<<") jobs:workers = "<<m_data->job_queue.size()<<":"<<workers<<" mem="<<mem<<"% cpu="<<cpu<<"% in flight="<<m_data->slice_budget.Used()/1048576<<"MB dropped="<<m_data->slice_budget.DroppedSlices();
   m_data->vars.Set("Status",tmp.str());
   
   return true;
@@ -142,11 +121,22 @@ bool Monitoring::Execute(){
 
 bool Monitoring::Finalise(){
 
+  m_data->sc_vars.Remove("ProfileDump");
+
   m_util->KillThread(args);
+  m_util->KillThread(sampler_args);
+
+  // nobody publishes the slices any more
+  std::array<uint64_t, SliceSampler::trigger_types> prescales;
+  prescales.fill(1);
+  m_data->monitoring_sampler.Configure(SliceSampler::Policy::none, 1, prescales);
 
   delete args;
   args=0;
 
+  delete sampler_args;
+  sampler_args=0;
+
   delete m_util;
   m_util=0;
 
@@ -180,51 +170,183 @@ void Monitoring::Thread(Thread_args* arg){
   }
   */
   
+  TakeSlices(args);
+  SendSlices(args);
+
   args->lapse = args->period -( boost::posix_time::microsec_clock::universal_time() - args->last);
   //std::cout<< m_lapse<<std::endl;
   
   if(!args->lapse.is_negative() ){
-    usleep(100);
+    args->data->profiler.Sleep(100, StageProfiler::monitoring);
     return;
   }
     //printf("in runstart lapse\n");
+
+    StageProfiler::Scope scope(args->data->profiler, StageProfiler::monitoring);
     
     std::string json="";
-    Store tmp;
-    for(unsigned int i=0; i<args->data->channel_hits.size(); i++){
 
-      tmp.Set(std::to_string(i),(unsigned int)args->data->channel_hits.at(i));
+    // hit counts and the rates since the last publication of the channels with hits
+    ChannelCounters::Snapshot hits=args->data->channel_hits.Take();
+    std::array<double, ChannelCounters::channels> rates=hits.Rates(args->last_hits);
+    args->last_hits=hits;
 
+    args->data->monitoring_store_mtx.lock();
+    for(unsigned int i=0; i<ChannelCounters::channels; i++){
+      if(!hits.counts[i]) continue;
+      args->data->monitoring_store.Set("channel_"+std::to_string(i)+"_hits",hits.counts[i]);
+      args->data->monitoring_store.Set("channel_"+std::to_string(i)+"_rate",rates[i]);
     }
 
-    tmp>>json;
-
-    args->data->monitoring_store_mtx.lock();
+    // in flight memory and the data lost to it since the start
+    SliceBudget& budget=args->data->slice_budget;
+    for(unsigned int i=0; i<ChannelCounters::channels; i++){
+      uint64_t dropped=budget.dropped_hits.Get(i);
+      if(dropped) args->data->monitoring_store.Set("channel_"+std::to_string(i)+"_dropped",dropped);
+      uint64_t late=args->data->late_hits.Get(i);
+      if(late) args->data->monitoring_store.Set("channel_"+std::to_string(i)+"_late",late);
+    }
+    args->data->monitoring_store.Set("memory_used_MB",budget.Used()/1048576.0);
+    args->data->monitoring_store.Set("memory_peak_MB",budget.Peak()/1048576.0);
+    args->data->monitoring_store.Set("memory_budget_MB",budget.Max()/1048576.0);
+    args->data->monitoring_store.Set("memory_blocked_s",budget.BlockedSeconds());
+    args->data->monitoring_store.Set("dropped_slices",budget.DroppedSlices());
+    args->data->monitoring_store.Set("shed_untriggered",budget.ShedUntriggered());
+    args->data->monitoring_store.Set("shed_zero_bias",budget.ShedZeroBias());
+
+    // published slices
+    args->data->monitoring_store.Set("monitoring_slices_seen",args->data->monitoring_sampler.Seen());
+    args->data->monitoring_store.Set("monitoring_slices_sampled",args->data->monitoring_sampler.Selected());
+    args->data->monitoring_store.Set("monitoring_slices_sent",args->sent);
+#ifdef ZMQ_XPUB_NODROP
+    args->data->monitoring_store.Set("monitoring_slices_dropped_hwm",args->dropped_hwm);
+#endif
+    args->data->monitoring_store.Set("monitoring_slices_overflow",args->overflow);
+    args->data->monitoring_store.Set("monitoring_slices_queued",args->outbox.size());
     args->data->monitoring_store>>json;
     args->data->monitoring_store_mtx.unlock();
     args->data->services->SendMonitoringData(json);
 
-    args->monitoring_readout_mutex->lock();
-    if(args->monitoring_readout->size()) std::swap(*args->monitoring_readout, args->in_progress);
-    args->monitoring_readout_mutex->unlock();
+    // rates and spectra of the hits triggered since the last publication
+    boost::posix_time::ptime now=boost::posix_time::microsec_clock::universal_time();
+    args->data->channel_stats.Collect(args->channel_stats);
+    std::stringstream histograms;
+    args->channel_stats.WriteJSON(histograms, (now - args->stats_start).total_microseconds()/1e6);
+    args->data->services->SendMonitoringData(histograms.str(), "histograms");
+    args->channel_stats.Reset();
+    args->stats_start=now;
 
-    for( size_t i=0; i <args->in_progress.size(); i++){
-      args->in_progress.front()->Send(args->sock);
-      args->in_progress.pop();
-    }
-    
     args->last = boost::posix_time::microsec_clock::universal_time();
     
   
 }
 
+void Monitoring::TakeSlices(Monitoring_args* args){
+
+  args->monitoring_readout_mutex->lock();
+  if(args->monitoring_readout->size()) std::swap(*args->monitoring_readout, args->in_progress);
+  args->monitoring_readout_mutex->unlock();
+
+  for(; args->in_progress.size(); args->in_progress.pop()) args->outbox.push_back(std::move(args->in_progress.front()));
+
+  // the newest slices are the most interesting to the viewers
+  while(args->outbox.size()>args->max_queued){
+    args->outbox.pop_front();
+    args->overflow++;
+  }
+
+}
+
+void Monitoring::SendSlices(Monitoring_args* args){
+
+  if(!args->outbox.size()) return;
+  boost::posix_time::ptime now=boost::posix_time::microsec_clock::universal_time();
+  if(now<args->next_send) return;
+
+  // spread the queued slices over the rest of the period, no faster than max_rate
+  long long left=(args->period - (now - args->last)).total_microseconds();
+  long long interval= left>0 ? left/static_cast<long long>(args->outbox.size()) : 0;
+  if(args->max_rate>0 && interval<1e6/args->max_rate) interval=1e6/args->max_rate;
+  args->next_send=now+boost::posix_time::microseconds(interval);
+
+  std::unique_ptr<TimeSlice> slice=std::move(args->outbox.front());
+  args->outbox.pop_front();
+  if(StageLink::SendSlice(args->sock, *slice, ZMQ_DONTWAIT)) args->sent++;
+  else args->dropped_hwm++;
+
+}
+
+void Monitoring::Sample(Thread_args* arg){
+
+  Monitoring_sampler_args* args=reinterpret_cast<Monitoring_sampler_args*>(arg);
+
+  args->lapse = args->period -( boost::posix_time::microsec_clock::universal_time() - args->last);
+
+  if(!args->lapse.is_negative() ){
+    usleep(args->lapse.total_microseconds() < 10000 ? args->lapse.total_microseconds() : 10000);
+    return;
+  }
+  args->last = boost::posix_time::microsec_clock::universal_time();
+
+  // sample into a private store so that the procfs reads happen outside of the lock
+  args->sample.Delete();
+  args->metrics.Sample(args->sample);
+  StageProfiler::Snapshot profile=args->data->profiler.Take();
+  StageProfiler::Publish(args->last_profile, profile, args->sample);
+  args->last_profile=profile;
+
+  // the pool creates and ends threads all the time, forget those that ended
+  std::vector<std::string> ended;
+  args->metrics.TakeEnded(ended);
+
+  std::string json;
+  args->sample>>json;
+  args->data->monitoring_store_mtx.lock();
+  for(size_t i=0; i<ended.size(); i++) args->data->monitoring_store.Remove(ended[i]);
+  args->data->monitoring_store.JsonParser(json);
+  args->data->monitoring_store_mtx.unlock();
+
+}
+
+std::string Monitoring::ProfileDump(const char* key){
+
+  std::stringstream dump;
+  m_data->profiler.Write(dump);
+  m_data->services->SendLog("Stage profile:\n"+dump.str(), v_message);
+
+  return dump.str();
+}
+
 bool Monitoring::LoadConfig(){
 
   if(!m_variables.Get("verbose",m_verbose)) m_verbose=1;
   unsigned int period_sec=0;
   if(!m_variables.Get("period_sec",period_sec)) period_sec=60;
   args->period = boost::posix_time::seconds(period_sec);
-  
+  unsigned int metrics_period_ms=1000;
+  m_variables.Get("metrics_period_ms",metrics_period_ms);
+  if(metrics_period_ms==0) metrics_period_ms=1000;
+  sampler_args->period = boost::posix_time::milliseconds(metrics_period_ms);
+
+  if(!m_variables.Get("max_slices_per_sec",args->max_rate) || args->max_rate<0) args->max_rate=10;
+  if(!m_variables.Get("max_queued_slices",args->max_queued)) args->max_queued=100;
+
+  std::string policy="nth";
+  m_variables.Get("sample_policy",policy);
+  SliceSampler::Policy sample_policy=SliceSampler::Policy::nth;
+  if(policy=="none") sample_policy=SliceSampler::Policy::none;
+  else if(policy=="triggered") sample_policy=SliceSampler::Policy::triggered;
+  else if(policy=="prescaled") sample_policy=SliceSampler::Policy::prescaled;
+  else if(policy!="nth") m_data->services->SendLog("Warning: Monitoring: unknown sample_policy "+policy+", using nth", v_warning);
+  uint64_t every=100;
+  m_variables.Get("sample_every",every);
+  std::array<uint64_t, SliceSampler::trigger_types> prescales;
+  TriggerInfo names;
+  for(size_t i=0; i<prescales.size(); i++){
+    prescales[i]=1;
+    m_variables.Get("prescale_"+names.GetType(static_cast<TriggerType>(i)),prescales[i]);
+  }
+  m_data->monitoring_sampler.Configure(sample_policy, every, prescales);
   
   return true;
 
@@ -3,11 +3,12 @@
 
 #include <string>
 #include <iostream>
+#include <deque>
 
 #include "Tool.h"
 #include "DataModel.h"
-#include "sys/types.h"
-#include "sys/sysinfo.h"
+#include "ProcessMetrics.h"
+#include "StageLink.h"
 #include <zmq.hpp>
 
 /**
@@ -38,13 +39,45 @@ struct Monitoring_args:Thread_args{
   std::queue<std::unique_ptr<TimeSlice>> in_progress;
   std::unique_ptr<TimeSlice> time_slice;
   zmq::socket_t* sock;
+  std::deque<std::unique_ptr<TimeSlice>> outbox; ///< sampled slices waiting to be published
+  size_t max_queued; ///< outbox size beyond which the oldest slices are dropped
+  double max_rate; ///< published slices per second, 0 for no limit
+  boost::posix_time::ptime next_send; ///< earliest time of the next publication
+  unsigned long sent; ///< slices published since the start
+  unsigned long dropped_hwm; ///< slices dropped at the high water mark of the socket since the start, only known with ZMQ 4.1 or later
+  unsigned long overflow; ///< slices dropped from a full outbox since the start
+  ChannelStats channel_stats; ///< per channel rates and spectra collected for publishing
+  boost::posix_time::ptime stats_start; ///< start of the period covered by channel_stats
+  ChannelCounters::Snapshot last_hits; ///< channel hit counts at the last publication
   
 };
 
+/**
+ * \struct Monitoring_sampler_args
+ *
+ * Data of the process metrics sampler thread, which keeps the procfs reads out of the ToolChain loop.
+ */
+
+struct Monitoring_sampler_args:Thread_args{
+
+  boost::posix_time::time_duration period;
+  boost::posix_time::time_duration lapse;
+  boost::posix_time::ptime last;
+  DataModel* data;
+  ProcessMetrics metrics;
+  StageProfiler::Snapshot last_profile; ///< stage times at the previous sample
+  Store sample; ///< metrics of the last sample, copied into monitoring_store
+
+};
+
 /**
  * \class Monitoring
  *
  * This is a template for a Tool that produces a single thread that can be assigned a function seperate to the main thread. Please fill out the descripton and author information.
+ *
+ * Written slices are sampled by the FileWriter according to sample_policy (none, nth, triggered or prescaled, see SliceSampler) and published on a PUB socket as StageLink slice frames, spread over the period and at most max_slices_per_sec. Slices the socket does not take at its high water mark are dropped; they are counted in monitoring_slices_dropped_hwm with ZMQ 4.1 or later (ZMQ_XPUB_NODROP) only. The pinned ZMQ 4.0.7 drops them for each slow subscriber without telling the sender, so the counter is not published and the rate of monitoring_slices_sent is the only measure of the stream.
+ *
+ * Configuration: address (ZMQ endpoint to bind, default tcp://*:5656), hwm (slices, default 10), period_sec (default 60), max_slices_per_sec (default 10, 0 for no limit), max_queued_slices (default 100), sample_policy (default nth), sample_every (default 100), prescale_<trigger type> (default 1, 0 never selects the type). address and hwm are only read at initialisation.
 *
 * $Author: B.Richards $
 * $Date: 2019/05/28 10:44:00 $
@@ -65,13 +98,14 @@ class Monitoring: public Tool {
 
   bool LoadConfig();
   static void Thread(Thread_args* arg); ///< Function to be run by the thread in a loop. Make sure not to block in it
+  static void TakeSlices(Monitoring_args* args); ///< Move the slices sampled by the FileWriter to the outbox
+  static void SendSlices(Monitoring_args* args); ///< Publish the next slice of the outbox when it is due, spreading them over the period
+  static void Sample(Thread_args* arg); ///< Sampler thread function, sets the process and stage metrics in monitoring_store every metrics_period_ms
+  std::string ProfileDump(const char* key); ///< ProfileDump slow control command, returns the stage time totals
   std::string m_configfile;
   Utilities* m_util;  ///< Pointer to utilities class to help with threading
   Monitoring_args* args; ///< thread args (also holds pointer to the thread)
-
-  unsigned long long lastTotalUser, lastTotalUserLow, lastTotalSys, lastTotalIdle;
-  float mem;
-  float cpu;
+  Monitoring_sampler_args* sampler_args; ///< sampler thread args
 
 };
 
@@ -0,0 +1,206 @@
+#include "ProcessMetrics.h"
+
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/sysinfo.h>
+
+namespace{
+
+  double Now(){
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec*1e-9;
+  }
+
+  unsigned long long StatusValue(const std::string& status, const char* key){
+    size_t pos=status.find(key);
+    if(pos==std::string::npos) return 0;
+    return strtoull(status.c_str()+pos+strlen(key), 0, 10);
+  }
+
+}
+
+ProcessMetrics::ProcessMetrics(): m_stat_fd(-1), m_status_fd(-1), m_system_stat_fd(-1), m_first(true){}
+
+ProcessMetrics::~ProcessMetrics(){
+
+  if(m_stat_fd>=0) close(m_stat_fd);
+  if(m_status_fd>=0) close(m_status_fd);
+  if(m_system_stat_fd>=0) close(m_system_stat_fd);
+  for(std::map<int, ThreadInfo>::iterator it=m_threads.begin(); it!=m_threads.end(); it++) close(it->second.fd);
+
+}
+
+bool ProcessMetrics::Open(){
+
+  m_stat_fd=open("/proc/self/stat", O_RDONLY);
+  m_status_fd=open("/proc/self/status", O_RDONLY);
+  m_system_stat_fd=open("/proc/stat", O_RDONLY);
+
+  m_ticks_per_second=sysconf(_SC_CLK_TCK);
+  m_page_MB=sysconf(_SC_PAGESIZE)/(1024.0*1024.0);
+  struct sysinfo info;
+  sysinfo(&info);
+  m_total_MB=double(info.totalram)*info.mem_unit/(1024.0*1024.0);
+
+  m_first=true;
+  return m_stat_fd>=0 && m_status_fd>=0 && m_system_stat_fd>=0;
+}
+
+bool ProcessMetrics::Read(int fd, std::string& buffer){
+
+  if(fd<0) return false;
+  buffer.resize(4096);
+  size_t size=0;
+  while(true){
+    ssize_t n=pread(fd, &buffer[size], buffer.size()-size, size);
+    if(n<0) return false;
+    if(n==0) break;
+    size+=n;
+    if(size==buffer.size()) buffer.resize(2*size);
+  }
+  buffer.resize(size);
+  return true;
+}
+
+bool ProcessMetrics::StatFields(const std::string& stat, std::vector<unsigned long long>& fields){
+
+  // the command name in parentheses may contain spaces and parentheses
+  size_t pos=stat.rfind(')');
+  if(pos==std::string::npos || pos+4>stat.size()) return false;
+
+  fields.clear();
+  fields.push_back(0); // state, not numeric
+  const char* p=stat.c_str()+pos+4;
+  char* end=0;
+  while(true){
+    unsigned long long value=strtoull(p, &end, 10);
+    if(end==p) break;
+    fields.push_back(value);
+    p=end;
+  }
+  return fields.size()>13;
+}
+
+void ProcessMetrics::UpdateThreads(){
+
+  for(std::map<int, ThreadInfo>::iterator it=m_threads.begin(); it!=m_threads.end(); it++) it->second.seen=false;
+
+  DIR* dir=opendir("/proc/self/task");
+  if(dir){
+    while(dirent* entry=readdir(dir)){
+      int tid=atoi(entry->d_name);
+      if(tid<=0) continue;
+      std::map<int, ThreadInfo>::iterator it=m_threads.find(tid);
+      if(it!=m_threads.end()){
+	it->second.seen=true;
+	continue;
+      }
+
+      std::string path=std::string("/proc/self/task/")+entry->d_name;
+      ThreadInfo thread;
+      thread.fd=open((path+"/stat").c_str(), O_RDONLY);
+      if(thread.fd<0) continue;
+      thread.ticks=0;
+      thread.sampled=false;
+      thread.seen=true;
+      m_threads[tid]=thread;
+    }
+    closedir(dir);
+  }
+
+  for(std::map<int, ThreadInfo>::iterator it=m_threads.begin(); it!=m_threads.end();){
+    if(it->second.seen){
+      it++;
+      continue;
+    }
+    close(it->second.fd);
+    m_ended.push_back(it->first);
+    m_threads.erase(it++);
+  }
+
+}
+
+void ProcessMetrics::TakeEnded(std::vector<std::string>& keys){
+
+  for(size_t i=0; i<m_ended.size(); i++){
+    std::string key="thread_"+std::to_string(m_ended[i]);
+    keys.push_back(key+"_name");
+    keys.push_back(key+"_cpu");
+  }
+  m_ended.clear();
+
+}
+
+void ProcessMetrics::Sample(Store& store){
+
+  double now=Now();
+  double seconds=now-m_last_time;
+  bool rates= !m_first && seconds>0;
+  std::vector<unsigned long long> fields;
+
+  // system wide cpu: user nice system idle iowait irq softirq steal
+  if(Read(m_system_stat_fd, m_buffer)){
+    unsigned long long value[8]={0};
+    sscanf(m_buffer.c_str(), "cpu %llu %llu %llu %llu %llu %llu %llu %llu", &value[0], &value[1], &value[2], &value[3], &value[4], &value[5], &value[6], &value[7]);
+    unsigned long long total=0;
+    for(int i=0; i<8; i++) total+=value[i];
+    unsigned long long busy=total-value[3]-value[4];
+    if(rates && total>m_last_total) store.Set("cpu", 100.0*(busy-m_last_busy)/(total-m_last_total));
+    m_last_busy=busy;
+    m_last_total=total;
+  }
+
+  // process: minflt is field 10, majflt 12, utime 14, stime 15, rss 24
+  if(Read(m_stat_fd, m_buffer) && StatFields(m_buffer, fields) && fields.size()>22){
+    unsigned long long minflt=fields[10-3];
+    unsigned long long majflt=fields[12-3];
+    unsigned long long ticks=fields[14-3]+fields[15-3];
+    double rss_MB=fields[24-3]*m_page_MB;
+    store.Set("rss_MB", rss_MB);
+    if(m_total_MB>0) store.Set("mem", 100.0*rss_MB/m_total_MB);
+    if(rates){
+      store.Set("process_cpu", 100.0*(ticks-m_last_ticks)/m_ticks_per_second/seconds);
+      store.Set("minor_faults_per_s", (minflt-m_last_minflt)/seconds);
+      store.Set("major_faults_per_s", (majflt-m_last_majflt)/seconds);
+    }
+    m_last_ticks=ticks;
+    m_last_minflt=minflt;
+    m_last_majflt=majflt;
+  }
+
+  if(Read(m_status_fd, m_buffer)){
+    unsigned long long voluntary=StatusValue(m_buffer, "\nvoluntary_ctxt_switches:");
+    unsigned long long involuntary=StatusValue(m_buffer, "\nnonvoluntary_ctxt_switches:");
+    if(rates){
+      store.Set("ctx_switches_per_s", (voluntary-m_last_voluntary)/seconds);
+      store.Set("involuntary_ctx_switches_per_s", (involuntary-m_last_involuntary)/seconds);
+    }
+    m_last_voluntary=voluntary;
+    m_last_involuntary=involuntary;
+  }
+
+  UpdateThreads();
+  store.Set("threads", m_threads.size());
+  for(std::map<int, ThreadInfo>::iterator it=m_threads.begin(); it!=m_threads.end(); it++){
+    ThreadInfo& thread=it->second;
+    if(!Read(thread.fd, m_buffer) || !StatFields(m_buffer, fields)) continue;
+    unsigned long long ticks=fields[14-3]+fields[15-3];
+    std::string key="thread_"+std::to_string(it->first);
+    // the name is re-read as threads may be renamed, e.g. by the pool jobs
+    size_t begin=m_buffer.find('(');
+    size_t end=m_buffer.rfind(')');
+    if(begin!=std::string::npos && end>begin) store.Set(key+"_name", m_buffer.substr(begin+1, end-begin-1));
+    if(rates && thread.sampled) store.Set(key+"_cpu", 100.0*(ticks-thread.ticks)/m_ticks_per_second/seconds);
+    thread.ticks=ticks;
+    thread.sampled=true;
+  }
+
+  m_last_time=now;
+  m_first=false;
+
+}
@@ -0,0 +1,60 @@
+#ifndef ProcessMetrics_H
+#define ProcessMetrics_H
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include "Store.h"
+
+using namespace ToolFramework;
+
+/**
+ * \class ProcessMetrics
+ *
+ * Samples CPU, memory, context switch and page fault figures of the process and of each of its threads from procfs. The procfs files are opened once and re-read with pread on every Sample, thread files are opened when a thread first appears and closed when it ends. Rates are computed between consecutive samples.
+ */
+
+class ProcessMetrics{
+
+ public:
+
+  ProcessMetrics(); ///< Simple constructor
+  ~ProcessMetrics();
+  bool Open(); ///< Open the procfs files, false if they are not available
+  void Sample(Store& store); ///< Read the counters and set the metrics in store: cpu (whole machine, %), process_cpu (% of one core), mem (resident memory, % of RAM), rss_MB, threads, ctx_switches_per_s, involuntary_ctx_switches_per_s, minor_faults_per_s, major_faults_per_s, and thread_<tid>_name and thread_<tid>_cpu (% of one core) for every thread
+  void TakeEnded(std::vector<std::string>& keys); ///< Append the thread_<tid>_ keys of the threads that ended since the last call, to be removed from the stores they were set in
+
+ private:
+
+  struct ThreadInfo{
+    int fd; ///< /proc/self/task/<tid>/stat
+    unsigned long long ticks; ///< utime+stime at the previous sample
+    bool sampled; ///< whether ticks is set
+    bool seen;
+  };
+
+  static bool Read(int fd, std::string& buffer); ///< pread the whole file
+  static bool StatFields(const std::string& stat, std::vector<unsigned long long>& fields); ///< numeric fields after the command name of a stat file, fields[0] being the state field 3
+  void UpdateThreads();
+
+  int m_stat_fd; ///< /proc/self/stat
+  int m_status_fd; ///< /proc/self/status
+  int m_system_stat_fd; ///< /proc/stat
+  std::map<int, ThreadInfo> m_threads;
+  std::vector<int> m_ended; ///< tids of the threads that ended since the last TakeEnded
+  std::string m_buffer;
+
+  double m_ticks_per_second;
+  double m_page_MB;
+  double m_total_MB;
+  bool m_first;
+  double m_last_time; ///< seconds, monotonic clock
+  unsigned long long m_last_busy, m_last_total; ///< system wide jiffies
+  unsigned long long m_last_ticks, m_last_minflt, m_last_majflt; ///< process counters
+  unsigned long long m_last_voluntary, m_last_involuntary;
+
+};
+
+
+#endif
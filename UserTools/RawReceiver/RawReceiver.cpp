@@ -0,0 +1,170 @@
+#include "RawReceiver.h"
+
+RawReceiver_args::RawReceiver_args():Thread_args(){
+  data=0;
+  sock=0;
+  received=0;
+  granted=0;
+  window=16;
+  max_pending_boards=1024;
+  follow_run=true;
+  followed=false;
+  run_changed=false;
+  bytes=0;
+  errors=0;
+}
+
+RawReceiver_args::~RawReceiver_args(){
+  delete sock;
+  sock=0;
+}
+
+
+RawReceiver::RawReceiver():Tool(){}
+
+
+bool RawReceiver::Initialise(std::string configfile, DataModel &data){
+
+  InitialiseTool(data);
+  m_configfile=configfile;
+  InitialiseConfiguration(configfile);
+  //m_variables.Print();
+
+  m_util=new Utilities();
+  args=new RawReceiver_args();
+  args->data=m_data;
+  args->last_credit=boost::posix_time::microsec_clock::universal_time();
+  args->last_stats=args->last_credit;
+
+  LoadConfig();
+
+  std::string address="tcp://localhost:5660";
+  m_variables.Get("address",address);
+  int linger=0;
+  args->sock=new zmq::socket_t(*(m_data->context), ZMQ_DEALER);
+  args->sock->setsockopt(ZMQ_LINGER, &linger, sizeof(linger));
+  args->sock->connect(address.c_str());
+
+  m_util->CreateThread("RawReceiver", &Thread, args);
+  StageProfiler::NameThread(args->thread, "RawReceiver");
+
+  ExportConfiguration();
+
+  return true;
+}
+
+
+bool RawReceiver::Execute(){
+
+  // without a RunControl in this toolchain a followed run is started here, for a single Execute as RunControl does
+  if(args->follow_run) m_data->run_start=args->run_changed.exchange(false);
+
+  if(m_data->change_config){
+    InitialiseConfiguration(m_configfile);
+    LoadConfig();
+    ExportConfiguration();
+  }
+
+  return true;
+}
+
+
+bool RawReceiver::Finalise(){
+
+  m_util->KillThread(args);
+
+  delete args;
+  args=0;
+
+  delete m_util;
+  m_util=0;
+
+  return true;
+}
+
+void RawReceiver::Thread(Thread_args* arg){
+
+  RawReceiver_args* args=reinterpret_cast<RawReceiver_args*>(arg);
+
+  // grant more batches only while the Reformatter keeps up
+  size_t pending=0;
+  args->data->raw_readout_mutex.lock();
+  if(args->data->raw_readout) pending=args->data->raw_readout->size();
+  args->data->raw_readout_mutex.unlock();
+
+  boost::posix_time::ptime now=boost::posix_time::microsec_clock::universal_time();
+  bool grant= pending<args->max_pending_boards && args->received+args->window>args->granted;
+  if(grant) args->granted=args->received+args->window;
+  if(grant || now - args->last_credit >= boost::posix_time::seconds(1)) SendCredit(args);
+
+  zmq::pollitem_t items[]={{*args->sock, 0, ZMQ_POLLIN, 0}};
+  zmq::poll(&items[0], 1, 10);
+  if(!(items[0].revents & ZMQ_POLLIN)) return;
+
+  std::list<std::unique_ptr<std::vector<Hit>>> boards;
+  zmq::message_t message;
+  while(args->sock->recv(&message, ZMQ_DONTWAIT)){
+    args->received++;
+    args->bytes+=message.size();
+    unsigned long run, sub_run;
+    std::list<std::unique_ptr<std::vector<Hit>>> batch;
+    if(!StageLink::Decode(static_cast<const char*>(message.data()), message.size(), run, sub_run, batch)){
+      args->errors++;
+      args->data->services->SendLog("ERROR: RawReceiver: undecodable batch of "+std::to_string(message.size())+" bytes", v_error);
+      continue;
+    }
+    if(args->follow_run && (!args->followed || run!=args->data->run_number || sub_run!=args->data->sub_run_number)){
+      // the readouts of the previous run are queued before the run changes
+      Queue(args, boards);
+      if(!args->followed || run!=args->data->run_number) args->run_changed=true;
+      args->followed=true;
+      args->data->run_number=run;
+      args->data->sub_run_number=sub_run;
+      args->data->services->SendLog("RawReceiver: following run "+std::to_string(run)+" sub run "+std::to_string(sub_run), v_message);
+    }
+    boards.splice(boards.end(), batch);
+  }
+  Queue(args, boards);
+
+  if(now - args->last_stats < boost::posix_time::seconds(1)) return;
+  args->last_stats=now;
+
+  args->data->monitoring_store_mtx.lock();
+  args->data->monitoring_store.Set("link_batches_received", args->received);
+  args->data->monitoring_store.Set("link_MB_received", args->bytes/1048576.0);
+  args->data->monitoring_store.Set("link_batch_errors", args->errors);
+  args->data->monitoring_store.Set("link_boards_pending", pending);
+  args->data->monitoring_store_mtx.unlock();
+
+}
+
+void RawReceiver::Queue(RawReceiver_args* args, std::list<std::unique_ptr<std::vector<Hit>>>& boards){
+
+  if(!boards.size()) return;
+  args->data->profiler.Lock(args->data->raw_readout_mutex, StageProfiler::digitizer);
+  if(!args->data->raw_readout) args->data->raw_readout.reset(new std::list<std::unique_ptr<std::vector<Hit>>>());
+  args->data->raw_readout->splice(args->data->raw_readout->end(), boards);
+  args->data->raw_readout_mutex.unlock();
+
+}
+
+void RawReceiver::SendCredit(RawReceiver_args* args){
+
+  StageLink::Credit credit;
+  credit.granted=args->granted;
+  credit.window=args->window;
+  zmq::message_t message(&credit, sizeof(credit));
+  if(args->sock->send(message, ZMQ_DONTWAIT)) args->last_credit=boost::posix_time::microsec_clock::universal_time();
+
+}
+
+void RawReceiver::LoadConfig(){
+
+  if(!m_variables.Get("verbose",m_verbose)) m_verbose=1;
+  if(!m_variables.Get("credit_window",args->window) || args->window==0) args->window=16;
+  if(!m_variables.Get("max_pending_boards",args->max_pending_boards) || args->max_pending_boards==0) args->max_pending_boards=1024;
+  int follow_run=1;
+  m_variables.Get("follow_run",follow_run);
+  args->follow_run=follow_run;
+
+}
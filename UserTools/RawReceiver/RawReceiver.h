@@ -0,0 +1,76 @@
+#ifndef RawReceiver_H
+#define RawReceiver_H
+
+#include <string>
+#include <iostream>
+
+#include "Tool.h"
+#include "DataModel.h"
+#include "StageLink.h"
+
+/**
+ * \struct RawReceiver_args
+ *
+ * Data of the receiving thread.
+ *
+ * $Author: B.Richards $
+ * $Date: 2019/05/28 10:44:00 $
+ */
+
+struct RawReceiver_args:Thread_args{
+
+  RawReceiver_args();
+  ~RawReceiver_args();
+  DataModel* data;
+  zmq::socket_t* sock; ///< DEALER connected to the RawSender
+  uint64_t received; ///< batches received since the start
+  uint64_t granted; ///< batches granted to the sender since the start
+  unsigned int window; ///< batches granted ahead of those received
+  unsigned long max_pending_boards; ///< no credit is granted while this many board readouts wait for the Reformatter
+  bool follow_run; ///< take the run and sub run numbers from the sender
+  bool followed; ///< a run was taken from the sender
+  std::atomic<bool> run_changed; ///< the followed run changed since the last Execute
+  boost::posix_time::ptime last_credit;
+  unsigned long bytes; ///< received since the start
+  unsigned long errors; ///< undecodable batches since the start
+  boost::posix_time::ptime last_stats;
+
+};
+
+/**
+ * \class RawReceiver
+ *
+ * Receives the raw readouts streamed by a RawSender in another toolchain and queues them for the Reformatter as the Digitizer would. Credit is only granted while the Reformatter keeps up, so back pressure reaches the digitizer node, see StageLink.
+ *
+ * Configuration: address (ZMQ endpoint of the sender, default tcp://localhost:5660), credit_window (batches, default 16), max_pending_boards (default 1024), follow_run (default 1, set 0 when this toolchain runs its own RunControl). When following, the first batch and every run change start a run in this toolchain (run_start), and the readouts received before a run change are queued before the run number changes, so they are reformatted under their own run.
+ *
+ * $Author: B.Richards $
+ * $Date: 2019/05/28 10:44:00 $
+ */
+
+class RawReceiver: public Tool {
+
+
+ public:
+
+  RawReceiver(); ///< Simple constructor
+  bool Initialise(std::string configfile,DataModel &data); ///< Initialise Function for setting up Tool resorces. @param configfile The path and name of the dynamic configuration file to read in. @param data A reference to the transient data class used to pass information between Tools.
+  bool Execute(); ///< Executre function used to perform Tool perpose. 
+  bool Finalise(); ///< Finalise funciton used to clean up resorces.
+
+
+ private:
+
+  void LoadConfig();
+  static void Thread(Thread_args* arg); ///< Grants credit and queues the received readouts
+  static void SendCredit(RawReceiver_args* args); ///< Send the total granted, also a heartbeat
+  static void Queue(RawReceiver_args* args, std::list<std::unique_ptr<std::vector<Hit>>>& boards); ///< Hand the received readouts to the Reformatter
+  Utilities* m_util;  ///< Pointer to utilities class to help with threading
+  RawReceiver_args* args; ///< thread args (also holds pointer to the thread)
+
+  std::string m_configfile;
+
+};
+
+
+#endif
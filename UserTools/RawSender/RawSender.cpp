@@ -0,0 +1,248 @@
+#include "RawSender.h"
+
+RawSender_args::RawSender_args():Thread_args(){
+  data=0;
+  sock=0;
+  batch_boards=64;
+  max_queued_boards=4096;
+  boards_dropped=0;
+  hits_dropped=0;
+  boards_dropped_reported=0;
+  batches=0;
+  bytes=0;
+}
+
+RawSender_args::~RawSender_args(){
+  delete sock;
+  sock=0;
+}
+
+
+RawSender::RawSender():Tool(){}
+
+
+bool RawSender::Initialise(std::string configfile, DataModel &data){
+
+  InitialiseTool(data);
+  m_configfile=configfile;
+  InitialiseConfiguration(configfile);
+  //m_variables.Print();
+
+  m_util=new Utilities();
+  args=new RawSender_args();
+  args->data=m_data;
+  args->last_stats=boost::posix_time::microsec_clock::universal_time();
+
+  LoadConfig();
+
+  std::string address="tcp://*:5660";
+  m_variables.Get("address",address);
+  int linger=0;
+  args->sock=new zmq::socket_t(*(m_data->context), ZMQ_ROUTER);
+  args->sock->setsockopt(ZMQ_LINGER, &linger, sizeof(linger));
+  args->sock->bind(address.c_str());
+
+  m_util->CreateThread("RawSender", &Thread, args);
+  StageProfiler::NameThread(args->thread, "RawSender");
+
+  ExportConfiguration();
+
+  return true;
+}
+
+
+bool RawSender::Execute(){
+
+  if(m_data->change_config){
+    InitialiseConfiguration(m_configfile);
+    LoadConfig();
+    ExportConfiguration();
+  }
+
+  return true;
+}
+
+
+bool RawSender::Finalise(){
+
+  m_util->KillThread(args);
+
+  delete args;
+  args=0;
+
+  delete m_util;
+  m_util=0;
+
+  return true;
+}
+
+void RawSender::Thread(Thread_args* arg){
+
+  RawSender_args* args=reinterpret_cast<RawSender_args*>(arg);
+
+  // credits and heartbeats; the timeout paces the loop when there is nothing to do
+  zmq::pollitem_t items[]={{*args->sock, 0, ZMQ_POLLIN, 0}};
+  zmq::poll(&items[0], 1, 1);
+  if(items[0].revents & ZMQ_POLLIN) ReceiveCredits(args);
+
+  std::unique_ptr<std::list<std::unique_ptr<std::vector<Hit>>>> readout;
+  args->data->raw_readout_mutex.lock();
+  std::swap(args->data->raw_readout, readout);
+  unsigned long run=args->data->run_number;
+  unsigned long sub_run=args->data->sub_run_number;
+  args->data->raw_readout_mutex.unlock();
+
+  DropSilentPeers(args);
+
+  if(args->order.size()){
+    while(args->unrouted.size()){
+      RawSender_board board=std::move(args->unrouted.front());
+      args->unrouted.pop_front();
+      Route(args, std::move(board));
+    }
+  }
+  if(readout) for(auto& hits : *readout){
+    RawSender_board board;
+    board.hits=std::move(hits);
+    board.run=run;
+    board.sub_run=sub_run;
+    Route(args, std::move(board));
+  }
+
+  for(unsigned int i=0; i<args->order.size(); i++){
+    const std::string& identity=args->order[i];
+    RawSender_peer& peer=args->peers[identity];
+    while(peer.sent<peer.granted && peer.queue.size()){
+      // a batch carries a single run, so it ends at a run change
+      unsigned long batch_run=peer.queue.front().run;
+      unsigned long batch_sub_run=peer.queue.front().sub_run;
+      uint32_t boards=1;
+      while(boards<args->batch_boards && boards<peer.queue.size() && peer.queue[boards].run==batch_run && peer.queue[boards].sub_run==batch_sub_run) boards++;
+      std::string batch;
+      StageLink::EncodeHeader(batch, batch_run, batch_sub_run, boards);
+      for(uint32_t j=0; j<boards; j++){
+	StageLink::EncodeBoard(batch, *peer.queue.front().hits);
+	peer.queue.pop_front();
+      }
+
+      zmq::message_t address(identity.data(), identity.size());
+      zmq::message_t message(batch.data(), batch.size());
+      args->sock->send(address, ZMQ_SNDMORE);
+      args->sock->send(message);
+      peer.sent++;
+      args->batches++;
+      args->bytes+=batch.size();
+    }
+  }
+
+  boost::posix_time::ptime now=boost::posix_time::microsec_clock::universal_time();
+  if(now - args->last_stats < boost::posix_time::seconds(1)) return;
+  args->last_stats=now;
+
+  unsigned long waiting=args->unrouted.size();
+  for(auto& peer : args->peers) waiting+=peer.second.queue.size();
+  args->data->monitoring_store_mtx.lock();
+  args->data->monitoring_store.Set("link_receivers", args->order.size());
+  args->data->monitoring_store.Set("link_batches_sent", args->batches);
+  args->data->monitoring_store.Set("link_MB_sent", args->bytes/1048576.0);
+  args->data->monitoring_store.Set("link_boards_waiting", waiting);
+  args->data->monitoring_store.Set("link_boards_dropped", args->boards_dropped);
+  args->data->monitoring_store.Set("link_hits_dropped", args->hits_dropped);
+  args->data->monitoring_store_mtx.unlock();
+
+  if(args->boards_dropped!=args->boards_dropped_reported){
+    args->data->services->SendLog("Warning: RawSender: "+std::to_string(args->boards_dropped-args->boards_dropped_reported)+" board readouts dropped, receivers not keeping up", v_warning);
+    args->boards_dropped_reported=args->boards_dropped;
+  }
+
+}
+
+void RawSender::ReceiveCredits(RawSender_args* args){
+
+  while(true){
+    zmq::message_t identity;
+    if(!args->sock->recv(&identity, ZMQ_DONTWAIT)) return;
+    if(!identity.more()) continue;
+    zmq::message_t payload;
+    args->sock->recv(&payload);
+    bool foreign=payload.more() || payload.size()!=sizeof(StageLink::Credit);
+    for(bool more=payload.more(); more;){ // skip the rest
+      zmq::message_t rest;
+      args->sock->recv(&rest);
+      more=rest.more();
+    }
+    if(foreign) continue;
+
+    StageLink::Credit credit;
+    memcpy(&credit, payload.data(), sizeof(credit));
+    std::string id(static_cast<const char*>(identity.data()), identity.size());
+
+    std::map<std::string, RawSender_peer>::iterator it=args->peers.find(id);
+    if(it==args->peers.end()){
+      // a new receiver, or one that was sending credits before this sender started
+      it=args->peers.insert(std::make_pair(id, RawSender_peer())).first;
+      it->second.sent= credit.granted>credit.window ? credit.granted-credit.window : 0;
+      args->order.push_back(id);
+      args->data->services->SendLog("RawSender: receiver connected, "+std::to_string(args->order.size())+" receivers", v_message);
+    }
+    if(credit.granted>it->second.granted) it->second.granted=credit.granted;
+    it->second.last_credit=boost::posix_time::microsec_clock::universal_time();
+  }
+
+}
+
+void RawSender::Route(RawSender_args* args, RawSender_board board){
+
+  if(!board.hits || board.hits->empty()) return;
+  if(!args->order.size()){
+    Queue(args, args->unrouted, std::move(board));
+    return;
+  }
+  unsigned int id=Hit::get_digitizer_id(board.hits->front().channel);
+  Queue(args, args->peers[args->order[id % args->order.size()]].queue, std::move(board));
+
+}
+
+void RawSender::Queue(RawSender_args* args, std::deque<RawSender_board>& queue, RawSender_board board, bool front){
+
+  if(queue.size()<args->max_queued_boards){
+    if(front) queue.push_front(std::move(board));
+    else queue.push_back(std::move(board));
+    return;
+  }
+  args->boards_dropped++;
+  args->hits_dropped+=board.hits->size();
+
+}
+
+void RawSender::DropSilentPeers(RawSender_args* args){
+
+  boost::posix_time::ptime now=boost::posix_time::microsec_clock::universal_time();
+  for(unsigned int i=0; i<args->order.size();){
+    RawSender_peer& peer=args->peers[args->order[i]];
+    if(now - peer.last_credit <= args->peer_timeout){
+      i++;
+      continue;
+    }
+    // the readouts of a lost receiver go to the others, in order
+    while(peer.queue.size()){
+      Queue(args, args->unrouted, std::move(peer.queue.back()), true);
+      peer.queue.pop_back();
+    }
+    args->peers.erase(args->order[i]);
+    args->order.erase(args->order.begin()+i);
+    args->data->services->SendLog("Warning: RawSender: receiver lost, "+std::to_string(args->order.size())+" receivers left", v_warning);
+  }
+
+}
+
+void RawSender::LoadConfig(){
+
+  if(!m_variables.Get("verbose",m_verbose)) m_verbose=1;
+  if(!m_variables.Get("batch_boards",args->batch_boards) || args->batch_boards==0) args->batch_boards=64;
+  unsigned int peer_timeout_sec=10;
+  m_variables.Get("peer_timeout_sec",peer_timeout_sec);
+  args->peer_timeout=boost::posix_time::seconds(peer_timeout_sec);
+  if(!m_variables.Get("max_queued_boards",args->max_queued_boards) || args->max_queued_boards==0) args->max_queued_boards=4096;
+
+}
@@ -0,0 +1,116 @@
+#ifndef RawSender_H
+#define RawSender_H
+
+#include <string>
+#include <iostream>
+#include <deque>
+#include <map>
+
+#include "Tool.h"
+#include "DataModel.h"
+#include "StageLink.h"
+
+/**
+ * \struct RawSender_board
+ *
+ * A board readout waiting to be sent, stamped with the run it was taken from the Digitizer in.
+ */
+
+struct RawSender_board{
+
+  RawSender_board(): run(0), sub_run(0){}
+  std::unique_ptr<std::vector<Hit>> hits;
+  unsigned long run; ///< run number when the readout was routed
+  unsigned long sub_run; ///< sub run number when the readout was routed
+
+};
+
+/**
+ * \struct RawSender_peer
+ *
+ * A RawReceiver connected to the sender, with its credit and the board readouts routed to it.
+ */
+
+struct RawSender_peer{
+
+  RawSender_peer(): granted(0), sent(0){}
+  uint64_t granted; ///< batches granted by the receiver since it connected
+  uint64_t sent; ///< batches sent to the receiver
+  boost::posix_time::ptime last_credit; ///< time of the last credit, receivers repeat it every second
+  std::deque<RawSender_board> queue; ///< board readouts waiting for credit
+
+};
+
+/**
+ * \struct RawSender_args
+ *
+ * Data of the sending thread.
+ *
+ * $Author: B.Richards $
+ * $Date: 2019/05/28 10:44:00 $
+ */
+
+struct RawSender_args:Thread_args{
+
+  RawSender_args();
+  ~RawSender_args();
+  DataModel* data;
+  zmq::socket_t* sock; ///< ROUTER bound to the link address
+  std::map<std::string, RawSender_peer> peers; ///< by ZMQ identity
+  std::vector<std::string> order; ///< peers in order of connection, a board always goes to order[board % order.size()]
+  std::deque<RawSender_board> unrouted; ///< readouts waiting for a receiver to connect
+  unsigned int batch_boards; ///< maximum board readouts per batch
+  unsigned int max_queued_boards; ///< readouts beyond this many waiting for a receiver, or for any receiver to connect, are dropped
+  unsigned long boards_dropped; ///< since the start
+  unsigned long hits_dropped; ///< since the start
+  unsigned long boards_dropped_reported; ///< boards_dropped at the last warning
+  boost::posix_time::time_duration peer_timeout; ///< peers silent for longer are dropped and their readouts rerouted
+  unsigned long batches; ///< sent since the start
+  unsigned long bytes; ///< sent since the start
+  boost::posix_time::ptime last_stats;
+
+};
+
+/**
+ * \class RawSender
+ *
+ * Streams the raw readouts of the Digitizer to RawReceivers in other toolchains, so that reformatting and triggering can run on other nodes. The readout of a board goes to receiver board % receivers, in order of connection, in batches of up to batch_boards readouts while that receiver has credit, see StageLink. Readouts are stamped with the run current when they are taken from the Digitizer, and a batch never mixes runs, so readouts that wait for credit across a run change still arrive with their own run.
+ *
+ * Routing is by board, not by time: with more than one receiver every node reformats and triggers on the channels of its boards only, so trigger conditions that need the whole detector must run downstream of a single receiver. The assignment also changes whenever a receiver connects or is dropped, moving boards between nodes in the middle of a run.
+ *
+ * A receiver that stops granting credit holds at most max_queued_boards readouts, as do readouts waiting for the first receiver; further readouts are dropped and counted in link_boards_dropped and link_hits_dropped.
+ *
+ * Configuration: address (ZMQ endpoint to bind, default tcp://*:5660), batch_boards (default 64), peer_timeout_sec (default 10), max_queued_boards (default 4096).
+ *
+ * $Author: B.Richards $
+ * $Date: 2019/05/28 10:44:00 $
+ */
+
+class RawSender: public Tool {
+
+
+ public:
+
+  RawSender(); ///< Simple constructor
+  bool Initialise(std::string configfile,DataModel &data); ///< Initialise Function for setting up Tool resorces. @param configfile The path and name of the dynamic configuration file to read in. @param data A reference to the transient data class used to pass information between Tools.
+  bool Execute(); ///< Executre function used to perform Tool perpose. 
+  bool Finalise(); ///< Finalise funciton used to clean up resorces.
+
+
+ private:
+
+  void LoadConfig();
+  static void Thread(Thread_args* arg); ///< Receives credits, routes the new readouts and sends the batches there is credit for
+  static void ReceiveCredits(RawSender_args* args); ///< Handle the pending credit messages, registering new receivers
+  static void Route(RawSender_args* args, RawSender_board board); ///< Queue a board readout for its receiver
+  static void DropSilentPeers(RawSender_args* args); ///< Forget receivers without credit for peer_timeout and reroute their readouts
+  static void Queue(RawSender_args* args, std::deque<RawSender_board>& queue, RawSender_board board, bool front=false); ///< Append a readout to a queue, or drop it if the queue is full
+  Utilities* m_util;  ///< Pointer to utilities class to help with threading
+  RawSender_args* args; ///< thread args (also holds pointer to the thread)
+
+  std::string m_configfile;
+
+};
+
+
+#endif
@@ -1,24 +1,233 @@
 #include "DataModel.h"
 #include "TimeSlice.h"
+#include "TimeUtils.h"
 
 #include "Reformatter.h"
 
 Reformatter::Reformatter(): Tool() {}
 
-void Reformatter::send_timeslice(Time time, std::vector<Hit>& hits) {
-  if (hits.empty()) return;
+std::string Reformatter::Log2Histogram::json() const {
+  int size = bins.size();
+  while (size > 0 && !bins[size - 1].load(std::memory_order_relaxed)) --size;
+  std::stringstream ss;
+  ss << '[';
+  for (int i = 0; i < size; ++i) {
+    if (i) ss << ',';
+    ss << bins[i].load(std::memory_order_relaxed);
+  };
+  ss << ']';
+  return ss.str();
+};
+
+void Reformatter::count_hit(const Hit& hit) {
+  TimeBuckets::Count& b = buckets[hit.time.bits() / bucket.bits()];
+  ++b.hits;
+  b.bytes += TimeBuckets::bytes(hit);
+};
+
+Time Reformatter::slice_end(
+    Time start, const std::map<uint64_t, TimeBuckets::Count>& buckets
+) const {
+  if (!max_hits && !max_bytes) return start + interval;
+
+  uint64_t width = bucket.bits();
+  uint64_t first = start.bits() / width;
+  uint64_t n     = std::max<uint64_t>(interval.bits() / width, 1);
+  uint64_t hits  = 0;
+  uint64_t bytes = 0;
+  for (
+      auto b = buckets.lower_bound(first);
+      b != buckets.end() && b->first < first + n;
+      ++b
+  ) {
+    hits  += b->second.hits;
+    bytes += b->second.bytes;
+    if (b->first > first && (
+          (max_hits  && hits  > max_hits) ||
+          (max_bytes && bytes > max_bytes)
+       ))
+      return Time(start.bits() + (b->first - first) * width);
+  };
+  return Time(start.bits() + n * width);
+};
+
+bool Reformatter::channels_ready(Time end) {
+  died.clear();
+  bool ready = watermarks.passed(end, died);
+  for (uint8_t channel : died) {
+    // one alarm per channel and run, flapping low rate channels are only
+    // visible in the liveness published to monitoring
+    if (channel_alarms[channel] != Alarm::none) continue;
+    channel_alarms[channel] = Alarm::raised;
+    std::stringstream ss;
+    ss << "Reformatter: channel " << static_cast<int>(channel)
+       << " stopped reporting, last hit at "
+       << watermarks.time(channel).seconds() << " s, latest hit at "
+       << watermarks.latest().seconds() << " s";
+    m_data->services->SendAlarm(ss.str());
+  };
+  return ready;
+};
+
+void Reformatter::advance_channel(uint8_t channel, Time time) {
+  if (!watermarks.advance(channel, time)) return;
+  if (channel_alarms[channel] != Alarm::raised) return;
+  channel_alarms[channel] = Alarm::cleared;
+  std::stringstream ss;
+  ss << "Reformatter: channel " << static_cast<int>(channel)
+     << " is reporting again at " << time.seconds() << " s";
+  m_data->services->SendLog(ss.str(), v_warning);
+};
+
+void Reformatter::publish_watermarks() {
+  auto now = std::chrono::steady_clock::now();
+  if (now - watermarks_time < std::chrono::seconds(1)) return;
+  watermarks_time = now;
+
+  // lags of all channels in one pass, outside of the lock
+  size_t n = watermarks.size();
+  std::vector<uint64_t> lag(n);
+  std::vector<double> lag_s(n);
+  for (size_t i = 0; i < n; ++i) lag[i] = watermarks.time(i).bits();
+  time_bits_before(lag.data(), n, watermarks.latest(), lag.data());
+  time_bits_to_seconds(lag.data(), n, lag_s.data());
+
+  std::lock_guard<std::mutex> lock(m_data->monitoring_store_mtx);
+  for (size_t i = 0; i < n; ++i) {
+    std::string key = "channel_" + std::to_string(i);
+    m_data->monitoring_store.Set(key + "_alive", watermarks.active(i));
+    m_data->monitoring_store.Set(key + "_lag_s", lag_s[i]);
+  };
+};
+
+void Reformatter::publish_slice_stats() {
+  auto now = std::chrono::steady_clock::now();
+  if (now - slice_stats_time < slice_stats_period) return;
+
+  std::stringstream json;
+  json
+    << "{\"seconds\":"
+    << std::chrono::duration<double>(now - slice_stats_time).count()
+    << ",\"hits\":"        << slice_hits.json()
+    << ",\"bytes\":"       << slice_bytes.json()
+    << ",\"duration_us\":" << slice_duration.json()
+    << '}';
+  m_data->services->SendMonitoringData(json.str(), "slice_sizes");
+
+  slice_hits.reset();
+  slice_bytes.reset();
+  slice_duration.reset();
+  slice_stats_time = now;
+};
+
+// Accounts a slice of `bytes` in the memory budget. Returns false if the slice
+// has to be dropped.
+bool Reformatter::reserve(TimeSlice& timeslice, uint64_t hits, uint64_t bytes) {
+  slice_hits.fill(hits);
+  slice_bytes.fill(bytes);
+  slice_duration.fill((timeslice.end - timeslice.time).bits() / 512000);
+
+  SliceBudget& budget = m_data->slice_budget;
+  while (!budget.Reserve(timeslice, bytes, std::chrono::milliseconds(100))) {
+    if (budget.policy() == SliceBudget::Policy::drop) return false;
+    if (!reformatting) {
+      // stopping: flush the last slices whatever the budget
+      budget.Force(timeslice, bytes);
+      break;
+    };
+  };
+  return true;
+};
+
+void Reformatter::queue_timeslice(std::unique_ptr<TimeSlice> timeslice) {
+  m_data->profiler.Lock(m_data->readout_mutex, StageProfiler::reformatter);
+  std::lock_guard<std::mutex> lock(m_data->readout_mutex, std::adopt_lock);
+  m_data->readout.push(std::move(timeslice));
+};
+
+void Reformatter::push_timeslice(std::unique_ptr<TimeSlice> timeslice) {
+  if (reserve(
+        *timeslice, timeslice->hits.size(), SliceBudget::Size(*timeslice)
+      ))
+    queue_timeslice(std::move(timeslice));
+  else
+    m_data->slice_budget.Drop(*timeslice);
+};
+
+void Reformatter::send_timeslice(Time start, Time end, std::vector<Hit>& hits) {
+  if (hits.empty()) {
+    // Nothing to share with the neighbours: the pending slice is complete
+    // since overlap <= interval.
+    if (pending) push_timeslice(std::move(pending));
+    overlap_hits.clear();
+    return;
+  };
 
   std::unique_ptr<TimeSlice> timeslice(new TimeSlice);
-  timeslice->time = time;
+  timeslice->time    = start;
+  timeslice->end     = end;
+  timeslice->run     = m_data->run_number;
+  timeslice->sub_run = m_data->sub_run_number;
+
+  if (overlap == Time()) {
+    timeslice->hits.insert(
+        timeslice->hits.begin(),
+        std::make_move_iterator(hits.begin()),
+        std::make_move_iterator(hits.end())
+    );
+    hits.clear();
+    push_timeslice(std::move(timeslice));
+    return;
+  };
+
+  // Context from the previous slice
+  timeslice->hits.reserve(overlap_hits.size() + hits.size());
+  timeslice->hits.insert(
+      timeslice->hits.end(),
+      std::make_move_iterator(overlap_hits.begin()),
+      std::make_move_iterator(overlap_hits.end())
+  );
+  overlap_hits.clear();
+
+  // Context for the previous and the next slice
+  for (auto& hit : hits) {
+    if (pending && hit.time < pending->end + overlap)
+      pending->hits.push_back(hit);
+    if (hit.time + overlap >= end)
+      overlap_hits.push_back(hit);
+  };
+  if (pending) push_timeslice(std::move(pending));
+
   timeslice->hits.insert(
-      timeslice->hits.begin(),
+      timeslice->hits.end(),
       std::make_move_iterator(hits.begin()),
       std::make_move_iterator(hits.end())
   );
   hits.clear();
 
-  std::lock_guard<std::mutex> lock(m_data->readout_mutex);
-  m_data->readout.push(std::move(timeslice));
+  // Wait for the next slice to provide the context
+  pending = std::move(timeslice);
+};
+
+// Late hits go to their own stream, in a slice spanning from the earliest of
+// them to the start of the slice being cut
+void Reformatter::send_late(Time start) {
+  if (late.empty()) return;
+
+  std::unique_ptr<TimeSlice> timeslice(new TimeSlice);
+  timeslice->time    = late.front().time;
+  timeslice->end     = start;
+  timeslice->run     = m_data->run_number;
+  timeslice->sub_run = m_data->sub_run_number;
+  for (auto& hit : late) {
+    m_data->late_hits.Add(hit.channel);
+    if (hit.time < timeslice->time) timeslice->time = hit.time;
+  };
+  timeslice->hits.swap(late);
+  late.clear();
+
+  std::lock_guard<std::mutex> lock(m_data->late_readout_mutex);
+  m_data->late_readout.push(std::move(timeslice));
 };
 
 template <typename Container>
@@ -40,6 +249,70 @@ void Reformatter::configure() {
   };
   interval = Time(time);
 
+  time = interval.seconds() / 10;
+  m_variables.Get("min_interval", time);
+  if (time <= 0 || Time(time) > interval) {
+    *m_data->Log
+      << ML(0) << "Reformatter: invalid minimum interval: " << time
+      << ", using " << interval.seconds() << " s" << std::endl;
+    time = interval.seconds();
+  };
+  bucket = Time(time);
+
+  threads = 1;
+  m_variables.Get("threads", threads);
+  // parallel slices are cut on bucket boundaries only
+  if (threads > 1)
+    interval = Time(static_cast<uint64_t>(
+          interval.bits() / bucket.bits() * bucket.bits()
+    ));
+
+  max_hits = 0;
+  m_variables.Get("max_hits", max_hits);
+  double max_MB = 0;
+  m_variables.Get("max_MB", max_MB);
+  max_bytes = max_MB > 0 ? max_MB * 1048576 : 0;
+
+  buckets.clear();
+  for (auto& readout : readouts)
+    for (auto& board : *readout)
+      for (auto& hit : *board)
+        count_hit(hit);
+
+  int stats_period = 60;
+  m_variables.Get("slice_stats_period", stats_period);
+  slice_stats_period = std::chrono::seconds(stats_period > 0 ? stats_period : 60);
+  slice_stats_time = std::chrono::steady_clock::now();
+
+  overlap = Time();
+  if (m_variables.Get("overlap", time)) {
+    if (time < 0) {
+      *m_data->Log
+        << ML(0) << "Reformatter: invalid overlap: " << time
+        << ", using 0 s" << std::endl;
+      time = 0;
+    } else if (Time(time) > bucket) {
+      // the context must come from the neighbouring slices only
+      *m_data->Log
+        << ML(0) << "Reformatter: overlap " << time
+        << " s is longer than the minimum interval, using "
+        << bucket.seconds() << " s" << std::endl;
+      time = bucket.seconds();
+    };
+    overlap = Time(time);
+  };
+
+  late_grace = Time();
+  if (m_variables.Get("late_grace", time)) {
+    if (time < 0) {
+      *m_data->Log
+        << ML(0) << "Reformatter: invalid late grace: " << time
+        << ", using 0 s" << std::endl;
+      time = 0;
+    };
+    late_grace = Time(time);
+  };
+
   dead_time = 10 * interval;
   if (m_variables.Get("dead_time", time)) {
     if (time <= 0) {
@@ -50,16 +323,50 @@ void Reformatter::configure() {
     dead_time = Time(time) + interval;
   };
 
-  channels.resize(m_data->enabled_digitizer_channels.size() * 16);
+  double memory_budget = 4096;
+  m_variables.Get("memory_budget_MB", memory_budget);
+  if (memory_budget < 0) {
+    *m_data->Log
+      << ML(0) << "Reformatter: invalid memory budget: " << memory_budget
+      << " MB, using 4096 MB" << std::endl;
+    memory_budget = 4096;
+  };
+
+  SliceBudget::Policy policy = SliceBudget::Policy::block;
+  std::string string;
+  if (m_variables.Get("memory_policy", string))
+    if (string == "drop")
+      policy = SliceBudget::Policy::drop;
+    else if (string != "block")
+      *m_data->Log
+        << ML(0) << "Reformatter: invalid memory policy: " << string
+        << ", using block" << std::endl;
+
+  double shed_fraction = 0.75;
+  m_variables.Get("memory_shed_fraction", shed_fraction);
+  if (shed_fraction <= 0 || shed_fraction > 1) {
+    *m_data->Log
+      << ML(0) << "Reformatter: invalid memory shed fraction: "
+      << shed_fraction << ", using 0.75" << std::endl;
+    shed_fraction = 0.75;
+  };
+
+  unsigned zero_bias_prescale = 10;
+  m_variables.Get("zero_bias_prescale", zero_bias_prescale);
+
+  m_data->slice_budget.Configure(
+      memory_budget * 1048576, policy, shed_fraction, zero_bias_prescale
+  );
+
   {
-    int i = 0;
+    std::vector<bool> enabled;
     for (uint16_t mask : m_data->enabled_digitizer_channels)
       for (int j = 0; j < 16; ++j)
-        channels[i++].active = mask & 1 << j;
+        enabled.push_back(mask & 1 << j);
+    watermarks.configure(enabled, dead_time);
   };
 
-  m_data->channel_hits.clear();
-  m_data->channel_hits.resize(m_data->enabled_digitizer_channels.size() * 16);
+  m_data->channel_hits.Reset();
 };
 
 void Reformatter::reformat() {
@@ -74,107 +381,406 @@ void Reformatter::reformat() {
    */
 
   Time start;
-  Time time;
 
   while (reformatting) {
-    if (m_data->raw_readout) {
-      {
-        std::lock_guard<std::mutex> lock(m_data->raw_readout_mutex);
-        readouts.push_back(std::move(m_data->raw_readout));
-      };
+    publish_watermarks();
 
-      for (auto& board : *readouts.back())
-        for (auto& hit : *board) {
-          if (hit.channel >= channels.size()) {
-            std::stringstream ss;
-            ss << "Unexpected hit channel " << static_cast<int>(hit.channel);
-            throw std::runtime_error(ss.str());
-          };
-
-          Channel& channel = channels[hit.channel];
-          if (channel.active) {
-            if (hit.time > channel.time) channel.time = hit.time;
-          } else {
-            channel.active = true;
-            channel.time = hit.time;
-          };
-        };
-    } else {
-      usleep(interval.seconds() * 0.5e6);
+    if (!m_data->raw_readout) {
+      m_data->profiler.Sleep(
+          interval.seconds() * 0.5e6, StageProfiler::reformatter
+      );
       continue;
     };
 
-    for (auto& channel : channels)
-      if (channel.time > time)
-        time = channel.time;
+    StageProfiler::Scope scope(m_data->profiler, StageProfiler::reformatter);
 
+    std::unique_ptr<std::list<std::unique_ptr<std::vector<Hit>>>> readout;
+    {
+      m_data->profiler.Lock(
+          m_data->raw_readout_mutex, StageProfiler::reformatter
+      );
+      std::lock_guard<std::mutex> lock(
+          m_data->raw_readout_mutex, std::adopt_lock
+      );
+      readout = std::move(m_data->raw_readout);
+    };
+    add_readout(std::move(readout));
+
+    Time time = watermarks.latest();
     while (true) {
-      Time end = start + interval;
-      if (time < end) break;
-
-      bool done = false;
-      for (auto& channel : channels)
-        if (channel.active && channel.time < end)
-          if (channel.time + dead_time > time) {
-            // some channel may yet provide data fitting the current time
-            // window
-            done = true;
-            break;
-          } else {
-            channel.active = false;
-            done = done && channel.time >= start;
+      Time end = slice_end(start, buckets);
+      if (time < end + late_grace) break;
+      if (!channels_ready(end + late_grace)) break;
+
+      cut_serial(start, end);
+      start = end;
+    };
+  };
+
+  {
+    std::lock_guard<std::mutex> lock(m_data->raw_readout_mutex);
+    if (m_data->raw_readout) add_readout(std::move(m_data->raw_readout));
+  };
+
+  // flush everything buffered, skipping over the gaps; every hit in readouts
+  // is counted in buckets
+  uint64_t width = bucket.bits();
+  while (!buckets.empty()) {
+    uint64_t next = buckets.begin()->first;
+    if (next > start.bits() / width) start = Time(next * width);
+    Time end = slice_end(start, buckets);
+    cut_serial(start, end);
+    start = end;
+  };
+  readouts.clear();
+
+  if (pending) push_timeslice(std::move(pending));
+  overlap_hits.clear();
+};
+
+void Reformatter::add_readout(
+    std::unique_ptr<std::list<std::unique_ptr<std::vector<Hit>>>> readout
+) {
+  // the watermarks move once per channel and readout
+  std::vector<Time> latest(watermarks.size());
+  for (auto& board : *readout)
+    for (auto& hit : *board) {
+      if (hit.channel >= latest.size()) {
+        std::stringstream ss;
+        ss << "Unexpected hit channel " << static_cast<int>(hit.channel);
+        throw std::runtime_error(ss.str());
+      };
+
+      count_hit(hit);
+
+      if (hit.time > latest[hit.channel]) latest[hit.channel] = hit.time;
+    };
+  for (size_t i = 0; i < latest.size(); ++i)
+    if (latest[i] > Time()) advance_channel(i, latest[i]);
+
+  readouts.push_back(std::move(readout));
+};
+
+void Reformatter::cut_serial(Time start, Time end) {
+  // Move hits fitting the timeslice from readouts to buffer
+  remove_if(
+      readouts,
+      [this, start, end](
+        std::unique_ptr<
+          std::list<std::unique_ptr<std::vector<Hit>>>
+        >& readout
+      ) -> bool {
+        remove_if(
+            *readout,
+            [this, start, end](std::unique_ptr<std::vector<Hit>>& board) -> bool {
+              remove_if(
+                  *board,
+                  [this, start, end](Hit& hit) -> bool {
+                    if (hit.time >= end) return false;
+                    if (hit.time < start) {
+                      late.push_back(std::move(hit));
+                      return true;
+                    };
+
+                    m_data->channel_hits.Add(hit.channel);
+                    buffer.push_back(std::move(hit));
+                    return true;
+                  }
+              );
+              return board->empty();
+            }
+        );
+        return readout->empty();
+      }
+  );
+
+  send_timeslice(start, end, buffer);
+  send_late(start);
+  buckets.erase(buckets.begin(), buckets.lower_bound(end.bits() / bucket.bits()));
+};
+
+void Reformatter::distribute(
+    std::list<std::unique_ptr<std::vector<Hit>>>& boards
+) {
+  for (auto& board : boards) {
+    if (board->empty()) continue;
+    // a board is always handled by the same thread, so each watermark has a
+    // single writer
+    Ingest& in = *ingests[
+      Hit::get_digitizer_id(board->front().channel) % ingests.size()
+    ];
+    {
+      std::lock_guard<std::mutex> lock(in.mutex);
+      in.boards.push_back(std::move(board));
+    };
+    in.ready.notify_one();
+  };
+  boards.clear();
+};
+
+void Reformatter::ingest(unsigned partition) {
+  Ingest& in = *ingests[partition];
+  std::vector<uint64_t> latest(watermarks.size());
+
+  while (true) {
+    std::unique_ptr<std::vector<Hit>> board;
+    {
+      std::unique_lock<std::mutex> lock(in.mutex);
+      in.ready.wait(
+          lock,
+          [&in]() -> bool { return !in.boards.empty() || !in.running; }
+      );
+      if (in.boards.empty()) return;
+      board = std::move(in.boards.front());
+      in.boards.pop_front();
+    };
+
+    StageProfiler::Scope scope(m_data->profiler, StageProfiler::reformatter);
+
+    std::fill(latest.begin(), latest.end(), 0);
+    remove_if(
+        *board,
+        [this, &latest](Hit& hit) -> bool {
+          if (hit.channel >= latest.size()) {
+            std::stringstream ss;
+            ss << "Reformatter: unexpected hit channel "
+               << static_cast<int>(hit.channel);
+            m_data->services->SendLog(ss.str(), v_error);
+            return true;
           };
-      if (done) break;
-
-      // Move hits fitting the next timeslice from readouts to buffer
-      remove_if(
-          readouts,
-          [this, start, end](
-            std::unique_ptr<
-              std::list<std::unique_ptr<std::vector<Hit>>>
-            >& readout
-          ) -> bool {
-            remove_if(
-                *readout,
-                [this, start, end](std::unique_ptr<std::vector<Hit>>& board) -> bool {
-                  remove_if(
-                      *board,
-                      [this, start, end](Hit& hit) -> bool {
-                        if (hit.time >= end) return false;
-                        if (hit.time < start) {
-                          std::stringstream ss;
-                          ss
-                            << "Reformatter: delayed hit in channel "
-                            << static_cast<int>(hit.channel)
-                            << ": " << hit.time.bits() << " (" << hit.time.seconds() << " s) < "
-                            << start.bits() << " (" << start.seconds() << " s)";
-                          throw std::runtime_error(ss.str());
-                        };
-
-                        ++m_data->channel_hits[hit.channel];
-                        buffer.push_back(std::move(hit));
-                        return true;
-                      }
-                  );
-                  return board->empty();
-                }
-            );
-            return readout->empty();
-          }
+          uint64_t& time = latest[hit.channel];
+          if (hit.time.bits() > time) time = hit.time.bits();
+          return false;
+        }
+    );
+
+    hit_buckets.add(partition, *board);
+
+    // The watermarks move only once the hits are in the buckets, so the
+    // reformatting thread never cuts a slice with hits still on the way.
+    for (size_t i = 0; i < latest.size(); ++i)
+      if (latest[i] > binned[i].load(std::memory_order_relaxed))
+        binned[i].store(latest[i], std::memory_order_release);
+  };
+};
+
+void Reformatter::advance_watermarks() {
+  for (size_t i = 0; i < watermarks.size(); ++i) {
+    uint64_t time = binned[i].load(std::memory_order_acquire);
+    if (time > watermarks.time(i).bits()) advance_channel(i, Time(time));
+  };
+};
+
+void Reformatter::cut_timeslice(Time start, Time end) {
+  std::unique_ptr<Assembly> assembly(new Assembly);
+  assembly->data = m_data;
+
+  // the tail of this slice is the context of the next one
+  std::vector<Hit> tail;
+  if (overlap != Time()) hit_buckets.copy(end - overlap, end, tail);
+
+  TimeBuckets::Count count = hit_buckets.take(
+      start.bits() / bucket.bits(),
+      end.bits()   / bucket.bits(),
+      assembly->parts,
+      late
+  );
+  send_late(start);
+
+  if (overlap != Time()) {
+    // context from the previous slice and from the next slice, which is still
+    // in the buckets
+    assembly->context = std::move(overlap_hits);
+    if (!assembly->parts.empty())
+      hit_buckets.copy(end, end + overlap, assembly->context);
+    overlap_hits = std::move(tail);
+  };
+
+  if (assembly->parts.empty()) return;
+
+  count.hits  += assembly->context.size();
+  count.bytes += sizeof(TimeSlice);
+  for (auto& hit : assembly->context) count.bytes += TimeBuckets::bytes(hit);
+
+  TimeSlice* timeslice = new TimeSlice;
+  assembly->slice.reset(timeslice);
+  timeslice->time    = start;
+  timeslice->end     = end;
+  timeslice->run     = m_data->run_number;
+  timeslice->sub_run = m_data->sub_run_number;
+
+  if (!reserve(*timeslice, count.hits, count.bytes)) {
+    gather(*assembly);
+    m_data->slice_budget.Drop(*timeslice);
+    return;
+  };
+
+  Job* job = new Job("reformatting");
+  job->data      = assembly.release();
+  job->func      = assemble;
+  job->fail_func = assemble_failed;
+  if (!m_data->job_queue.AddJob(job)) {
+    assemble_failed(job->data);
+    delete job;
+  };
+};
+
+void Reformatter::gather(Assembly& assembly) {
+  std::vector<Hit>& hits = assembly.slice->hits;
+  size_t size = assembly.context.size();
+  for (auto& part : assembly.parts) size += part.size();
+  hits.reserve(size);
+
+  for (auto& part : assembly.parts) {
+    for (auto& hit : part) assembly.data->channel_hits.Add(hit.channel);
+    hits.insert(
+        hits.end(),
+        std::make_move_iterator(part.begin()),
+        std::make_move_iterator(part.end())
+    );
+    std::vector<Hit>().swap(part);
+  };
+  hits.insert(
+      hits.end(),
+      std::make_move_iterator(assembly.context.begin()),
+      std::make_move_iterator(assembly.context.end())
+  );
+  assembly.parts.clear();
+  assembly.context.clear();
+};
+
+bool Reformatter::assemble(void* data) {
+  Assembly* assembly = static_cast<Assembly*>(data);
+  StageProfiler::NameThread("job:reformat");
+  {
+    StageProfiler::Scope scope(
+        assembly->data->profiler, StageProfiler::reformatter
+    );
+    gather(*assembly);
+
+    DataModel* m_data = assembly->data;
+    m_data->profiler.Lock(m_data->readout_mutex, StageProfiler::reformatter);
+    std::lock_guard<std::mutex> lock(m_data->readout_mutex, std::adopt_lock);
+    m_data->readout.push(std::move(assembly->slice));
+  };
+  delete assembly;
+  return true;
+};
+
+void Reformatter::assemble_failed(void* data) {
+  Assembly* assembly = static_cast<Assembly*>(data);
+  gather(*assembly);
+  assembly->data->slice_budget.Drop(*assembly->slice);
+  delete assembly;
+};
+
+void Reformatter::reformat_parallel() {
+  /* Same scheme as `reformat`, but the hits are binned by the ingestion
+   * threads, and the slices cut on bucket boundaries. A slice is cut once all
+   * active channels passed its end plus the overlap, so that its context is
+   * complete as well.
+   */
+
+  Time start;
+  std::map<uint64_t, TimeBuckets::Count> counts;
+  uint64_t width = bucket.bits();
+  uint64_t n     = std::max<uint64_t>(interval.bits() / width, 1);
+
+  for (size_t i = 0; i < watermarks.size(); ++i)
+    binned[i].store(watermarks.time(i).bits(), std::memory_order_relaxed);
+
+  for (unsigned i = 0; i < threads; ++i) {
+    ingests.emplace_back(new Ingest);
+    ingests[i]->thread = std::thread(&Reformatter::ingest, this, i);
+    StageProfiler::NameThread(
+        ingests[i]->thread.native_handle(), "Ingest" + std::to_string(i)
+    );
+  };
+
+  // readouts left over from the serial mode
+  for (auto& readout : readouts) distribute(*readout);
+  readouts.clear();
+  buckets.clear();
+
+  while (reformatting) {
+    std::unique_ptr<std::list<std::unique_ptr<std::vector<Hit>>>> readout;
+    {
+      m_data->profiler.Lock(
+          m_data->raw_readout_mutex, StageProfiler::reformatter
       );
+      std::lock_guard<std::mutex> lock(
+          m_data->raw_readout_mutex, std::adopt_lock
+      );
+      readout = std::move(m_data->raw_readout);
+    };
 
-      send_timeslice(start, buffer);
+    if (!readout) {
+      m_data->profiler.Sleep(
+          bucket.seconds() * 0.5e6, StageProfiler::reformatter
+      );
+    } else {
+      StageProfiler::Scope scope(m_data->profiler, StageProfiler::reformatter);
+      distribute(*readout);
+    };
 
+    StageProfiler::Scope scope(m_data->profiler, StageProfiler::reformatter);
+    advance_watermarks();
+    publish_watermarks();
+    Time time = watermarks.latest();
+    while (true) {
+      uint64_t first = start.bits() / width;
+      hit_buckets.count(first, first + n, counts);
+      Time end = slice_end(start, counts);
+      Time close = end + overlap + late_grace;
+      if (time < close) break;
+      if (!channels_ready(close)) break;
+
+      cut_timeslice(start, end);
       start = end;
     };
   };
 
-  send_timeslice(start, buffer);
+  {
+    std::lock_guard<std::mutex> lock(m_data->raw_readout_mutex);
+    if (m_data->raw_readout) distribute(*m_data->raw_readout);
+    m_data->raw_readout.reset();
+  };
+
+  for (auto& in : ingests) {
+    {
+      std::lock_guard<std::mutex> lock(in->mutex);
+      in->running = false;
+    };
+    in->ready.notify_one();
+    in->thread.join();
+  };
+  ingests.clear();
+  advance_watermarks();
+
+  // flush everything binned, skipping over the gaps
+  uint64_t next;
+  while (hit_buckets.first(next)) {
+    if (next > start.bits() / width) start = Time(next * width);
+    uint64_t first = start.bits() / width;
+    hit_buckets.count(first, first + n, counts);
+    Time end = slice_end(start, counts);
+    cut_timeslice(start, end);
+    start = end;
+  };
+  overlap_hits.clear();
 };
 
 void Reformatter::start_reformatting() {
   reformatting = true;
-  thread = std::thread(&Reformatter::reformat, this);
+  channel_alarms.assign(watermarks.size(), Alarm::none);
+  if (threads > 1) {
+    binned.reset(new std::atomic<uint64_t>[watermarks.size()]);
+    hit_buckets.configure(threads, bucket.bits());
+    thread = std::thread(&Reformatter::reformat_parallel, this);
+  } else {
+    thread = std::thread(&Reformatter::reformat, this);
+  };
+  StageProfiler::NameThread(thread.native_handle(), "Reformatter");
 };
 
 void Reformatter::stop_reformatting() {
@@ -210,6 +816,8 @@ bool Reformatter::Execute() {
 
   if (m_data->run_start && !reformatting) start_reformatting();
 
+  publish_slice_stats();
+
   return true;
 }
 
@@ -1,11 +1,20 @@
 #ifndef Reformatter_H
 #define Reformatter_H
 
-#include <string>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
 #include <iostream>
+#include <map>
+#include <string>
 
 #include "Tool.h"
 
+#include "TimeBuckets.h"
+#include "WatermarkTracker.h"
+
 class Reformatter: public ToolFramework::Tool {
   public:
     Reformatter();
@@ -16,12 +25,18 @@ class Reformatter: public ToolFramework::Tool {
     bool Finalise();
 
   private:
-    struct Channel {
-      Time time; // time of the last hit in the channel
-      bool active; // whether we expect hits in the channel
-    };
+    // times of the last hit and liveness of the channels
+    WatermarkTracker watermarks;
 
-    std::vector<Channel> channels;
+    // channels found dead in channels_ready
+    std::vector<uint8_t> died;
+
+    // dead channel alarms raised this run, and whether the channel came back
+    enum class Alarm : uint8_t { none, raised, cleared };
+    std::vector<Alarm> channel_alarms;
+
+    // liveness and lag are published every second
+    std::chrono::steady_clock::time_point watermarks_time;
 
     std::vector<Hit> buffer;
 
@@ -35,12 +50,101 @@ class Reformatter: public ToolFramework::Tool {
       >
     > readouts;
 
-    // target timeslice length
+    // maximum timeslice length
     Time interval;
 
+    // Adaptive slicing. A timeslice spans a whole number of buckets of
+    // `bucket` length (min_interval) and ends before the bucket that would
+    // take it over max_hits or max_bytes, but it is never shorter than one
+    // bucket nor longer than `interval`. Zero limits give fixed `interval`
+    // slices.
+    Time     bucket;
+    uint64_t max_hits;
+    uint64_t max_bytes;
+
+    // hits in `readouts` by bucket index (time / bucket)
+    std::map<uint64_t, TimeBuckets::Count> buckets;
+
+    // Parallel reformatting (threads > 1). The reformatting thread hands the
+    // board readouts to `threads` ingestion threads, by board id. Those bin
+    // the hits into `hit_buckets` and then advance the watermarks of their
+    // channels. The reformatting thread only compares the watermarks and
+    // moves whole buckets out, slices are assembled on the worker pool.
+    unsigned threads;
+    TimeBuckets hit_buckets;
+
+    // time of the latest hit binned per channel, in bits
+    std::unique_ptr<std::atomic<uint64_t>[]> binned;
+
+    struct Ingest {
+      std::mutex mutex;
+      std::condition_variable ready;
+      std::deque<std::unique_ptr<std::vector<Hit>>> boards;
+      bool running = true;
+      std::thread thread;
+    };
+
+    std::vector<std::unique_ptr<Ingest>> ingests;
+
+    // a slice being assembled on the worker pool
+    struct Assembly {
+      DataModel* data;
+      std::unique_ptr<TimeSlice> slice;
+      std::vector<std::vector<Hit>> parts;
+      std::vector<Hit> context;
+    };
+
+    // Power of two histogram: bin i counts values in [2^(i-1), 2^i), bin 0
+    // counts zeros. Filled by the reformatting thread, read by Execute.
+    struct Log2Histogram {
+      std::array<std::atomic<uint64_t>, 64> bins;
+
+      Log2Histogram() { reset(); };
+
+      void fill(uint64_t value) {
+        int bin = 0;
+        while (value) {
+          value >>= 1;
+          ++bin;
+        };
+        bins[bin].fetch_add(1, std::memory_order_relaxed);
+      };
+
+      void reset() {
+        for (auto& bin : bins) bin.store(0, std::memory_order_relaxed);
+      };
+
+      // JSON array up to the last non-empty bin
+      std::string json() const;
+    };
+
+    // sizes of the formed timeslices, published every slice_stats_period
+    Log2Histogram slice_hits;
+    Log2Histogram slice_bytes;
+    Log2Histogram slice_duration; // in us
+    std::chrono::seconds slice_stats_period;
+    std::chrono::steady_clock::time_point slice_stats_time;
+
     // max time to wait for data from a channel
     Time dead_time;
 
+    // length of the context copied from the neighbouring timeslices
+    Time overlap;
+
+    // Extra data time a slice is held open after all channels passed its end,
+    // for hits delayed on the way. Hits arriving later still go to
+    // m_data->late_readout.
+    Time late_grace;
+
+    // late hits found while cutting the current slice
+    std::vector<Hit> late;
+
+    // last timeslice waiting for the context from the next timeslice
+    std::unique_ptr<TimeSlice> pending;
+
+    // context of the last timeslice for the next timeslice
+    std::vector<Hit> overlap_hits;
+
     bool reformatting = false;
     std::thread thread;
 
@@ -49,8 +153,34 @@ class Reformatter: public ToolFramework::Tool {
     void start_reformatting();
     void stop_reformatting();
 
-    void send_timeslice(Time time, std::vector<Hit>& hits);
+    void count_hit(const Hit&);
+    Time slice_end(
+        Time start, const std::map<uint64_t, TimeBuckets::Count>& buckets
+    ) const;
+    bool channels_ready(Time end);
+    void advance_channel(uint8_t channel, Time time);
+    void publish_watermarks();
+    void publish_slice_stats();
+
+    bool reserve(TimeSlice&, uint64_t hits, uint64_t bytes);
+    void queue_timeslice(std::unique_ptr<TimeSlice>);
+    void push_timeslice(std::unique_ptr<TimeSlice>);
+    void send_timeslice(Time start, Time end, std::vector<Hit>& hits);
+    void send_late(Time start);
+    void add_readout(
+        std::unique_ptr<std::list<std::unique_ptr<std::vector<Hit>>>>
+    );
+    void cut_serial(Time start, Time end);
     void reformat();
+
+    void distribute(std::list<std::unique_ptr<std::vector<Hit>>>& boards);
+    void ingest(unsigned partition);
+    void advance_watermarks();
+    void cut_timeslice(Time start, Time end);
+    static void gather(Assembly&);
+    static bool assemble(void*);
+    static void assemble_failed(void*);
+    void reformat_parallel();
 };
 
 #endif
@@ -0,0 +1,137 @@
+#include "DataModel.h"
+#include "TimeBuckets.h"
+
+void TimeBuckets::configure(unsigned partitions, uint64_t width) {
+  width_ = width ? width : 1;
+  parts.clear();
+  for (unsigned i = 0; i < partitions; ++i)
+    parts.emplace_back(new Partition);
+};
+
+void TimeBuckets::add(unsigned partition, std::vector<Hit>& hits) {
+  if (hits.empty()) return;
+  Partition& part = *parts[partition % parts.size()];
+
+  uint64_t low   = hits.front().time.bits() / width_;
+  uint64_t high  = low;
+  uint64_t total = 0;
+  for (auto& hit : hits) {
+    uint64_t i = hit.time.bits() / width_;
+    if (i < low)  low  = i;
+    if (i > high) high = i;
+    total += bytes(hit);
+  };
+
+  if (low == high) {
+    std::lock_guard<std::mutex> lock(part.mutex);
+    Bucket& bucket = part.buckets[low];
+    bucket.hits  += hits.size();
+    bucket.bytes += total;
+    bucket.chunks.push_back(std::move(hits));
+    hits.clear();
+    return;
+  };
+
+  // Split outside of the lock. Hits of a board come channel by channel in
+  // time order, so consecutive hits usually fall into the same bucket.
+  std::map<uint64_t, Bucket> split;
+  Bucket* bucket = nullptr;
+  uint64_t index = 0;
+  for (auto& hit : hits) {
+    uint64_t i = hit.time.bits() / width_;
+    if (!bucket || i != index) {
+      bucket = &split[i];
+      index  = i;
+      if (bucket->chunks.empty()) bucket->chunks.emplace_back();
+    };
+    ++bucket->hits;
+    bucket->bytes += bytes(hit);
+    bucket->chunks.back().push_back(std::move(hit));
+  };
+  hits.clear();
+
+  std::lock_guard<std::mutex> lock(part.mutex);
+  for (auto& s : split) {
+    Bucket& bucket = part.buckets[s.first];
+    bucket.hits  += s.second.hits;
+    bucket.bytes += s.second.bytes;
+    bucket.chunks.push_back(std::move(s.second.chunks.back()));
+  };
+};
+
+void TimeBuckets::count(
+    uint64_t first, uint64_t last, std::map<uint64_t, Count>& counts
+) {
+  counts.clear();
+  for (auto& part : parts) {
+    std::lock_guard<std::mutex> lock(part->mutex);
+    for (
+        auto b = part->buckets.lower_bound(first);
+        b != part->buckets.end() && b->first < last;
+        ++b
+    ) {
+      Count& count = counts[b->first];
+      count.hits  += b->second.hits;
+      count.bytes += b->second.bytes;
+    };
+  };
+};
+
+TimeBuckets::Count TimeBuckets::take(
+    uint64_t first,
+    uint64_t last,
+    std::vector<std::vector<Hit>>& hits,
+    std::vector<Hit>& late
+) {
+  Count count;
+  for (auto& part : parts) {
+    std::lock_guard<std::mutex> lock(part->mutex);
+    auto begin = part->buckets.begin();
+    auto end   = part->buckets.lower_bound(last);
+    for (auto b = begin; b != end; ++b)
+      if (b->first < first) {
+        for (auto& chunk : b->second.chunks)
+          late.insert(
+              late.end(),
+              std::make_move_iterator(chunk.begin()),
+              std::make_move_iterator(chunk.end())
+          );
+      } else {
+        count.hits  += b->second.hits;
+        count.bytes += b->second.bytes;
+        for (auto& chunk : b->second.chunks)
+          hits.push_back(std::move(chunk));
+      };
+    part->buckets.erase(begin, end);
+  };
+  return count;
+};
+
+void TimeBuckets::copy(Time begin, Time end, std::vector<Hit>& hits) {
+  uint64_t first = begin.bits() / width_;
+  uint64_t last  = (end.bits() + width_ - 1) / width_;
+  for (auto& part : parts) {
+    std::lock_guard<std::mutex> lock(part->mutex);
+    for (
+        auto b = part->buckets.lower_bound(first);
+        b != part->buckets.end() && b->first < last;
+        ++b
+    )
+      for (auto& chunk : b->second.chunks)
+        for (auto& hit : chunk)
+          if (hit.time >= begin && hit.time < end)
+            hits.push_back(hit);
+  };
+};
+
+bool TimeBuckets::first(uint64_t& bucket) {
+  bool found = false;
+  for (auto& part : parts) {
+    std::lock_guard<std::mutex> lock(part->mutex);
+    if (part->buckets.empty()) continue;
+    uint64_t i = part->buckets.begin()->first;
+    if (!found || i < bucket) bucket = i;
+    found = true;
+  };
+  return found;
+};
@@ -0,0 +1,78 @@
+#ifndef TimeBuckets_H
+#define TimeBuckets_H
+
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "Hit.h"
+
+// Hits binned by time for the parallel Reformatter.
+//
+// Bucket i holds the hits with i * width <= time < (i + 1) * width. The
+// buckets are split into partitions, one per ingestion thread, so that the
+// threads only contend with the slicing thread taking the hits out, never
+// with each other. Timeslices that start and end on bucket boundaries are cut
+// by moving whole bucket vectors, without looking at the hits.
+class TimeBuckets {
+  public:
+    struct Count {
+      uint64_t hits  = 0;
+      uint64_t bytes = 0;
+    };
+
+    TimeBuckets(): width_(1) {};
+
+    // Drops all hits
+    void configure(unsigned partitions, uint64_t width);
+
+    unsigned partitions() const { return parts.size(); };
+    uint64_t width()      const { return width_; };
+
+    static uint64_t bytes(const Hit& hit) {
+      return sizeof(Hit) + hit.waveform.size() * sizeof(uint16_t);
+    };
+
+    // Move the hits into the buckets of a partition
+    void add(unsigned partition, std::vector<Hit>& hits);
+
+    // Hits and bytes per bucket in [first, last) summed over the partitions
+    void count(uint64_t first, uint64_t last, std::map<uint64_t, Count>&);
+
+    // Move the hits of the buckets [first, last) to `hits` and return their
+    // count. Hits left in the buckets before `first` arrived after their
+    // slice was cut and are moved to `late`.
+    Count take(
+        uint64_t first,
+        uint64_t last,
+        std::vector<std::vector<Hit>>& hits,
+        std::vector<Hit>& late
+    );
+
+    // Copy the hits with begin <= time < end
+    void copy(Time begin, Time end, std::vector<Hit>& hits);
+
+    // Index of the first non-empty bucket, false if all are empty
+    bool first(uint64_t& bucket);
+
+  private:
+    // A board readout within a single bucket is stored as is, so the hits
+    // are only moved once more, when the timeslice is assembled.
+    struct Bucket {
+      std::vector<std::vector<Hit>> chunks;
+      uint64_t hits  = 0;
+      uint64_t bytes = 0;
+    };
+
+    struct Partition {
+      std::mutex mutex;
+      std::map<uint64_t, Bucket> buckets;
+    };
+
+    uint64_t width_;
+    std::vector<std::unique_ptr<Partition>> parts;
+};
+
+#endif
@@ -0,0 +1,84 @@
+#include "DataModel.h"
+#include "WatermarkTracker.h"
+
+void WatermarkTracker::configure(const std::vector<bool>& enabled, Time dead_time) {
+  this->dead_time = dead_time;
+  channels.resize(enabled.size());
+  heap.clear();
+  for (auto& channel : channels) channel.position = npos;
+  for (size_t i = 0; i < enabled.size(); ++i)
+    if (enabled[i]) push(i);
+};
+
+void WatermarkTracker::swap(size_t a, size_t b) {
+  std::swap(heap[a], heap[b]);
+  channels[heap[a]].position = a;
+  channels[heap[b]].position = b;
+};
+
+void WatermarkTracker::sift_up(size_t i) {
+  while (i > 0) {
+    size_t parent = (i - 1) / 2;
+    if (!less(i, parent)) break;
+    swap(i, parent);
+    i = parent;
+  };
+};
+
+void WatermarkTracker::sift_down(size_t i) {
+  while (true) {
+    size_t min   = i;
+    size_t left  = 2 * i + 1;
+    size_t right = left + 1;
+    if (left  < heap.size() && less(left,  min)) min = left;
+    if (right < heap.size() && less(right, min)) min = right;
+    if (min == i) break;
+    swap(i, min);
+    i = min;
+  };
+};
+
+void WatermarkTracker::push(uint8_t channel) {
+  channels[channel].position = heap.size();
+  heap.push_back(channel);
+  sift_up(heap.size() - 1);
+};
+
+void WatermarkTracker::pop() {
+  channels[heap.front()].position = npos;
+  heap.front() = heap.back();
+  heap.pop_back();
+  if (!heap.empty()) {
+    channels[heap.front()].position = 0;
+    sift_down(0);
+  };
+};
+
+bool WatermarkTracker::advance(uint8_t channel, Time time) {
+  Channel& c = channels[channel];
+  if (time > latest_) latest_ = time;
+
+  if (c.position == npos) {
+    c.time = time;
+    push(channel);
+    return true;
+  };
+
+  if (time > c.time) {
+    c.time = time;
+    sift_down(c.position);
+  };
+  return false;
+};
+
+bool WatermarkTracker::passed(Time end, std::vector<uint8_t>& died) {
+  while (!heap.empty()) {
+    const Channel& c = channels[heap.front()];
+    if (!(c.time < end)) return true;
+    // some channel may yet provide data fitting the current time window
+    if (c.time + dead_time > latest_) return false;
+    died.push_back(heap.front());
+    pop();
+  };
+  return true;
+};
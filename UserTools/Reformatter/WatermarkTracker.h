@@ -0,0 +1,66 @@
+#ifndef WatermarkTracker_H
+#define WatermarkTracker_H
+
+#include <cstdint>
+#include <vector>
+
+#include "Hit.h"
+
+// Per channel watermarks (time of the latest hit) and liveness for the
+// Reformatter.
+//
+// The active channels are kept in a min-heap by watermark, so the channel
+// holding back the next timeslice is always on top: advancing a channel costs
+// O(log channels), and checking whether a slice can be cut only looks at the
+// channels that are behind its end.
+//
+// A channel is dead when it is behind the slice end and lags the latest hit in
+// any channel by more than the dead time. Dead channels are taken out of the
+// heap and no longer hold back the slicing; their next hit brings them back.
+class WatermarkTracker {
+  public:
+    WatermarkTracker(): latest_(), dead_time() {};
+
+    // Resizes to `channels`, keeping the watermarks of the existing ones.
+    // `enabled` channels start active, the rest dead.
+    void configure(const std::vector<bool>& enabled, Time dead_time);
+
+    size_t size() const { return channels.size(); };
+
+    // Hits in the channel up to `time`. Returns true if the channel was dead.
+    bool advance(uint8_t channel, Time time);
+
+    // Whether all active channels passed `end`. Channels found dead on the way
+    // are deactivated and appended to `died`.
+    bool passed(Time end, std::vector<uint8_t>& died);
+
+    Time time(uint8_t channel)   const { return channels[channel].time; };
+    bool active(uint8_t channel) const { return channels[channel].position != npos; };
+
+    // latest hit in any channel
+    Time latest() const { return latest_; };
+
+  private:
+    static const size_t npos = static_cast<size_t>(-1);
+
+    struct Channel {
+      Time   time;
+      size_t position = npos; // in the heap, npos if dead
+    };
+
+    std::vector<Channel> channels;
+    std::vector<uint8_t> heap;
+    Time latest_;
+    Time dead_time;
+
+    bool less(size_t a, size_t b) const {
+      return channels[heap[a]].time < channels[heap[b]].time;
+    };
+    void swap(size_t a, size_t b);
+    void sift_up(size_t);
+    void sift_down(size_t);
+    void push(uint8_t channel);
+    void pop();
+};
+
+#endif
@@ -23,6 +23,7 @@ bool RunControl::Initialise(std::string configfile, DataModel &data){
   m_run_start=false;
   m_run_stop=false;
   m_stopping=false;
+  m_draining=false;
   m_start_time=&m_data->start_time;
   //printf("d3\n");
 
@@ -75,22 +76,17 @@ bool RunControl::Execute(){
   }
   if(m_data->sub_run) m_data->sub_run=false;
 
-  if(m_stopping){
+  if(m_stopping && Drain()){
 
     m_data->readout_num=0;
     
-    m_data->readout_mutex.lock();
-    while(m_data->readout.size()) m_data->readout.pop();
-    m_data->readout_mutex.unlock();
-
-    m_data->sorted_readout_mutex.lock();
-    while(m_data->sorted_readout.size()) m_data->sorted_readout.pop();
-    m_data->sorted_readout_mutex.unlock();
+    // whatever did not make it through the drain is counted as lost
+    Discard(m_data->readout, m_data->readout_mutex);
+    Discard(m_data->sorted_readout, m_data->sorted_readout_mutex);
+    Discard(m_data->triggered_readout, m_data->triggered_readout_mutex);
+    ReportDrain();
 
-    m_data->triggered_readout_mutex.lock();
-    while(m_data->triggered_readout.size()) m_data->triggered_readout.pop();
-    m_data->triggered_readout_mutex.unlock();
-    
+    // windows are copies of data accounted for above
     m_data->final_readout_mutex.lock();
     while(m_data->final_readout.size()) m_data->final_readout.pop();
     m_data->final_readout_mutex.unlock();
@@ -361,6 +357,9 @@ void RunControl::LoadConfig(){
   unsigned int sub_run_period=0;
   if(!m_variables.Get("sub_run_period_hours",sub_run_period)) sub_run_period=30;
   if(!m_variables.Get("run_start_delay_mins",m_start_delay)) m_start_delay=1;
+  unsigned int drain_timeout=30;
+  m_variables.Get("drain_timeout_sec",drain_timeout);
+  m_drain_timeout=boost::posix_time::seconds(drain_timeout);
   // std::cout<<"printing runcontrol variables"<<std::endl;
   //m_variables.Print();
   m_period_new_sub_run=boost::posix_time::hours(sub_run_period);
@@ -375,3 +374,58 @@ void RunControl::LoadConfig(){
   */
   
 }
+
+bool RunControl::Drain(){
+
+  boost::posix_time::ptime now=boost::posix_time::microsec_clock::universal_time();
+
+  if(!m_draining){
+    m_draining=true;
+    m_drain_start=now;
+    m_drain_dropped=m_data->slice_budget.dropped_hits.Take();
+    m_drain_dropped_slices=m_data->slice_budget.DroppedSlices();
+    m_data->drained=false;
+    if(m_drain_timeout.total_seconds()==0) return true; // drain disabled, discard the queues as they are
+    m_data->draining=true;
+    m_data->vars.Set("Status", "Run Draining");
+  }
+
+  if(!m_data->drained && now - m_drain_start < m_drain_timeout) return false;
+
+  m_data->draining=false;
+  return true;
+
+}
+
+void RunControl::Discard(std::queue<std::unique_ptr<TimeSlice>>& queue, std::mutex& mutex){
+
+  std::lock_guard<std::mutex> lock(mutex);
+  while(queue.size()){
+    m_data->slice_budget.Drop(*queue.front());
+    queue.pop();
+  }
+
+}
+
+void RunControl::ReportDrain(){
+
+  double seconds=(boost::posix_time::microsec_clock::universal_time() - m_drain_start).total_microseconds()/1e6;
+  ChannelCounters::Snapshot dropped=m_data->slice_budget.dropped_hits.Take();
+  unsigned long lost_hits=0;
+  for(unsigned int i=0; i<ChannelCounters::channels; i++) lost_hits+=dropped.counts[i]-m_drain_dropped.counts[i];
+  unsigned long lost_slices=m_data->slice_budget.DroppedSlices()-m_drain_dropped_slices;
+  bool drained=m_data->drained;
+  m_draining=false;
+
+  m_data->monitoring_store_mtx.lock();
+  m_data->monitoring_store.Set("drain_seconds",seconds);
+  m_data->monitoring_store.Set("drain_lost_slices",lost_slices);
+  m_data->monitoring_store.Set("drain_lost_hits",lost_hits);
+  m_data->monitoring_store_mtx.unlock();
+
+  std::stringstream msg;
+  msg<<"Run "<<m_data->run_number<<(drained ? " drained in " : " drain timed out after ")<<seconds<<" s";
+  if(lost_slices) msg<<", "<<lost_slices<<" slices ("<<lost_hits<<" hits) lost";
+  Log(msg.str(), drained && !lost_slices ? v_message : v_warning);
+
+}
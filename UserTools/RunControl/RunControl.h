@@ -59,6 +59,9 @@ class RunControl: public Tool {
   std::string SubRun(const char* key);
 
   void LoadConfig();
+  bool Drain(); ///< Start or continue the run stop drain, true once the pipeline is flushed or drain_timeout_sec has passed
+  void Discard(std::queue<std::unique_ptr<TimeSlice>>& queue, std::mutex& mutex); ///< Drop the slices left in a queue, counting them as lost
+  void ReportDrain(); ///< Log and publish the drain time and the data lost at run stop
 
   int m_config_update_time_sec;
   int m_start_delay;
@@ -67,6 +70,7 @@ class RunControl: public Tool {
   bool m_run_stop;
   bool m_new_sub_run;
   bool m_stopping;
+  bool m_draining; ///< run stop drain in progress
   std::string m_run_description;
   
 
@@ -75,6 +79,10 @@ class RunControl: public Tool {
   boost::posix_time::time_duration m_lapse;
   boost::posix_time::ptime m_config_start;
   boost::posix_time::time_duration m_period_reconfigure;
+  boost::posix_time::time_duration m_drain_timeout;
+  boost::posix_time::ptime m_drain_start;
+  ChannelCounters::Snapshot m_drain_dropped; ///< hits lost to the memory budget before the drain
+  unsigned long m_drain_dropped_slices; ///< slices lost to the memory budget before the drain
   
 };
 
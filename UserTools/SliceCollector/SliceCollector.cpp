@@ -0,0 +1,198 @@
+#include "SliceCollector.h"
+
+SliceCollector_args::SliceCollector_args():Thread_args(){
+  data=0;
+  sock=0;
+  session=0;
+  have_next=false;
+  next=0;
+  reorder_us=1000000;
+  out_of_order=0;
+  skipped=0;
+}
+
+SliceCollector_args::~SliceCollector_args(){
+  delete sock;
+  sock=0;
+}
+
+
+SliceCollector::SliceCollector():Tool(){}
+
+
+bool SliceCollector::Initialise(std::string configfile, DataModel &data){
+
+  InitialiseTool(data);
+  m_configfile=configfile;
+  InitialiseConfiguration(configfile);
+  //m_variables.Print();
+
+  m_util=new Utilities();
+  args=new SliceCollector_args();
+  args->data=m_data;
+  args->last_stats=boost::posix_time::microsec_clock::universal_time();
+
+  LoadConfig();
+
+  std::string address="tcp://*:5680";
+  m_variables.Get("address",address);
+  int linger=0;
+  args->sock=new zmq::socket_t(*(m_data->context), ZMQ_PULL);
+  args->sock->setsockopt(ZMQ_LINGER, &linger, sizeof(linger));
+  args->sock->bind(address.c_str());
+
+  m_util->CreateThread("SliceCollector", &Thread, args);
+  StageProfiler::NameThread(args->thread, "SliceCollector");
+
+  ExportConfiguration();
+
+  return true;
+}
+
+
+bool SliceCollector::Execute(){
+
+  if(m_data->change_config){
+    InitialiseConfiguration(m_configfile);
+    LoadConfig();
+    ExportConfiguration();
+  }
+
+  return true;
+}
+
+
+bool SliceCollector::Finalise(){
+
+  m_util->KillThread(args);
+
+  delete args;
+  args=0;
+
+  delete m_util;
+  m_util=0;
+
+  return true;
+}
+
+void SliceCollector::Thread(Thread_args* arg){
+
+  SliceCollector_args* args=reinterpret_cast<SliceCollector_args*>(arg);
+
+  std::queue<std::unique_ptr<TimeSlice>> ready;
+  zmq::pollitem_t items[]={{*args->sock, 0, ZMQ_POLLIN, 0}};
+  zmq::poll(&items[0], 1, 10);
+  if(items[0].revents & ZMQ_POLLIN) Receive(args, ready);
+  Advance(args, ready, false);
+
+  if(ready.size()){
+    args->data->triggered_readout_mutex.lock();
+    for(; ready.size(); ready.pop()){
+      args->data->slice_budget.Force(*ready.front());
+      args->data->triggered_readout.push(std::move(ready.front()));
+    }
+    args->data->triggered_readout_mutex.unlock();
+  }
+
+  boost::posix_time::ptime now=boost::posix_time::microsec_clock::universal_time();
+  if(now - args->last_stats < boost::posix_time::seconds(1)) return;
+  args->last_stats=now;
+  PublishStats(args);
+
+}
+
+void SliceCollector::Receive(SliceCollector_args* args, std::queue<std::unique_ptr<TimeSlice>>& ready){
+
+  while(true){
+    zmq::pollitem_t items[]={{*args->sock, 0, ZMQ_POLLIN, 0}};
+    zmq::poll(&items[0], 1, 0);
+    if(!(items[0].revents & ZMQ_POLLIN)) return;
+
+    StageLink::SliceHeader header;
+    if(!StageLink::ReceiveSliceHeader(args->sock, header)){
+      args->data->services->SendLog("ERROR: SliceCollector: foreign message", v_error);
+      continue;
+    }
+    std::unique_ptr<TimeSlice> slice(new TimeSlice());
+    if(!StageLink::ReceiveSlice(args->sock, *slice)){
+      args->data->services->SendLog("ERROR: SliceCollector: undecodable slice", v_error);
+      continue;
+    }
+
+    uint64_t now=StageLink::Microseconds();
+    SliceCollector_worker& worker=args->workers[header.worker];
+    worker.returned++;
+    worker.period_returned++;
+    worker.latency_us+= now>header.dispatched_us ? now-header.dispatched_us : 0;
+    worker.busy_us+=header.worker_us;
+
+    // a restarted dispatcher numbers its slices from 0 again
+    if(header.session!=args->session){
+      Advance(args, ready, true);
+      args->session=header.session;
+      args->have_next=false;
+    }
+
+    // a slice passed on after later ones was already given up as skipped
+    if(args->have_next && header.sequence<args->next){
+      args->out_of_order++;
+      ready.push(std::move(slice));
+      continue;
+    }
+    args->data->slices_at_workers--;
+    SliceCollector_args::Entry& entry=args->pending[header.sequence];
+    entry.slice=std::move(slice);
+    entry.arrived_us=now;
+  }
+
+}
+
+void SliceCollector::Advance(SliceCollector_args* args, std::queue<std::unique_ptr<TimeSlice>>& ready, bool flush){
+
+  uint64_t now=StageLink::Microseconds();
+  while(args->pending.size()){
+    std::map<uint64_t, SliceCollector_args::Entry>::iterator front=args->pending.begin();
+    bool next= args->have_next && front->first==args->next;
+    if(!next && !flush && now<front->second.arrived_us+args->reorder_us) return;
+    if(args->have_next && front->first>args->next){
+      args->skipped+=front->first-args->next;
+      args->data->slices_at_workers-=front->first-args->next;
+    }
+    ready.push(std::move(front->second.slice));
+    args->next=front->first+1;
+    args->have_next=true;
+    args->pending.erase(front);
+  }
+
+}
+
+void SliceCollector::PublishStats(SliceCollector_args* args){
+
+  args->data->monitoring_store_mtx.lock();
+  for(auto& w : args->workers){
+    std::string prefix="worker_"+std::to_string(w.first);
+    SliceCollector_worker& worker=w.second;
+    args->data->monitoring_store.Set(prefix+"_returned", worker.returned);
+    if(worker.period_returned){
+      args->data->monitoring_store.Set(prefix+"_latency_ms", worker.latency_us/1000.0/worker.period_returned);
+      args->data->monitoring_store.Set(prefix+"_busy_ms", worker.busy_us/1000.0/worker.period_returned);
+    }
+    worker.period_returned=0;
+    worker.latency_us=0;
+    worker.busy_us=0;
+  }
+  args->data->monitoring_store.Set("collector_waiting", args->pending.size());
+  args->data->monitoring_store.Set("collector_out_of_order", args->out_of_order);
+  args->data->monitoring_store.Set("collector_skipped", args->skipped);
+  args->data->monitoring_store_mtx.unlock();
+
+}
+
+void SliceCollector::LoadConfig(){
+
+  if(!m_variables.Get("verbose",m_verbose)) m_verbose=1;
+  unsigned int reorder_ms=1000;
+  m_variables.Get("reorder_ms",reorder_ms);
+  args->reorder_us=reorder_ms*1000ull;
+
+}
@@ -0,0 +1,97 @@
+#ifndef SliceCollector_H
+#define SliceCollector_H
+
+#include <string>
+#include <iostream>
+#include <map>
+
+#include "Tool.h"
+#include "DataModel.h"
+#include "StageLink.h"
+
+/**
+ * \struct SliceCollector_worker
+ *
+ * Returns and latencies of a SliceWorker, averaged over the monitoring period.
+ */
+
+struct SliceCollector_worker{
+
+  SliceCollector_worker(): returned(0), period_returned(0), latency_us(0), busy_us(0){}
+  unsigned long returned; ///< slices since the start
+  unsigned long period_returned; ///< slices since the last monitoring update
+  uint64_t latency_us; ///< summed from dispatch to collection since the last update
+  uint64_t busy_us; ///< summed time in the worker since the last update
+
+};
+
+/**
+ * \struct SliceCollector_args
+ *
+ * Data of the collecting thread.
+ *
+ * $Author: B.Richards $
+ * $Date: 2019/05/28 10:44:00 $
+ */
+
+struct SliceCollector_args:Thread_args{
+
+  struct Entry{
+    std::unique_ptr<TimeSlice> slice;
+    uint64_t arrived_us;
+  };
+
+  SliceCollector_args();
+  ~SliceCollector_args();
+  DataModel* data;
+  zmq::socket_t* sock; ///< PULL the workers connect to
+  std::map<uint64_t, Entry> pending; ///< slices waiting for the ones dispatched before them, by sequence number
+  uint64_t session; ///< of the dispatcher
+  bool have_next; ///< whether the next sequence number is known
+  uint64_t next; ///< sequence number of the next slice to pass on
+  uint64_t reorder_us; ///< how long a slice waits for the ones dispatched before it
+  std::map<uint32_t, SliceCollector_worker> workers;
+  unsigned long out_of_order; ///< slices passed on after later ones since the start
+  unsigned long skipped; ///< sequence numbers that never arrived since the start, e.g. shed by a worker
+  boost::posix_time::ptime last_stats;
+
+};
+
+/**
+ * \class SliceCollector
+ *
+ * Collects the triggered timeslices returned by the SliceWorkers and queues them for the FileWriter in the order the SliceDispatcher sent them, which is the time order of the Reformatter. A slice waits at most reorder_ms for those dispatched before it, after which the missing ones are skipped. Returned and skipped slices are taken off slices_at_workers, which the FileWriter waits for at run stop. Publishes the slices returned by each worker, the mean latency from dispatch to collection (which assumes synchronised clocks) and the mean time spent in the worker.
+ *
+ * Configuration: address (ZMQ endpoint to bind, default tcp://*:5680), reorder_ms (default 1000).
+ *
+ * $Author: B.Richards $
+ * $Date: 2019/05/28 10:44:00 $
+ */
+
+class SliceCollector: public Tool {
+
+
+ public:
+
+  SliceCollector(); ///< Simple constructor
+  bool Initialise(std::string configfile,DataModel &data); ///< Initialise Function for setting up Tool resorces. @param configfile The path and name of the dynamic configuration file to read in. @param data A reference to the transient data class used to pass information between Tools.
+  bool Execute(); ///< Executre function used to perform Tool perpose.
+  bool Finalise(); ///< Finalise funciton used to clean up resorces.
+
+
+ private:
+
+  void LoadConfig();
+  static void Thread(Thread_args* arg); ///< Receives the returned slices and passes them on in order
+  static void Receive(SliceCollector_args* args, std::queue<std::unique_ptr<TimeSlice>>& ready); ///< Take the returned slices, those that need not wait go to ready
+  static void Advance(SliceCollector_args* args, std::queue<std::unique_ptr<TimeSlice>>& ready, bool flush); ///< Move the pending slices that are next or waited long enough, all if flush, to ready
+  static void PublishStats(SliceCollector_args* args); ///< Per worker returns and latencies into the monitoring store
+  Utilities* m_util;  ///< Pointer to utilities class to help with threading
+  SliceCollector_args* args; ///< thread args (also holds pointer to the thread)
+
+  std::string m_configfile;
+
+};
+
+
+#endif
@@ -0,0 +1,216 @@
+#include "SliceDispatcher.h"
+
+SliceDispatcher_args::SliceDispatcher_args():Thread_args(){
+  data=0;
+  hash=false;
+  partition_ns=1000000000;
+  max_backlog=64;
+  next=0;
+  session=0;
+  sequence=0;
+  rerouted=0;
+}
+
+SliceDispatcher_args::~SliceDispatcher_args(){
+  for(unsigned int i=0; i<workers.size(); i++){
+    delete workers[i].sock;
+    workers[i].sock=0;
+  }
+}
+
+
+SliceDispatcher::SliceDispatcher():Tool(){}
+
+
+bool SliceDispatcher::Initialise(std::string configfile, DataModel &data){
+
+  InitialiseTool(data);
+  m_configfile=configfile;
+  InitialiseConfiguration(configfile);
+  //m_variables.Print();
+
+  m_util=new Utilities();
+  args=new SliceDispatcher_args();
+  args->data=m_data;
+  args->session=StageLink::Microseconds();
+  args->last_stats=boost::posix_time::microsec_clock::universal_time();
+
+  LoadConfig();
+
+  int hwm=4;
+  m_variables.Get("hwm",hwm);
+  int linger=0;
+  std::string address;
+  while(m_variables.Get("worker_"+std::to_string(args->workers.size()),address)){
+    args->workers.emplace_back();
+    SliceDispatcher_worker& worker=args->workers.back();
+    worker.address=address;
+    worker.sock=new zmq::socket_t(*(m_data->context), ZMQ_PUSH);
+    worker.sock->setsockopt(ZMQ_SNDHWM, &hwm, sizeof(hwm));
+    worker.sock->setsockopt(ZMQ_LINGER, &linger, sizeof(linger));
+    worker.sock->connect(address.c_str());
+  }
+  if(!args->workers.size()){
+    std::string errmsg="ERROR "+m_tool_name+"::Initialise no workers configured, expected worker_0";
+    m_data->services->SendLog(errmsg, v_error);
+    delete args;
+    args=0;
+    delete m_util;
+    m_util=0;
+    return false;
+  }
+
+  m_util->CreateThread("SliceDispatcher", &Thread, args);
+  StageProfiler::NameThread(args->thread, "SliceDispatcher");
+
+  ExportConfiguration();
+
+  return true;
+}
+
+
+bool SliceDispatcher::Execute(){
+
+  if(m_data->change_config){
+    InitialiseConfiguration(m_configfile);
+    LoadConfig();
+    ExportConfiguration();
+  }
+
+  return true;
+}
+
+
+bool SliceDispatcher::Finalise(){
+
+  if(!args) return true;
+
+  m_util->KillThread(args);
+
+  // slices no worker took are lost
+  for(unsigned int i=0; i<args->workers.size(); i++){
+    for(auto& pending : args->workers[i].backlog) m_data->slice_budget.Drop(*pending.second);
+  }
+
+  delete args;
+  args=0;
+
+  delete m_util;
+  m_util=0;
+
+  return true;
+}
+
+void SliceDispatcher::Thread(Thread_args* arg){
+
+  SliceDispatcher_args* args=reinterpret_cast<SliceDispatcher_args*>(arg);
+
+  std::queue<std::unique_ptr<TimeSlice>> readout;
+  args->data->readout_mutex.lock();
+  std::swap(args->data->readout, readout);
+  args->data->readout_mutex.unlock();
+
+  bool routed=readout.size();
+  while(readout.size()){
+    Route(args, std::move(readout.front()));
+    readout.pop();
+  }
+
+  bool waiting=false;
+  for(unsigned int i=0; i<args->workers.size(); i++){
+    while(args->workers[i].backlog.size() && Send(args, i));
+    if(args->workers[i].backlog.size()) waiting=true;
+  }
+  if(waiting) usleep(1000);
+  else if(!routed) usleep(10000);
+
+  boost::posix_time::ptime now=boost::posix_time::microsec_clock::universal_time();
+  if(now - args->last_stats < boost::posix_time::seconds(1)) return;
+  args->last_stats=now;
+
+  args->data->monitoring_store_mtx.lock();
+  for(unsigned int i=0; i<args->workers.size(); i++){
+    std::string prefix="worker_"+std::to_string(i);
+    args->data->monitoring_store.Set(prefix+"_dispatched", args->workers[i].dispatched);
+    args->data->monitoring_store.Set(prefix+"_backlog", args->workers[i].backlog.size());
+  }
+  args->data->monitoring_store.Set("dispatch_rerouted", args->rerouted);
+  args->data->monitoring_store_mtx.unlock();
+
+}
+
+void SliceDispatcher::Route(SliceDispatcher_args* args, std::unique_ptr<TimeSlice> slice){
+
+  unsigned int worker;
+  if(args->hash){
+    worker=(slice->time.ns()/args->partition_ns) % args->workers.size();
+    if(args->workers[worker].backlog.size()>=args->max_backlog){
+      worker=LeastLoaded(args);
+      args->rerouted++;
+    }
+  }
+  else{
+    worker=LeastLoaded(args);
+    args->next=(worker+1) % args->workers.size();
+  }
+
+  args->workers[worker].backlog.push_back(std::make_pair(args->sequence++, std::move(slice)));
+
+}
+
+unsigned int SliceDispatcher::LeastLoaded(SliceDispatcher_args* args){
+
+  unsigned int best=args->next % args->workers.size();
+  for(unsigned int i=1; i<args->workers.size(); i++){
+    unsigned int worker=(args->next+i) % args->workers.size();
+    if(args->workers[worker].backlog.size()<args->workers[best].backlog.size()) best=worker;
+  }
+  return best;
+
+}
+
+bool SliceDispatcher::Send(SliceDispatcher_args* args, unsigned int worker){
+
+  SliceDispatcher_worker& w=args->workers[worker];
+  StageLink::SliceHeader header;
+  header.magic=StageLink::slice_magic;
+  header.worker=worker;
+  header.session=args->session;
+  header.sequence=w.backlog.front().first;
+  header.dispatched_us=StageLink::Microseconds();
+  header.worker_us=0;
+
+  // once the first frame is queued the socket takes the whole message
+  zmq::message_t message(&header, sizeof(header));
+  if(!w.sock->send(message, ZMQ_SNDMORE | ZMQ_DONTWAIT)) return false;
+  StageLink::SendSlice(w.sock, *w.backlog.front().second);
+
+  // the slice left this process, the SliceCollector accounts for it until it returns
+  args->data->slice_budget.Release(*w.backlog.front().second);
+  args->data->slices_at_workers++;
+  w.backlog.pop_front();
+  w.dispatched++;
+  return true;
+
+}
+
+void SliceDispatcher::LoadConfig(){
+
+  if(!m_variables.Get("verbose",m_verbose)) m_verbose=1;
+
+  std::string policy="round_robin";
+  m_variables.Get("policy",policy);
+  if(policy!="round_robin" && policy!="hash"){
+    m_data->services->SendLog("Warning: "+m_tool_name+": unknown policy "+policy+", using round_robin", v_warning);
+    policy="round_robin";
+  }
+  args->hash= policy=="hash";
+
+  double partition_seconds=1;
+  m_variables.Get("partition_seconds",partition_seconds);
+  args->partition_ns= partition_seconds>0 ? static_cast<uint64_t>(partition_seconds*1e9) : 1000000000;
+  if(!args->partition_ns) args->partition_ns=1;
+
+  if(!m_variables.Get("max_backlog",args->max_backlog) || args->max_backlog==0) args->max_backlog=64;
+
+}
@@ -0,0 +1,91 @@
+#ifndef SliceDispatcher_H
+#define SliceDispatcher_H
+
+#include <string>
+#include <iostream>
+#include <deque>
+
+#include "Tool.h"
+#include "DataModel.h"
+#include "StageLink.h"
+
+/**
+ * \struct SliceDispatcher_worker
+ *
+ * A SliceWorker the timeslices are dispatched to, with the slices waiting for its socket.
+ */
+
+struct SliceDispatcher_worker{
+
+  SliceDispatcher_worker(): sock(0), dispatched(0){}
+  std::string address; ///< endpoint of the worker
+  zmq::socket_t* sock; ///< PUSH connected to the worker
+  std::deque<std::pair<uint64_t, std::unique_ptr<TimeSlice>>> backlog; ///< slices with their sequence numbers, waiting while the worker does not take more
+  unsigned long dispatched; ///< slices sent since the start
+
+};
+
+/**
+ * \struct SliceDispatcher_args
+ *
+ * Data of the dispatching thread.
+ *
+ * $Author: B.Richards $
+ * $Date: 2019/05/28 10:44:00 $
+ */
+
+struct SliceDispatcher_args:Thread_args{
+
+  SliceDispatcher_args();
+  ~SliceDispatcher_args();
+  DataModel* data;
+  std::deque<SliceDispatcher_worker> workers; ///< a deque, the workers are never moved
+  bool hash; ///< partition by slice time instead of round robin
+  uint64_t partition_ns; ///< slices starting in the same interval go to the same worker with the hash policy
+  unsigned long max_backlog; ///< with the hash policy slices for a worker with this many waiting go to the least loaded one
+  unsigned int next; ///< where the round robin continues
+  uint64_t session; ///< start time, tells the collector the sequence numbers restarted
+  uint64_t sequence; ///< of the next slice
+  unsigned long rerouted; ///< slices that did not go to their hash partition
+  boost::posix_time::ptime last_stats;
+
+};
+
+/**
+ * \class SliceDispatcher
+ *
+ * Fans out the complete timeslices of the Reformatter to SliceWorkers in other toolchains when a single node cannot keep up with triggering. The round_robin policy sends each slice to the worker with the fewest slices waiting, starting after the previous one; the hash policy sends all slices starting within the same partition_seconds interval to the same worker. A worker whose socket is full holds its slices in a backlog, which with the round robin policy moves the load to the others. A SliceCollector in the same toolchain merges the triggered slices back, see StageLink; sent slices leave the memory budget and are counted in slices_at_workers until it collects them.
+ *
+ * Configuration: worker_0, worker_1, ... (ZMQ endpoints of the workers), policy (round_robin or hash, default round_robin), partition_seconds (default 1), max_backlog (slices, default 64), hwm (slices queued in the socket per worker, default 4).
+ *
+ * $Author: B.Richards $
+ * $Date: 2019/05/28 10:44:00 $
+ */
+
+class SliceDispatcher: public Tool {
+
+
+ public:
+
+  SliceDispatcher(); ///< Simple constructor
+  bool Initialise(std::string configfile,DataModel &data); ///< Initialise Function for setting up Tool resorces. @param configfile The path and name of the dynamic configuration file to read in. @param data A reference to the transient data class used to pass information between Tools.
+  bool Execute(); ///< Executre function used to perform Tool perpose.
+  bool Finalise(); ///< Finalise funciton used to clean up resorces.
+
+
+ private:
+
+  void LoadConfig();
+  static void Thread(Thread_args* arg); ///< Routes the new timeslices and sends the backlogs
+  static void Route(SliceDispatcher_args* args, std::unique_ptr<TimeSlice> slice); ///< Queue a slice for a worker according to the policy
+  static unsigned int LeastLoaded(SliceDispatcher_args* args); ///< Worker with the shortest backlog, ties broken round robin
+  static bool Send(SliceDispatcher_args* args, unsigned int worker); ///< Send the first slice of the backlog if the worker takes it
+  Utilities* m_util;  ///< Pointer to utilities class to help with threading
+  SliceDispatcher_args* args; ///< thread args (also holds pointer to the thread)
+
+  std::string m_configfile;
+
+};
+
+
+#endif
@@ -0,0 +1,197 @@
+#include "SliceWorker.h"
+
+SliceWorker_args::SliceWorker_args():Thread_args(){
+  data=0;
+  in=0;
+  out=0;
+  received=0;
+  returned=0;
+  failed=0;
+}
+
+SliceWorker_args::~SliceWorker_args(){
+  delete in;
+  in=0;
+  delete out;
+  out=0;
+}
+
+
+SliceWorker::SliceWorker():Tool(){}
+
+
+bool SliceWorker::Initialise(std::string configfile, DataModel &data){
+
+  InitialiseTool(data);
+  m_configfile=configfile;
+  InitialiseConfiguration(configfile);
+  //m_variables.Print();
+
+  m_util=new Utilities();
+  args=new SliceWorker_args();
+  args->data=m_data;
+  args->last_stats=boost::posix_time::microsec_clock::universal_time();
+
+  LoadConfig();
+
+  std::string address="tcp://*:5670";
+  m_variables.Get("address",address);
+  std::string collector="tcp://localhost:5680";
+  m_variables.Get("collector",collector);
+  int send_timeout_ms=1000;
+  m_variables.Get("send_timeout_ms",send_timeout_ms);
+  int hwm=4;
+  int linger=0;
+
+  args->in=new zmq::socket_t(*(m_data->context), ZMQ_PULL);
+  args->in->setsockopt(ZMQ_RCVHWM, &hwm, sizeof(hwm));
+  args->in->setsockopt(ZMQ_LINGER, &linger, sizeof(linger));
+  args->in->bind(address.c_str());
+
+  args->out=new zmq::socket_t(*(m_data->context), ZMQ_PUSH);
+  args->out->setsockopt(ZMQ_SNDTIMEO, &send_timeout_ms, sizeof(send_timeout_ms));
+  args->out->setsockopt(ZMQ_LINGER, &linger, sizeof(linger));
+  args->out->connect(collector.c_str());
+
+  m_util->CreateThread("SliceWorker", &Thread, args);
+  StageProfiler::NameThread(args->thread, "SliceWorker");
+
+  ExportConfiguration();
+
+  return true;
+}
+
+
+bool SliceWorker::Execute(){
+
+  if(m_data->change_config){
+    InitialiseConfiguration(m_configfile);
+    LoadConfig();
+    ExportConfiguration();
+  }
+
+  return true;
+}
+
+
+bool SliceWorker::Finalise(){
+
+  m_util->KillThread(args);
+
+  delete args;
+  args=0;
+
+  delete m_util;
+  m_util=0;
+
+  return true;
+}
+
+void SliceWorker::Thread(Thread_args* arg){
+
+  SliceWorker_args* args=reinterpret_cast<SliceWorker_args*>(arg);
+
+  zmq::pollitem_t items[]={{*args->in, 0, ZMQ_POLLIN, 0}};
+  zmq::poll(&items[0], 1, 10);
+  if(items[0].revents & ZMQ_POLLIN) Receive(args);
+
+  Return(args);
+
+  boost::posix_time::ptime now=boost::posix_time::microsec_clock::universal_time();
+  if(now - args->last_stats < boost::posix_time::seconds(1)) return;
+  args->last_stats=now;
+
+  uint64_t stale=StageLink::Microseconds()-args->pending_timeout.total_microseconds();
+  for(auto it=args->pending.begin(); it!=args->pending.end();){
+    if(it->second.second<stale) it=args->pending.erase(it);
+    else ++it;
+  }
+
+  args->data->monitoring_store_mtx.lock();
+  args->data->monitoring_store.Set("worker_received", args->received);
+  args->data->monitoring_store.Set("worker_returned", args->returned);
+  args->data->monitoring_store.Set("worker_return_failed", args->failed);
+  args->data->monitoring_store.Set("worker_in_progress", args->pending.size());
+  args->data->monitoring_store_mtx.unlock();
+
+}
+
+void SliceWorker::Receive(SliceWorker_args* args){
+
+  SliceBudget& budget=args->data->slice_budget;
+  std::queue<std::unique_ptr<TimeSlice>> readout;
+
+  // slices left in the socket hold back the dispatcher, which then favours the other workers
+  while(!budget.Max() || budget.Used()<budget.Max()){
+    zmq::pollitem_t items[]={{*args->in, 0, ZMQ_POLLIN, 0}};
+    zmq::poll(&items[0], 1, 0);
+    if(!(items[0].revents & ZMQ_POLLIN)) break;
+
+    StageLink::SliceHeader header;
+    if(!StageLink::ReceiveSliceHeader(args->in, header)){
+      args->data->services->SendLog("ERROR: SliceWorker: foreign message", v_error);
+      continue;
+    }
+    std::unique_ptr<TimeSlice> slice(new TimeSlice());
+    if(!StageLink::ReceiveSlice(args->in, *slice)){
+      args->data->services->SendLog("ERROR: SliceWorker: undecodable slice", v_error);
+      continue;
+    }
+    budget.Force(*slice);
+    args->pending[SliceWorker_args::Key(slice->run, slice->sub_run, slice->time.bits())]=std::make_pair(header, StageLink::Microseconds());
+    readout.push(std::move(slice));
+    args->received++;
+  }
+
+  if(!readout.size()) return;
+  std::lock_guard<std::mutex> lock(args->data->readout_mutex);
+  while(readout.size()){
+    args->data->readout.push(std::move(readout.front()));
+    readout.pop();
+  }
+
+}
+
+void SliceWorker::Return(SliceWorker_args* args){
+
+  std::queue<std::unique_ptr<TimeSlice>> triggered;
+  args->data->triggered_readout_mutex.lock();
+  std::swap(args->data->triggered_readout, triggered);
+  args->data->triggered_readout_mutex.unlock();
+
+  for(; triggered.size(); triggered.pop()){
+    TimeSlice& slice=*triggered.front();
+    auto it=args->pending.find(SliceWorker_args::Key(slice.run, slice.sub_run, slice.time.bits()));
+    if(it==args->pending.end()){
+      args->data->services->SendLog("ERROR: SliceWorker: no dispatcher header for a slice, dropping it", v_error);
+      args->data->slice_budget.Drop(slice);
+      args->failed++;
+      continue;
+    }
+
+    StageLink::SliceHeader header=it->second.first;
+    header.worker_us=StageLink::Microseconds()-it->second.second;
+    args->pending.erase(it);
+
+    zmq::message_t message(&header, sizeof(header));
+    if(!args->out->send(message, ZMQ_SNDMORE)){
+      args->data->services->SendLog("ERROR: SliceWorker: collector does not take slices, dropping one", v_error);
+      args->data->slice_budget.Drop(slice);
+      args->failed++;
+      continue;
+    }
+    StageLink::SendSlice(args->out, slice);
+    args->data->slice_budget.Release(slice);
+    args->returned++;
+  }
+
+}
+
+void SliceWorker::LoadConfig(){
+
+  if(!m_variables.Get("verbose",m_verbose)) m_verbose=1;
+  unsigned int pending_timeout_sec=60;
+  m_variables.Get("pending_timeout_sec",pending_timeout_sec);
+  args->pending_timeout=boost::posix_time::seconds(pending_timeout_sec);
+
+}
@@ -0,0 +1,76 @@
+#ifndef SliceWorker_H
+#define SliceWorker_H
+
+#include <string>
+#include <iostream>
+#include <map>
+#include <tuple>
+
+#include "Tool.h"
+#include "DataModel.h"
+#include "StageLink.h"
+
+/**
+ * \struct SliceWorker_args
+ *
+ * Data of the worker thread.
+ *
+ * $Author: B.Richards $
+ * $Date: 2019/05/28 10:44:00 $
+ */
+
+struct SliceWorker_args:Thread_args{
+
+  typedef std::tuple<unsigned long, unsigned long, uint64_t> Key; ///< run, sub run and time of a slice
+
+  SliceWorker_args();
+  ~SliceWorker_args();
+  DataModel* data;
+  zmq::socket_t* in; ///< PULL the dispatcher connects to
+  zmq::socket_t* out; ///< PUSH connected to the collector
+  std::map<Key, std::pair<StageLink::SliceHeader, uint64_t>> pending; ///< headers of the slices being triggered, with the time they arrived
+  boost::posix_time::time_duration pending_timeout; ///< headers of slices that did not come back within this time, e.g. shed by the Trigger, are forgotten
+  unsigned long received; ///< slices since the start
+  unsigned long returned; ///< slices since the start
+  unsigned long failed; ///< slices that could not be returned since the start
+  boost::posix_time::ptime last_stats;
+
+};
+
+/**
+ * \class SliceWorker
+ *
+ * Receives timeslices from a SliceDispatcher in another toolchain and queues them for the Sorter and the Trigger as the Reformatter would, then returns the triggered slices to the SliceCollector. Slices are only taken from the dispatcher while the slice budget has room, so a busy worker leaves them to the others.
+ *
+ * Configuration: address (ZMQ endpoint to bind, default tcp://*:5670), collector (ZMQ endpoint of the collector, default tcp://localhost:5680), pending_timeout_sec (default 60), send_timeout_ms (default 1000).
+ *
+ * $Author: B.Richards $
+ * $Date: 2019/05/28 10:44:00 $
+ */
+
+class SliceWorker: public Tool {
+
+
+ public:
+
+  SliceWorker(); ///< Simple constructor
+  bool Initialise(std::string configfile,DataModel &data); ///< Initialise Function for setting up Tool resorces. @param configfile The path and name of the dynamic configuration file to read in. @param data A reference to the transient data class used to pass information between Tools.
+  bool Execute(); ///< Executre function used to perform Tool perpose.
+  bool Finalise(); ///< Finalise funciton used to clean up resorces.
+
+
+ private:
+
+  void LoadConfig();
+  static void Thread(Thread_args* arg); ///< Receives new slices and returns the triggered ones
+  static void Receive(SliceWorker_args* args); ///< Queue the pending slices for the Sorter while the budget has room
+  static void Return(SliceWorker_args* args); ///< Send the triggered slices to the collector
+  Utilities* m_util;  ///< Pointer to utilities class to help with threading
+  SliceWorker_args* args; ///< thread args (also holds pointer to the thread)
+
+  std::string m_configfile;
+
+};
+
+
+#endif
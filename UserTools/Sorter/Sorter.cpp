@@ -13,6 +13,9 @@ bool Sorter::Initialise(std::string configfile, DataModel &data){
   InitialiseConfiguration(configfile);
 
   if(!m_variables.Get("verbose",m_verbose)) m_verbose=1;
+  unsigned long bucket_ns=0;
+  if(m_variables.Get("index_bucket_ns",bucket_ns)) index_bucket=Time::from_ns(bucket_ns);
+  else index_bucket=TimeSlice::index_bucket();
 
   m_util=new Utilities();
 
@@ -53,12 +56,14 @@ void Sorter::CreateThread(){
   tmp_args->readout_mutex = &(m_data->readout_mutex);
   tmp_args->sorted_readout = &(m_data->sorted_readout);
   tmp_args->sorted_readout_mutex = &(m_data->sorted_readout_mutex);
+  tmp_args->index_bucket = &index_bucket;
   args.push_back(tmp_args);
   
   std::stringstream tmp;
-  tmp<<"T"<<m_threadnum;
+  tmp<<"Sorter"<<m_threadnum;
 
   m_util->CreateThread(tmp.str(), &Thread, args.at(args.size()-1));
+  StageProfiler::NameThread(args.at(args.size()-1)->thread, tmp.str());
   m_threadnum++;
   m_data->thread_num++;
   
@@ -77,10 +82,10 @@ void Sorter::Thread(Thread_args* arg){
 
   Sorter_args* args=reinterpret_cast<Sorter_args*>(arg);
 
-  args->readout_mutex->lock();
+  args->m_data->profiler.Lock(*args->readout_mutex, StageProfiler::sorter);
   if(!args->readout->size()){
     args->readout_mutex->unlock();
-    usleep(100);
+    args->m_data->profiler.Sleep(100, StageProfiler::sorter);
     return;
   }
   std::swap(*args->readout, args->in_progress);
@@ -99,6 +104,7 @@ void Sorter::Thread(Thread_args* arg){
     //printf("p4 %p\n",tmp_args->time_slice.get());
     tmp_args->sorted_readout = args->sorted_readout;
     tmp_args->sorted_readout_mutex = args->sorted_readout_mutex;
+    tmp_args->index_bucket = args->index_bucket;
     tmp_job->data=tmp_args;
     tmp_job->func=SortData;
     tmp_job->fail_func=FailSort;
@@ -112,6 +118,8 @@ void Sorter::Thread(Thread_args* arg){
 bool Sorter::SortData(void* data){
 
   Sorter_args* args=reinterpret_cast<Sorter_args*>(data);
+  StageProfiler::NameThread("job:sorter");
+  StageProfiler::Scope scope(args->m_data->profiler, StageProfiler::sorter);
 
   //printf("d1\n");
   //printf("d1.2 %p\n",args->time_slice.get());
@@ -121,8 +129,10 @@ bool Sorter::SortData(void* data){
                                   {
                                       return a.time < b.time;
                                   });
+  // coarse time index for the downstream time window lookups
+  args->time_slice->BuildIndex(*args->index_bucket);
   //printf("d2\n");
-   args->sorted_readout_mutex->lock();
+   args->m_data->profiler.Lock(*args->sorted_readout_mutex, StageProfiler::sorter);
    //printf("d3\n");
    args->sorted_readout->emplace(std::move(args->time_slice)); //Ben this is bad and will lead to an unsorted queue dont use a queue;
    //printf("d4\n");
@@ -138,6 +148,7 @@ bool Sorter::SortData(void* data){
 void Sorter::FailSort(void* data){
 
   Sorter_args* args=reinterpret_cast<Sorter_args*>(data);
+  if(args->time_slice) args->m_data->slice_budget.Drop(*args->time_slice); // counted as lost
   delete args;
   args=0;
   data=0;
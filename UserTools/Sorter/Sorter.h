@@ -30,6 +30,7 @@ struct Sorter_args:Thread_args{
   std::mutex* sorted_readout_mutex;
   std::queue<std::unique_ptr<TimeSlice>> in_progress;
   std::unique_ptr<TimeSlice> time_slice;
+  Time* index_bucket;
   
 };
 
@@ -66,6 +67,8 @@ class Sorter: public Tool {
 
   static bool SortData(void* data);
   static void FailSort(void* data);
+
+  Time index_bucket; ///< Width of the coarse time index buckets, 0 disables the index
   
 };
 
@@ -13,9 +13,8 @@ bool Trigger::Initialise(std::string configfile, DataModel &data){
   m_configfile=configfile;
   InitialiseConfiguration(configfile);
 
-  srand (time(NULL));
-  
-  if(!m_variables.Get("verbose",m_verbose)) m_verbose=1;
+  std::atomic_store(&engine, std::make_shared<TriggerEngine>());
+  LoadConfig();
 
   m_util=new Utilities();
 
@@ -33,23 +32,11 @@ bool Trigger::Execute(){
   
   if(m_data->change_config){
     InitialiseConfiguration(m_configfile);
-
-    if(!m_variables.Get("verbose",m_verbose)) m_verbose=1;
-    if(!m_variables.Get("nhits",nhits)) nhits=false;
-    if(!m_variables.Get("threashold",threashold)) threashold=20;
-    if(!m_variables.Get("window_size",window_size)) window_size=200;
-    if(!m_variables.Get("jump",jump)) jump=2000;
-    trigger_channels.clear();
-    std::string type;
-    for(uint8_t i=0; i<255; i++){
-      if(m_variables.Get(std::to_string(i), type)){
-	if(type=="calib") trigger_channels[i]=TriggerType::calib;
-      }
-    }
-    if(!m_variables.Get("zero_rate",zero_rate)) zero_rate=0.0;  
-
+    LoadConfig();
     ExportConfiguration();
   }
+
+  PublishRates();
   
   return true;
 }
@@ -75,18 +62,14 @@ void Trigger::CreateThread(){
   tmp_args->sorted_readout_mutex = &(m_data->sorted_readout_mutex);
   tmp_args->triggered_readout = &(m_data->triggered_readout);
   tmp_args->triggered_readout_mutex = &(m_data->triggered_readout_mutex);
-  tmp_args->trigger_channels = &trigger_channels;
-  tmp_args->zero_rate = &zero_rate;
-  tmp_args->threashold = &threashold;
-  tmp_args->window_size = &window_size;
-  tmp_args->jump = &jump;
-  tmp_args->nhits = &nhits;
+  tmp_args->current_engine = &engine;
   args.push_back(tmp_args);
   
   std::stringstream tmp;
-  tmp<<"T"<<m_threadnum;
+  tmp<<"Trigger"<<m_threadnum;
 
   m_util->CreateThread(tmp.str(), &Thread, args.at(args.size()-1));
+  StageProfiler::NameThread(args.at(args.size()-1)->thread, tmp.str());
   m_threadnum++;
   m_data->thread_num++;
   
@@ -105,10 +88,10 @@ void Trigger::Thread(Thread_args* arg){
 
   Trigger_args* args=reinterpret_cast<Trigger_args*>(arg);
 
-  args->sorted_readout_mutex->lock();
+  args->m_data->profiler.Lock(*args->sorted_readout_mutex, StageProfiler::trigger);
   if(!args->sorted_readout->size()){
     args->sorted_readout_mutex->unlock();
-    usleep(100);
+    args->m_data->profiler.Sleep(100, StageProfiler::trigger);
     return;
   }
   //  printf("l1\n");  
@@ -126,12 +109,7 @@ void Trigger::Thread(Thread_args* arg){
     args->in_progress.pop();
     tmp_args->triggered_readout = args->triggered_readout;
     tmp_args->triggered_readout_mutex = args->triggered_readout_mutex;
-    tmp_args->trigger_channels = args->trigger_channels;
-    tmp_args->zero_rate = args->zero_rate;
-    tmp_args->threashold = args->threashold;
-    tmp_args->window_size = args->window_size;
-    tmp_args->jump = args->jump;
-    tmp_args->nhits = args->nhits;
+    tmp_args->engine = std::atomic_load(args->current_engine);
     tmp_job->data=tmp_args;
     tmp_job->func=TriggerData;
     tmp_job->fail_func=FailTrigger;
@@ -150,65 +128,39 @@ bool Trigger::TriggerData(void* data){
 
   //printf("d1\n");
   Trigger_args* args=reinterpret_cast<Trigger_args*>(data);
-
-  //run trigger algos
-  //nhits
-  //trigger channels
-  //time??
- //printf("d2\n");
-  
-  if(args->nhits) args->count = new short[100000000];
- //printf("d3\n");
-  for(unsigned int i=0; i <args->time_slice->hits.size(); i++){
-
-    if(args->trigger_channels->count(args->time_slice->hits.at(i).channel)) args->time_slice->triggers.emplace(args->time_slice->triggers.end(), (*args->trigger_channels)[args->time_slice->hits.at(i).channel], args->time_slice->hits.at(i).time); // calib triggers
-    else{
-      //printf("a=%lu\n",args->time_slice->hits.at(i).time.bits());
-      //printf("b=%lu\n",args->time_slice->time.bits());
-      //printf("c=%lu\n",(args->time_slice->hits.at(i).time.bits() - args->time_slice->time.bits())>>9);
-      //printf("channel = %u\n", args->time_slice->hits[i].channel);
-      
-      if(args->nhits) args->count[(args->time_slice->hits.at(i).time.bits() - args->time_slice->time.bits())>>9]++;
-    }
-  }
-  //printf("d4\n");
-  
-  if(args->nhits){
-    for(unsigned int i=1; i<100000000; i++){
-      args->count[i]+=args->count[i-1];
-    }
-    //printf("d5\n");
-    
-    //nhits
-    for(unsigned int i= (*args->window_size)+1; i<100000000-(*args->window_size); i++){
-      if(args->count[i]-args->count[i-(*args->window_size)] >= (*args->threashold)){
-	args->time_slice->triggers.emplace(args->time_slice->triggers.end(), TriggerType::nhits, (i-(*args->window_size) <<9) + args->time_slice->time.bits());
-	i+=(*args->jump);
-      }
-    }
-    
-    delete[] args->count;
-    args->count=0;
-  }
-  
-  // zero bais
-  for(float repeate = 0.0; repeate<(*(args->zero_rate)/10.0); repeate+=1.0){ 
-    if(((rand() % 1000)/1000.0) < (*(args->zero_rate)/10.0)){
-      args->time_slice->triggers.emplace(args->time_slice->triggers.end(), TriggerType::zero_bias, ((rand() % 100000000) <<9) + args->time_slice->time.bits()); 
-    }
-    
+  StageProfiler::NameThread("job:trigger");
+  StageProfiler::Scope scope(args->m_data->profiler, StageProfiler::trigger);
+
+  // calib, nhits, multiplicity and coincidence triggers in one pass over the sorted hits
+  args->engine->Run(*args->time_slice);
+  
+  // zero bais, reproducible for a given run and zero_seed
+  args->engine->ZeroBias(*args->time_slice, args->m_data->run_number);
+
+  // triggers in the context hits are reported by the neighbouring slices
+  args->time_slice->TrimTriggers();
+  std::sort(args->time_slice->triggers.begin(), args->time_slice->triggers.end(), [](const TriggerInfo& a, const TriggerInfo& b){ return a.time < b.time; });
+
+  // under memory pressure untriggered and prescaled zero bias slices go first
+  if(args->m_data->slice_budget.Shed(*args->time_slice)){
+    args->m_data->slice_budget.Drop(*args->time_slice);
+    delete args;
+    args=0;
+    data=0;
+    return true;
   }
+
+  // online histograms, each worker thread fills its own shard
+  args->m_data->channel_stats.Fill(*args->time_slice);
 				    
  //printf("d6\n");
 
   ////
-   args->triggered_readout_mutex->lock();
+   args->m_data->profiler.Lock(*args->triggered_readout_mutex, StageProfiler::trigger);
    args->triggered_readout->emplace(std::move(args->time_slice)); //Ben this is bad and will lead to an unsorted queue dont use a queue;
    args->triggered_readout_mutex->unlock(); 
    //printf("d7\n");
    
-   delete[] args->count;
-   args->count=0;
    delete args;
    args=0;
    data=0;
@@ -222,6 +174,7 @@ bool Trigger::TriggerData(void* data){
 void Trigger::FailTrigger(void* data){
   // printf("e1\n");
   Trigger_args* args=reinterpret_cast<Trigger_args*>(data);
+  if(args->time_slice) args->m_data->slice_budget.Drop(*args->time_slice); // counted as lost
   delete args;
   args=0;
   data=0;
@@ -229,4 +182,48 @@ void Trigger::FailTrigger(void* data){
   
 }
 
+bool Trigger::LoadConfig(){
 
+  if(!m_variables.Get("verbose",m_verbose)) m_verbose=1;
+
+  unsigned int rate_period_sec=10;
+  m_variables.Get("rate_period_sec",rate_period_sec);
+  m_rate_period=boost::posix_time::seconds(rate_period_sec);
+
+  std::shared_ptr<TriggerEngine> tmp=std::make_shared<TriggerEngine>();
+  std::string error;
+  if(!tmp->Configure(m_variables, error)){
+    std::string errmsg="ERROR "+m_tool_name+"::LoadConfig "+error+", keeping previous trigger configuration";
+    m_data->services->SendLog(errmsg, v_error);
+    m_data->services->SendAlarm(errmsg);
+    return false;
+  }
+
+  std::atomic_store(&engine, tmp);
+  m_last_counts.assign(tmp->conditions.size(), 0);
+  m_last_rates=boost::posix_time::microsec_clock::universal_time();
+
+  return true;
+}
+
+void Trigger::PublishRates(){
+
+  boost::posix_time::ptime now=boost::posix_time::microsec_clock::universal_time();
+  boost::posix_time::time_duration lapse=now - m_last_rates;
+  if(lapse < m_rate_period) return;
+
+  std::shared_ptr<TriggerEngine> current=std::atomic_load(&engine);
+  std::vector<unsigned long> counts=current->Counts();
+  double seconds=lapse.total_microseconds()/1e6;
+
+  m_data->monitoring_store_mtx.lock();
+  for(size_t i=0; i<counts.size(); i++){
+    m_data->monitoring_store.Set("trigger_"+current->conditions[i].name+"_count",counts[i]);
+    m_data->monitoring_store.Set("trigger_"+current->conditions[i].name+"_rate",(counts[i]-m_last_counts[i])/seconds);
+  }
+  m_data->monitoring_store_mtx.unlock();
+
+  m_last_counts=counts;
+  m_last_rates=now;
+
+}
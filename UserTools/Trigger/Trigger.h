@@ -6,8 +6,7 @@
 
 #include "Tool.h"
 #include <DataModel.h>
-#include <stdlib.h>     /* srand, rand */
-#include <time.h>       /* time */
+#include "TriggerEngine.h"
 
 using namespace ToolFramework;
 
@@ -32,13 +31,8 @@ struct Trigger_args:Thread_args{
   std::mutex* triggered_readout_mutex;
   std::queue<std::unique_ptr<TimeSlice>> in_progress;
   std::unique_ptr<TimeSlice> time_slice;
-  std::map<uint8_t, TriggerType>* trigger_channels;
-  unsigned int* threashold;
-  unsigned int* window_size;
-  unsigned int* jump;
-  float* zero_rate;
-  short* count;
-  bool* nhits;
+  std::shared_ptr<TriggerEngine>* current_engine; ///< engine to hand out to new jobs
+  std::shared_ptr<TriggerEngine> engine; ///< engine used by a job
   
 };
 
@@ -76,13 +70,15 @@ class Trigger: public Tool {
   static bool TriggerData(void* data);
   static void FailTrigger(void* data);
 
-  std::map<uint8_t, TriggerType> trigger_channels;
-  unsigned int threashold;
-  unsigned int window_size;
-  unsigned int jump;
-  float zero_rate;
+  bool LoadConfig();
+  void PublishRates(); ///< Put per condition trigger counts and rates into the monitoring store
+
+  std::shared_ptr<TriggerEngine> engine; ///< replaced atomically on configuration change
   std::string m_configfile;
-  bool nhits;
+
+  std::vector<unsigned long> m_last_counts;
+  boost::posix_time::ptime m_last_rates;
+  boost::posix_time::time_duration m_rate_period;
   
 };
 
@@ -0,0 +1,361 @@
+#include "TriggerEngine.h"
+
+namespace {
+
+  // Sliding window state of one condition while running over a TimeSlice.
+  // All counts are updated incrementally as hits enter and leave the window.
+  struct ConditionState{
+
+    ConditionState(const TriggerCondition& condition): tail(0), value(0), vetoed(false), veto(0){
+      switch(condition.count){
+      case TriggerCondition::Count::channels:
+	entries.resize(256, 0);
+	break;
+      case TriggerCondition::Count::digitizers:
+	entries.resize(16, 0);
+	break;
+      case TriggerCondition::Count::groups:
+	entries.resize(condition.groups.size(), 0);
+	break;
+      default:
+	break;
+      }
+    }
+
+    size_t tail; ///< index of the earliest hit in the window
+    unsigned long value; ///< current count compared to the threshold
+    std::vector<unsigned int> entries; ///< hits per channel, digitizer or group
+    bool vetoed;
+    uint64_t veto; ///< no triggers before this raw time if vetoed
+
+  };
+
+  // raw times read straight from the hits, for TriggerEngine::Scan
+  struct HitTimes{
+    const Hit* hits;
+    uint64_t operator[](size_t i) const { return hits[i].time.bits(); }
+  };
+
+  inline void Enter(unsigned int& entry, unsigned long& value){
+    if(!entry++) value++;
+  }
+
+  inline void Leave(unsigned int& entry, unsigned long& value){
+    if(!--entry) value--;
+  }
+
+  inline void Add(const TriggerCondition& condition, ConditionState& state, const Hit& hit){
+    uint8_t channel=hit.channel;
+    switch(condition.count){
+    case TriggerCondition::Count::hits:
+      state.value++;
+      break;
+    case TriggerCondition::Count::charge:
+      state.value+=hit.charge_long;
+      break;
+    case TriggerCondition::Count::channels:
+      Enter(state.entries[channel], state.value);
+      break;
+    case TriggerCondition::Count::digitizers:
+      Enter(state.entries[Hit::get_digitizer_id(channel)], state.value);
+      break;
+    case TriggerCondition::Count::groups:
+      for(size_t i=0; i<condition.groups.size(); i++)
+	if(condition.groups[i].test(channel)) Enter(state.entries[i], state.value);
+      break;
+    }
+  }
+
+  inline void Remove(const TriggerCondition& condition, ConditionState& state, const Hit& hit){
+    uint8_t channel=hit.channel;
+    switch(condition.count){
+    case TriggerCondition::Count::hits:
+      state.value--;
+      break;
+    case TriggerCondition::Count::charge:
+      state.value-=hit.charge_long;
+      break;
+    case TriggerCondition::Count::channels:
+      Leave(state.entries[channel], state.value);
+      break;
+    case TriggerCondition::Count::digitizers:
+      Leave(state.entries[Hit::get_digitizer_id(channel)], state.value);
+      break;
+    case TriggerCondition::Count::groups:
+      for(size_t i=0; i<condition.groups.size(); i++)
+	if(condition.groups[i].test(channel)) Leave(state.entries[i], state.value);
+      break;
+    }
+  }
+
+}
+
+TriggerEngine::TriggerEngine(): zero_rate(0.0), zero_seed(0){}
+
+bool TriggerEngine::ParseChannels(const std::string& list, ChannelSet& channels){
+
+  channels.reset();
+
+  std::stringstream ss(list);
+  std::string item;
+  while(std::getline(ss, item, ',')){
+    if(item.empty()) continue;
+    unsigned int first=0;
+    unsigned int last=0;
+    char dash=0;
+    std::stringstream range(item);
+    if(!(range>>first)) return false;
+    last=first;
+    if(range>>dash && (dash!='-' || !(range>>last))) return false;
+    if(first>last || last>=channels.size()) return false;
+    for(unsigned int i=first; i<=last; i++) channels.set(i);
+  }
+
+  return true;
+}
+
+bool TriggerEngine::AddCondition(Store& variables, const std::string& prefix, std::string& error){
+
+  TriggerCondition condition;
+  std::string type;
+  variables.Get(prefix+"type", type);
+
+  if(type=="nhits"){
+    condition.type=TriggerType::nhits;
+    condition.count=TriggerCondition::Count::hits;
+  }
+  else if(type=="channels"){
+    condition.type=TriggerType::multiplicity;
+    condition.count=TriggerCondition::Count::channels;
+  }
+  else if(type=="digitizers"){
+    condition.type=TriggerType::multiplicity;
+    condition.count=TriggerCondition::Count::digitizers;
+  }
+  else if(type=="coincidence"){
+    condition.type=TriggerType::coincidence;
+    condition.count=TriggerCondition::Count::groups;
+  }
+  else if(type=="energy_sum"){
+    condition.type=TriggerType::energy_sum;
+    condition.count=TriggerCondition::Count::charge;
+  }
+  else if(type=="psd"){
+    condition.type=TriggerType::psd;
+    condition.count=TriggerCondition::Count::hits;
+  }
+  else{
+    error=prefix+"type: unknown trigger condition type '"+type+"'";
+    return false;
+  }
+
+  if(!variables.Get(prefix+"name", condition.name)) condition.name=prefix.substr(0, prefix.size()-1);
+
+  unsigned long window=200;
+  variables.Get(prefix+"window", window);
+  if(window==0){
+    error=prefix+"window must be positive";
+    return false;
+  }
+  condition.window=Time::from_ns(window);
+
+  unsigned long jump=window;
+  variables.Get(prefix+"jump", jump);
+  condition.jump=Time::from_ns(jump);
+
+  std::string list;
+  if(variables.Get(prefix+"channels", list)){
+    if(!ParseChannels(list, condition.channels)){
+      error=prefix+"channels: invalid channel list '"+list+"'";
+      return false;
+    }
+  }
+  else condition.channels=~calib_channels;
+
+  if(condition.count==TriggerCondition::Count::groups){
+    if(!variables.Get(prefix+"groups", list)){
+      error=prefix+"groups is required for coincidence conditions";
+      return false;
+    }
+    std::stringstream ss(list);
+    std::string group;
+    while(std::getline(ss, group, ';')){
+      ChannelSet channels;
+      if(!ParseChannels(group, channels) || channels.none()){
+	error=prefix+"groups: invalid channel group '"+group+"'";
+	return false;
+      }
+      condition.groups.push_back(channels & condition.channels);
+    }
+  }
+
+  condition.min_charge=0;
+  variables.Get(prefix+"min_charge", condition.min_charge);
+
+  condition.psd_min=0.0;
+  condition.psd_max=1.0;
+  bool psd_min=variables.Get(prefix+"psd_min", condition.psd_min);
+  bool psd_max=variables.Get(prefix+"psd_max", condition.psd_max);
+  condition.psd_cut= psd_min || psd_max || condition.type==TriggerType::psd;
+  if(condition.psd_cut && condition.psd_min > condition.psd_max){
+    error=prefix+"psd_min is greater than psd_max";
+    return false;
+  }
+
+  if(condition.count==TriggerCondition::Count::groups) condition.threshold=condition.groups.size();
+  else if(condition.type==TriggerType::psd) condition.threshold=1;
+  else condition.threshold=20;
+  if(!variables.Get(prefix+"threshold", condition.threshold) && condition.count==TriggerCondition::Count::charge){
+    error=prefix+"threshold is required for energy_sum conditions";
+    return false;
+  }
+  if(condition.threshold==0){
+    error=prefix+"threshold must be positive";
+    return false;
+  }
+
+  conditions.push_back(condition);
+
+  return true;
+}
+
+bool TriggerEngine::Configure(Store& variables, std::string& error){
+
+  conditions.clear();
+  calib_channels.reset();
+
+  std::string type;
+  for(unsigned int i=0; i<calib_channels.size(); i++){
+    if(variables.Get(std::to_string(i), type) && type=="calib") calib_channels.set(i);
+  }
+
+  // single nhits condition of the original configuration format
+  bool nhits=false;
+  variables.Get("nhits", nhits);
+  if(nhits){
+    TriggerCondition condition;
+    condition.name="nhits";
+    condition.type=TriggerType::nhits;
+    condition.count=TriggerCondition::Count::hits;
+    unsigned int threashold=20;
+    unsigned int window_size=200;
+    unsigned int jump=2000;
+    variables.Get("threashold", threashold);
+    variables.Get("window_size", window_size);
+    variables.Get("jump", jump);
+    condition.threshold=threashold;
+    condition.window=Time::from_ns(window_size ? window_size : 1);
+    condition.jump=Time::from_ns(jump);
+    condition.channels=~calib_channels;
+    condition.min_charge=0;
+    condition.psd_min=0.0;
+    condition.psd_max=1.0;
+    condition.psd_cut=false;
+    conditions.push_back(condition);
+  }
+
+  zero_rate=0.0;
+  variables.Get("zero_rate", zero_rate);
+  if(zero_rate<0){
+    error="zero_rate must not be negative";
+    return false;
+  }
+  zero_seed=0;
+  variables.Get("zero_seed", zero_seed);
+
+  for(unsigned int i=0; variables.Get("trigger_"+std::to_string(i)+"_type", type); i++){
+    if(!AddCondition(variables, "trigger_"+std::to_string(i)+"_", error)) return false;
+  }
+
+  counts.reset(new std::atomic<unsigned long>[conditions.size()]);
+  for(size_t i=0; i<conditions.size(); i++) counts[i]=0;
+
+  return true;
+}
+
+const size_t TriggerEngine::gather_conditions;
+
+void TriggerEngine::Run(TimeSlice& time_slice) const{
+
+  // with several conditions the window edges are found on a contiguous array
+  // of raw times instead of striding over the hits for each of them
+  if(conditions.size()>=gather_conditions) Scan(time_slice, hit_time_bits(time_slice.hits));
+  else Scan(time_slice, HitTimes{time_slice.hits.data()});
+
+}
+
+template <typename Times>
+void TriggerEngine::Scan(TimeSlice& time_slice, const Times& times) const{
+
+  const std::vector<Hit>& hits=time_slice.hits;
+
+  std::vector<ConditionState> states;
+  states.reserve(conditions.size());
+  for(size_t i=0; i<conditions.size(); i++) states.emplace_back(conditions[i]);
+  std::vector<unsigned long> fired(conditions.size(), 0);
+
+  for(size_t head=0; head<hits.size(); head++){
+    const Hit& hit=hits[head];
+
+    if(calib_channels.test(hit.channel)) time_slice.triggers.emplace_back(TriggerType::calib, hit.time);
+
+    for(size_t i=0; i<conditions.size(); i++){
+      const TriggerCondition& condition=conditions[i];
+      if(!condition.Accept(hit)) continue;
+
+      ConditionState& state=states[i];
+      Add(condition, state, hit);
+
+      // drop hits that fell out of the window
+      uint64_t window=condition.window.bits();
+      while(times[state.tail] + window <= times[head]){
+	if(condition.Accept(hits[state.tail])) Remove(condition, state, hits[state.tail]);
+	state.tail++;
+      }
+
+      if(state.value < condition.threshold) continue;
+      if(state.vetoed && times[head] < state.veto) continue;
+
+      time_slice.triggers.emplace_back(condition.type, hits[state.tail].time);
+      state.vetoed=true;
+      state.veto=times[head] + condition.jump.bits();
+      fired[i]++;
+    }
+  }
+
+  for(size_t i=0; i<conditions.size(); i++)
+    if(fired[i]) counts[i].fetch_add(fired[i], std::memory_order_relaxed);
+
+}
+
+void TriggerEngine::ZeroBias(TimeSlice& time_slice, uint64_t run) const{
+
+  if(zero_rate<=0) return;
+
+  Time begin=time_slice.time;
+  Time end=time_slice.end;
+  if(end==Time()){
+    if(time_slice.hits.empty()) return;
+    end=time_slice.hits.back().time;
+  }
+  if(end<=begin) return;
+
+  // Exponential gaps between triggers. The process is memoryless, so starting
+  // afresh in every slice still gives a Poisson process at the configured rate
+  // whatever the slice length is.
+  CounterRNG rng(zero_seed ^ CounterRNG::mix(run), begin.bits());
+  double length=end.bits()-begin.bits();
+  const double units=512e9; // Time units per second
+  for(double t=rng.exponential(zero_rate)*units; t<length; t+=rng.exponential(zero_rate)*units){
+    time_slice.triggers.emplace_back(TriggerType::zero_bias, Time(begin.bits() + static_cast<uint64_t>(t)));
+  }
+
+}
+
+std::vector<unsigned long> TriggerEngine::Counts() const{
+
+  std::vector<unsigned long> ret(conditions.size());
+  for(size_t i=0; i<conditions.size(); i++) ret[i]=counts[i].load(std::memory_order_relaxed);
+
+  return ret;
+}
@@ -0,0 +1,89 @@
+#ifndef TriggerEngine_H
+#define TriggerEngine_H
+
+#include <atomic>
+#include <bitset>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <DataModel.h>
+#include <Random.h>
+#include <TimeUtils.h>
+
+using namespace ToolFramework;
+
+typedef std::bitset<256> ChannelSet; ///< Set of channels indexed by Hit::channel
+
+/**
+ * \struct TriggerCondition
+ *
+ * One trigger condition evaluated over a sliding time window. Hits in channels outside of `channels` and hits failing the charge and pulse shape cuts are ignored. Depending on `count` the condition fires when the window contains at least `threshold` hits, distinct channels, distinct digitizers, hit channel groups (coincidence) or total long gate charge (energy sum).
+ */
+
+struct TriggerCondition{
+
+  enum class Count {hits, channels, digitizers, groups, charge};
+
+  std::string name; ///< Name used for the rate counters
+  TriggerType type; ///< Type of the produced triggers
+  Count count; ///< What is counted within the window
+  Time window; ///< Sliding window length
+  Time jump; ///< Dead time after a trigger
+  unsigned long threshold; ///< Minimum count to trigger
+  ChannelSet channels; ///< Channels taking part in the condition
+  std::vector<ChannelSet> groups; ///< Channel groups for coincidence conditions
+  uint16_t min_charge; ///< Minimum charge_long of a hit
+  float psd_min; ///< Minimum charge_short/charge_long of a hit
+  float psd_max; ///< Maximum charge_short/charge_long of a hit
+  bool psd_cut; ///< Whether psd_min and psd_max are applied
+
+  bool Accept(const Hit& hit) const{ ///< Whether a hit takes part in the condition
+    if(!channels.test(hit.channel) || hit.charge_long < min_charge) return false;
+    if(!psd_cut) return true;
+    // charge_short/charge_long within [psd_min, psd_max] without a division
+    float charge_long=hit.charge_long;
+    return hit.charge_long && hit.charge_short >= psd_min * charge_long && hit.charge_short <= psd_max * charge_long;
+  }
+
+};
+
+/**
+ * \class TriggerEngine
+ *
+ * Evaluates all trigger conditions in a single pass over the sorted hits of a TimeSlice. The engine is immutable once configured so that it can be shared between the worker pool jobs, only the per condition trigger counters are updated (atomically) by Run.
+ */
+
+class TriggerEngine{
+
+ public:
+
+  TriggerEngine(); ///< Simple constructor
+  bool Configure(Store& variables, std::string& error); ///< Build the conditions from the Trigger tool configuration. @param variables Tool configuration. @param error Set to the description of the first configuration error.
+  void Run(TimeSlice& time_slice) const; ///< Append triggers found in a time sorted TimeSlice
+  void ZeroBias(TimeSlice& time_slice, uint64_t run) const; ///< Append zero bias triggers forming a Poisson process over the slice core. @param run Run number, selects the random number stream together with zero_seed and the slice time
+  std::vector<unsigned long> Counts() const; ///< Number of triggers produced by each condition so far
+
+  std::vector<TriggerCondition> conditions; ///< Trigger conditions
+  ChannelSet calib_channels; ///< Channels producing a calib trigger on every hit
+  double zero_rate; ///< Zero bias trigger rate in Hz
+  uint64_t zero_seed; ///< Seed of the zero bias random number streams
+
+  static bool ParseChannels(const std::string& list, ChannelSet& channels); ///< Parse a channel list such as "0-15,32,40-47"
+
+ private:
+
+  bool AddCondition(Store& variables, const std::string& prefix, std::string& error);
+  template <typename Times> void Scan(TimeSlice& time_slice, const Times& times) const; ///< The single pass of Run, reading hit i's raw time as times[i]
+
+  // conditions from which Run gathers the raw hit times into an array before
+  // the scan; the gather costs about one scan on the hits (see TimeBench)
+  static const size_t gather_conditions=2;
+
+  std::unique_ptr<std::atomic<unsigned long>[]> counts; ///< Triggers produced by each condition
+
+};
+
+
+#endif
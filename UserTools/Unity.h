@@ -6,10 +6,16 @@
 #include <FileWriter.h>
 #include <HVoltage.h>
 #include <JobManager.h>
+#include <LinkTest.h>
 #include <Monitoring.h>
 #include <NhitsTrigger.h>
+#include <RawReceiver.h>
+#include <RawSender.h>
 #include <Reformatter.h>
 #include <RunControl.h>
+#include <SliceCollector.h>
+#include <SliceDispatcher.h>
+#include <SliceWorker.h>
 #include <Sorter.h>
 #include <Trigger.h>
 #include <WindowBuilder.h>
@@ -66,9 +66,10 @@ void WindowBuilder::CreateThread(){
   args.push_back(tmp_args);
   
   std::stringstream tmp;
-  tmp<<"T"<<m_threadnum;
+  tmp<<"WindowBuilder"<<m_threadnum;
 
   m_util->CreateThread(tmp.str(), &Thread, args.at(args.size()-1));
+  StageProfiler::NameThread(args.at(args.size()-1)->thread, tmp.str());
   m_threadnum++;
   m_data->thread_num++;
   
@@ -87,10 +88,10 @@ void WindowBuilder::Thread(Thread_args* arg){
 
   WindowBuilder_args* args=reinterpret_cast<WindowBuilder_args*>(arg);
 
-  args->triggered_readout_mutex->lock();
+  args->m_data->profiler.Lock(*args->triggered_readout_mutex, StageProfiler::window_builder);
   if(!args->triggered_readout->size()){
     args->triggered_readout_mutex->unlock();
-    usleep(100);
+    args->m_data->profiler.Sleep(100, StageProfiler::window_builder);
     return;
   }
   std::swap(*args->triggered_readout, args->in_progress);
@@ -125,6 +126,8 @@ void WindowBuilder::Thread(Thread_args* arg){
 bool WindowBuilder::SelectData(void* data){
   
   WindowBuilder_args* args=reinterpret_cast<WindowBuilder_args*>(data);
+  StageProfiler::NameThread("job:window");
+  StageProfiler::Scope scope(args->m_data->profiler, StageProfiler::window_builder);
   
   //printf("d1\n");
   std::vector<TriggerGroup> trigger_groups;
@@ -159,36 +162,37 @@ bool WindowBuilder::SelectData(void* data){
   
   // looping over triggers to add hits
   
+  // Windows are cut from the core of the slice only. The neighbouring slices
+  // are processed independently and their windows stop at their own core, so
+  // a window reaching into the context hits would copy hits that a window of
+  // the neighbour may also hold. The context still serves the trigger
+  // conditions crossing the boundary.
+  uint64_t core_begin=args->time_slice->time.bits();
+  uint64_t core_end= args->time_slice->end==Time() ? UINT64_MAX : args->time_slice->end.bits();
+
   std::vector<TimeSlice*> time_slices;
   for(unsigned int i=0; i< trigger_groups.size(); i++){
 
+    uint64_t begin=std::max<uint64_t>(trigger_groups.at(i).min, core_begin);
+    uint64_t end=std::min<uint64_t>(trigger_groups.at(i).max, core_end - 1) + 1;
+
     TimeSlice* tmp = new TimeSlice;
     tmp->triggers=trigger_groups.at(i).triggers;
-    tmp->time=trigger_groups.at(i).min;
-
-    bool skip=false;
-    std::vector<Hit>::iterator min_it;
-    std::vector<Hit>::iterator max_it;
-    
-    for(std::vector<Hit>::iterator it=args->time_slice->hits.begin(); it!= args->time_slice->hits.end(); it++){
-      if(it->time.bits()<trigger_groups.at(i).min) continue;
-      if(it->time.bits()>trigger_groups.at(i).max) break;
-      if(!skip){
-	min_it=it;
-	skip=true;
-      }
-      max_it=it;
-      
-      
-    }
-    tmp->hits.insert(tmp->hits.end(), min_it, max_it);
+    tmp->time=Time(begin);
+    tmp->end=Time(end);
+    tmp->run=args->time_slice->run;
+    tmp->sub_run=args->time_slice->sub_run;
+
+    // hits with begin <= time < end via the coarse time index
+    std::pair<size_t, size_t> range = args->time_slice->Range(Time(begin), Time(end));
+    tmp->hits.insert(tmp->hits.end(), args->time_slice->hits.begin() + range.first, args->time_slice->hits.begin() + range.second);
     time_slices.push_back(tmp);
   }
 
   
   
   //printf("d2\n");
-   args->final_readout_mutex->lock();
+   args->m_data->profiler.Lock(*args->final_readout_mutex, StageProfiler::window_builder);
    //printf("d3\n");
    for(unsigned int i=0; i< time_slices.size(); i++){
      args->final_readout->emplace(std::move(time_slices.at(i))); //Ben this is bad and will lead to an unsorted queue dont use a queue;
@@ -197,6 +201,7 @@ bool WindowBuilder::SelectData(void* data){
    //printf("d4\n");
    args->final_readout_mutex->unlock(); 
    //printf("d5\n");
+   args->m_data->slice_budget.Release(*args->time_slice);
    delete args;
    args=0;
    data=0;
@@ -207,6 +212,7 @@ bool WindowBuilder::SelectData(void* data){
 void WindowBuilder::FailSelect(void* data){
 
   WindowBuilder_args* args=reinterpret_cast<WindowBuilder_args*>(data);
+  if(args->time_slice) args->m_data->slice_budget.Drop(*args->time_slice); // counted as lost
   delete args;
   args=0;
   data=0;
@@ -230,6 +236,22 @@ void WindowBuilder::LoadConfig(){
   if(m_variables.Get("zero_bias_trigger_offset",tmp)) trigger_offset[TriggerType::zero_bias]=tmp;
   if(m_variables.Get("zero_bias_pre_trigger",tmp)) pre_trigger[TriggerType::zero_bias]=tmp;
   if(m_variables.Get("zero_bias_post_trigger",tmp)) post_trigger[TriggerType::zero_bias]=tmp;
+
+  if(m_variables.Get("multiplicity_trigger_offset",tmp)) trigger_offset[TriggerType::multiplicity]=tmp;
+  if(m_variables.Get("multiplicity_pre_trigger",tmp)) pre_trigger[TriggerType::multiplicity]=tmp;
+  if(m_variables.Get("multiplicity_post_trigger",tmp)) post_trigger[TriggerType::multiplicity]=tmp;
+
+  if(m_variables.Get("coincidence_trigger_offset",tmp)) trigger_offset[TriggerType::coincidence]=tmp;
+  if(m_variables.Get("coincidence_pre_trigger",tmp)) pre_trigger[TriggerType::coincidence]=tmp;
+  if(m_variables.Get("coincidence_post_trigger",tmp)) post_trigger[TriggerType::coincidence]=tmp;
+
+  if(m_variables.Get("energy_sum_trigger_offset",tmp)) trigger_offset[TriggerType::energy_sum]=tmp;
+  if(m_variables.Get("energy_sum_pre_trigger",tmp)) pre_trigger[TriggerType::energy_sum]=tmp;
+  if(m_variables.Get("energy_sum_post_trigger",tmp)) post_trigger[TriggerType::energy_sum]=tmp;
+
+  if(m_variables.Get("psd_trigger_offset",tmp)) trigger_offset[TriggerType::psd]=tmp;
+  if(m_variables.Get("psd_pre_trigger",tmp)) pre_trigger[TriggerType::psd]=tmp;
+  if(m_variables.Get("psd_post_trigger",tmp)) post_trigger[TriggerType::psd]=tmp;
   
   
 }
@@ -0,0 +1,65 @@
+#!/bin/bash
+
+# Multi-process test of the RawSender to RawReceiver link on localhost: two
+# receiver toolchains connect to a sender toolchain fed with synthetic board
+# readouts (LinkTest tool). Checks that every hit generated is received exactly
+# once and that each board went to a single receiver.
+#
+# Run from the top directory after make, or with make link_test.
+
+log=`mktemp -d`
+trap 'kill $receiver_0 $receiver_1 $sender 2>/dev/null; rm -rf $log' EXIT
+
+./main configfiles/link_test/receiver/main_0.cfg > $log/receiver_0 2>&1 &
+receiver_0=$!
+./main configfiles/link_test/receiver/main_1.cfg > $log/receiver_1 2>&1 &
+receiver_1=$!
+# the source waits for both receivers to register before its first readout
+sleep 1
+./main configfiles/link_test/sender/main.cfg > $log/sender 2>&1 &
+sender=$!
+
+wait $sender $receiver_0 $receiver_1
+
+# number after $2 in the LinkTest line of log $1
+count(){
+  grep "LinkTest: $2" $log/$1 | sed "s/.*LinkTest: $2 \([0-9]*\) hits.*/\1/"
+}
+
+generated=`count sender generated`
+received_0=`count receiver_0 received`
+received_1=`count receiver_1 received`
+digitizers_0=`grep "LinkTest: received" $log/receiver_0 | sed 's/.*from digitizers//'`
+digitizers_1=`grep "LinkTest: received" $log/receiver_1 | sed 's/.*from digitizers//'`
+
+echo "generated $generated hits"
+echo "receiver 0: $received_0 hits, digitizers$digitizers_0"
+echo "receiver 1: $received_1 hits, digitizers$digitizers_1"
+
+status=0
+if [ -z "$generated" ] || [ -z "$received_0" ] || [ -z "$received_1" ]; then
+  echo "ERROR: a toolchain did not report, logs:"
+  tail -n 20 $log/*
+  exit 1
+fi
+if [ $((received_0 + received_1)) -ne $generated ]; then
+  echo "ERROR: $((received_0 + received_1)) hits received out of $generated"
+  status=1
+fi
+if [ -z "$digitizers_0" ] || [ -z "$digitizers_1" ]; then
+  echo "ERROR: the boards were not shared out between the receivers"
+  status=1
+fi
+for id in $digitizers_0; do
+  if echo " $digitizers_1 " | grep -q " $id "; then
+    echo "ERROR: digitizer $id went to both receivers"
+    status=1
+  fi
+done
+if grep -q "dropped" $log/sender; then
+  echo "ERROR: the sender dropped readouts"
+  status=1
+fi
+
+[ $status -eq 0 ] && echo "link test passed"
+exit $status
@@ -0,0 +1,92 @@
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <Store.h>
+#include <TriggerEngine.h>
+
+// Checks that the zero bias triggers of the TriggerEngine form a Poisson
+// process at zero_rate (Hz) whatever the slice length: the number of triggers
+// over the whole data time must match zero_rate within 5 standard deviations,
+// the spread of the counts per slice must match a Poisson distribution and
+// every trigger must lie within its slice.
+//
+// usage: RateCheck [trigger config (default configfiles/ratecheck/trigger.cfg)]
+//                  [data time per slice length, s (default 1000)]
+
+namespace {
+
+  bool Check(const TriggerEngine& engine, double slice_seconds, double seconds){
+
+    const uint64_t length=static_cast<uint64_t>(slice_seconds*512e9);
+    const unsigned long slices=static_cast<unsigned long>(seconds/slice_seconds);
+    const uint64_t run=1;
+
+    unsigned long total=0;
+    double sum2=0;
+    unsigned long outside=0;
+    TimeSlice slice;
+    for(unsigned long i=0; i<slices; i++){
+      slice.triggers.clear();
+      slice.time=Time(i*length);
+      slice.end=Time((i+1)*length);
+      engine.ZeroBias(slice, run);
+      for(const TriggerInfo& trigger : slice.triggers)
+	if(trigger.time<slice.time || !(trigger.time<slice.end)) outside++;
+      total+=slice.triggers.size();
+      sum2+=static_cast<double>(slice.triggers.size())*slice.triggers.size();
+    }
+
+    double data_time=slices*(length/512e9);
+    double expected=engine.zero_rate*data_time;
+    double measured=total/data_time;
+    double mean=static_cast<double>(total)/slices;
+    // variance over mean of the counts per slice, 1 for a Poisson process with
+    // a standard error of sqrt(2/slices)
+    double dispersion= mean>0 ? (sum2/slices-mean*mean)/mean : 0;
+
+    bool rate_ok= std::fabs(total-expected) <= 5*std::sqrt(expected);
+    bool dispersion_ok= std::fabs(dispersion-1) <= 5*std::sqrt(2.0/slices);
+
+    std::cout<<"slices of "<<slice_seconds<<" s: "<<total<<" triggers in "<<data_time<<" s, "
+	     <<measured<<" Hz (expected "<<engine.zero_rate<<" Hz), dispersion "<<dispersion
+	     <<", outside their slice "<<outside<<std::endl;
+    if(!rate_ok) std::cout<<"ERROR: the rate is off by more than 5 standard deviations"<<std::endl;
+    if(!dispersion_ok) std::cout<<"ERROR: the counts per slice are not Poisson distributed"<<std::endl;
+    if(outside) std::cout<<"ERROR: triggers outside their slice"<<std::endl;
+
+    return rate_ok && dispersion_ok && !outside;
+  }
+
+}
+
+int main(int argc, char* argv[]){
+
+  std::string config= argc>1 ? argv[1] : "configfiles/ratecheck/trigger.cfg";
+  double seconds= argc>2 ? strtod(argv[2], 0) : 1000;
+
+  Store variables;
+  if(!variables.Initialise(config)){
+    std::cout<<"cannot read "<<config<<std::endl;
+    return 1;
+  }
+
+  TriggerEngine engine;
+  std::string error;
+  if(!engine.Configure(variables, error)){
+    std::cout<<config<<": "<<error<<std::endl;
+    return 1;
+  }
+  if(engine.zero_rate<=0){
+    std::cout<<config<<": zero_rate must be positive"<<std::endl;
+    return 1;
+  }
+
+  // shorter, equal to and longer than the mean gap at the default rate
+  const double slice_seconds[]={0.001, 0.01, 0.1, 1.0};
+  bool ok=true;
+  for(double length : slice_seconds) ok&=Check(engine, length, seconds);
+
+  return ok ? 0 : 1;
+}
@@ -1,32 +1,278 @@
 #include <iostream>
+#include <fstream>
+#include <sstream>
+#include <functional>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <vector>
+#include <string>
+#include <cstdlib>
+#include <algorithm>
+#include <cstdio>
+#include <glob.h>
+#include <sys/stat.h>
 #include <BinaryStream.h>
 #include <TimeSlice.h>
 #include <SerialisableObject.h>
+#include <SliceCodec.h>
+#include <JournalReader.h>
+#include <ChannelStats.h>
 
-int main(int argc, char* argv[]){
+// Read all time slices of a part file in any of the FileWriter formats
+bool ReadPart(const std::string& filename, const std::function<void(TimeSlice&)>& process, std::string& error){
+
+  JournalReader journal;
+  if(journal.Open(filename)){
+    TimeSlice ts;
+    while(journal.Next(ts)){
+      process(ts);
+      ts.hits.clear();
+      ts.triggers.clear();
+    }
+    if(!journal.Clean()){
+      std::stringstream ss;
+      ss<<filename<<": damaged after "<<journal.ValidBytes()<<" bytes, run Recover to truncate it";
+      error=ss.str();
+      return false;
+    }
+    return true;
+  }
 
   BinaryStream bs;
 
-  bs.Bopen(argv[1], READ, UNCOMPRESSED);
+  if(!bs.Bopen(filename, READ, UNCOMPRESSED)){
+    error=filename+": cannot open file";
+    return false;
+  }
 
-  unsigned long size=0;
+  // compressed part files start with SliceCodec::magic, uncompressed ones
+  // with the number of time slices
+  uint64_t magic=0;
+  bs >> magic;
+  bool compressed= magic==SliceCodec::magic;
 
-  bs >> size;
+  unsigned long size=magic;
+  uint32_t version=0;
+  if(compressed){
+    bs >> version;
+    if(version<1 || version>SliceCodec::version){
+      error=filename+": unsupported compressed file version "+std::to_string(version);
+      bs.Bclose();
+      return false;
+    }
+    bs >> size;
+  }
 
-  std::cout<<"Time slices in file ="<<size<<std::endl;
+  bool ok=true;
   for(unsigned long i=0; i < size; i++){
 
     TimeSlice ts;
-    bs >> ts;
+    if(compressed){
+      uint64_t raw_size=0;
+      std::string block;
+      std::string raw;
+      if(version==1){
+	uint32_t raw_size32=0;
+	bs >> raw_size32;
+	raw_size=raw_size32;
+      }
+      else bs >> raw_size;
+      bs >> block;
+      if(!SliceCodec::decompress(block, raw_size, raw) || !SliceCodec::decode(raw, ts)){
+        error=filename+": corrupted time slice "+std::to_string(i);
+        ok=false;
+        continue;
+      }
+    }
+    else if(!(bs >> ts)){
+      error=filename+": unsupported time slice format in slice "+std::to_string(i);
+      ok=false;
+      break;
+    }
 
-    std::cout<<"TimeSlice "<<i<<":";
-    ts.Print();
-    std::cout<<std::endl;
+    process(ts);
   }
 
 
   bs.Bclose();
 
-  return 0;
+  return ok;
+
+}
+
+// Orders part files by run, sub run, kind (P before L) and part number, as
+// numbers; names not of the FileWriter form R<run>S<sub run><kind><part>.dat
+// come last, in lexical order
+struct PartOrder{
+
+  struct Key{
+    bool parsed;
+    unsigned long run, sub_run, part;
+    char kind;
+  };
+
+  static Key Parse(const std::string& filename){
+    Key key={false, 0, 0, 0, 0};
+    size_t slash=filename.rfind('/');
+    std::string name=filename.substr(slash==std::string::npos ? 0 : slash+1);
+    int end=0;
+    key.parsed= sscanf(name.c_str(), "R%luS%lu%c%lu.dat%n", &key.run, &key.sub_run, &key.kind, &key.part, &end)==4
+      && end==static_cast<int>(name.size()) && (key.kind=='P' || key.kind=='L');
+    return key;
+  }
+
+  bool operator()(const std::string& a, const std::string& b) const{
+    Key ka=Parse(a), kb=Parse(b);
+    if(ka.parsed!=kb.parsed) return ka.parsed;
+    if(!ka.parsed) return a<b;
+    if(ka.run!=kb.run) return ka.run<kb.run;
+    if(ka.sub_run!=kb.sub_run) return ka.sub_run<kb.sub_run;
+    if(ka.kind!=kb.kind) return ka.kind=='P';
+    if(ka.part!=kb.part) return ka.part<kb.part;
+    return a<b;
+  }
+
+};
+
+// Per channel statistics of many part files, read in parallel. Each thread
+// reads a contiguous range of the time ordered files, of about the same size,
+// and the ranges are appended in order, so that the hit interval histograms
+// see every pair of consecutive hits.
+int Summary(const std::vector<std::string>& files, unsigned int threads, const std::string& output){
+
+  std::vector<uint64_t> sizes(files.size(), 0);
+  uint64_t total_bytes=0;
+  for(size_t i=0; i<files.size(); i++){
+    struct stat file_stat;
+    if(stat(files[i].c_str(), &file_stat)==0) sizes[i]=file_stat.st_size;
+    total_bytes+=sizes[i];
+  }
+  // files [begin[t], begin[t+1]) go to thread t
+  std::vector<size_t> begin(threads+1, files.size());
+  begin[0]=0;
+  uint64_t bytes=0;
+  for(size_t i=0, t=1; i<files.size() && t<threads; i++){
+    bytes+=sizes[i];
+    if(bytes*threads >= total_bytes*t && files.size()-(i+1) >= threads-t) begin[t++]=i+1;
+  }
+
+  std::vector<ChannelStats> stats(threads);
+  std::vector<unsigned long> slices(threads, 0);
+  std::atomic<unsigned int> failed(0);
+  std::mutex log_mutex;
+
+  std::vector<std::thread> workers;
+  for(unsigned int t=0; t<threads; t++){
+    workers.emplace_back([&, t](){
+	for(size_t i=begin[t]; i<begin[t+1]; i++){
+	  std::string error;
+	  bool ok=ReadPart(files[i], [&](TimeSlice& ts){ stats[t].Fill(ts); slices[t]++; }, error);
+	  if(!ok){
+	    failed++;
+	    std::lock_guard<std::mutex> lock(log_mutex);
+	    std::cerr<<error<<std::endl;
+	  }
+	}
+      });
+  }
+  for(auto& worker : workers) worker.join();
+
+  unsigned long total=slices[0];
+  for(unsigned int t=1; t<threads; t++){
+    stats[0].Append(stats[t]);
+    total+=slices[t];
+  }
+
+  std::ofstream file;
+  if(output!=""){
+    file.open(output);
+    if(!file.is_open()){
+      std::cerr<<"cannot open "<<output<<std::endl;
+      return 1;
+    }
+  }
+  std::ostream& out= output!="" ? file : std::cout;
+
+  out<<"# files "<<files.size()<<" failed "<<failed<<" time_slices "<<total<<std::endl;
+  stats[0].Write(out);
+
+  return failed ? 1 : 0;
+
+}
+
+void Usage(const char* name){
+
+  std::cout<<"usage: "<<name<<" <part file>\n"
+	   <<"       "<<name<<" --summary [--threads N] [--output FILE] [--run N [--prefix PATH]] [FILE|GLOB]...\n"
+	   <<"  print the time slices of a part file, or per channel hit counts, rates, charge, PSD and\n"
+	   <<"  hit interval histograms of many part files read in parallel. --run selects all parts\n"
+	   <<"  PATH R<run>S*P*.dat, PATH being the FileWriter file_path (default ./data). The files are\n"
+	   <<"  read in the order of run, sub run and part number; the hit intervals are those of\n"
+	   <<"  consecutive hits in that order"<<std::endl;
+
+}
+
+int main(int argc, char* argv[]){
+
+  if(argc<2){
+    Usage(argv[0]);
+    return 1;
+  }
+
+  if(std::string(argv[1])!="--summary"){
+
+    unsigned long i=0;
+    std::string error;
+    bool ok=ReadPart(argv[1], [&](TimeSlice& ts){
+	std::cout<<"TimeSlice "<<i++<<":";
+	ts.Print();
+	std::cout<<std::endl;
+      }, error);
+    std::cout<<"Time slices in file ="<<i<<std::endl;
+    if(!ok) std::cout<<error<<std::endl;
+
+    return ok ? 0 : 1;
+  }
+
+  unsigned int threads=std::thread::hardware_concurrency();
+  std::string output;
+  std::string prefix="./data";
+  std::vector<std::string> patterns;
+  std::string run;
+
+  for(int i=2; i<argc; i++){
+    std::string arg=argv[i];
+    if(arg=="--threads" && i+1<argc) threads=std::strtoul(argv[++i], 0, 10);
+    else if(arg=="--output" && i+1<argc) output=argv[++i];
+    else if(arg=="--prefix" && i+1<argc) prefix=argv[++i];
+    else if(arg=="--run" && i+1<argc) run=argv[++i];
+    else if(arg.size() && arg[0]=='-'){
+      Usage(argv[0]);
+      return 1;
+    }
+    else patterns.push_back(arg);
+  }
+  if(run!="") patterns.push_back(prefix+"R"+run+"S*P*.dat");
+  if(threads==0) threads=1;
+
+  std::vector<std::string> files;
+  for(size_t i=0; i<patterns.size(); i++){
+    glob_t matches;
+    if(glob(patterns[i].c_str(), 0, 0, &matches)==0){
+      for(size_t j=0; j<matches.gl_pathc; j++) files.push_back(matches.gl_pathv[j]);
+    }
+    globfree(&matches);
+  }
+  if(files.empty()){
+    std::cerr<<"no part files found"<<std::endl;
+    return 1;
+  }
+  // glob sorts lexically (P10 before P2) and patterns may overlap
+  std::sort(files.begin(), files.end(), PartOrder());
+  files.erase(std::unique(files.begin(), files.end()), files.end());
+  if(threads>files.size()) threads=files.size();
+
+  return Summary(files, threads, output);
 
 }
@@ -0,0 +1,60 @@
+#include <iostream>
+#include <string>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <BinaryStream.h>
+#include <SerialisableObject.h>
+#include <JournalReader.h>
+
+// Truncate a journal part file left by a crashed FileWriter to its last
+// intact block, so that it can be read and appended to again.
+
+int main(int argc, char* argv[]){
+
+  if(argc<2){
+    std::cout<<"usage: "<<argv[0]<<" <journal part file>..."<<std::endl;
+    return 1;
+  }
+
+  int ret=0;
+
+  for(int i=1; i<argc; i++){
+
+    JournalReader journal;
+    if(!journal.Open(argv[i])){
+      std::cout<<argv[i]<<": not a journal part file"<<std::endl;
+      ret=1;
+      continue;
+    }
+
+    uint64_t raw_size;
+    std::string payload;
+    while(journal.NextBlock(raw_size, payload));
+
+    struct stat file_stat;
+    if(stat(argv[i], &file_stat)!=0){
+      std::cout<<argv[i]<<": cannot stat file"<<std::endl;
+      ret=1;
+      continue;
+    }
+
+    uint64_t size=file_stat.st_size;
+    std::cout<<argv[i]<<": "<<journal.Blocks()<<" valid blocks, "<<journal.ValidBytes()<<" of "<<size<<" bytes";
+
+    if(journal.Clean() && journal.ValidBytes()==size){
+      std::cout<<", intact"<<std::endl;
+      continue;
+    }
+
+    if(truncate(argv[i], journal.ValidBytes())!=0){
+      std::cout<<", failed to truncate"<<std::endl;
+      ret=1;
+      continue;
+    }
+    std::cout<<", truncated "<<size-journal.ValidBytes()<<" bytes"<<std::endl;
+
+  }
+
+  return ret;
+
+}
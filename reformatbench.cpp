@@ -0,0 +1,244 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdlib>
+#include <deque>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <thread>
+#include <vector>
+#include <BinaryStream.h>
+#include <SerialisableObject.h>
+#include <TimeBuckets.h>
+
+// Wall clock throughput of the parallel Reformatter scheme on synthetic data
+// (threads above 1 in the Reformatter configuration), for 1 to 8 boards and 1
+// to 8 ingestion threads. As in the Reformatter, the board readouts are
+// handed to the ingestion thread of their board, which bins them into
+// TimeBuckets, the reformatting thread cuts a slice once every board passed
+// its end and the slices are gathered by a pool of as many threads. A board is
+// always ingested by the same thread, so there are never more useful threads
+// than boards.
+//
+// Boards have 16 channels with Poisson hits and are read out every 10 ms,
+// slices are 100 ms long on 10 ms buckets.
+//
+// usage: ReformatBench [seconds of data (default 2)] [rate per channel, Hz
+//                      (default 20000)] [max threads (default the hardware
+//                      threads, at most 8)]
+
+namespace {
+
+  typedef std::chrono::steady_clock Clock;
+
+  const unsigned channels_per_board = 16;
+  const double readout_period = 0.01;
+  const double bucket_seconds = 0.01;
+  const unsigned buckets_per_slice = 10;
+
+  struct Readout{
+    unsigned board;
+    uint64_t end; // Time bits up to which the board is read out
+    std::vector<Hit> hits;
+  };
+
+  // readouts in the order they arrive, board after board every period
+  std::vector<Readout> Generate(unsigned boards, double seconds, double rate){
+    std::mt19937_64 rng(boards);
+    std::exponential_distribution<double> gap(rate);
+    unsigned periods=seconds/readout_period;
+    std::vector<Readout> readouts(periods*boards);
+    std::vector<double> next(boards*channels_per_board);
+    for(auto& t : next) t=gap(rng);
+    for(unsigned p=0; p<periods; p++){
+      double end=(p+1)*readout_period;
+      for(unsigned b=0; b<boards; b++){
+	Readout& readout=readouts[p*boards+b];
+	readout.board=b;
+	readout.end=Time(static_cast<long double>(end)).bits();
+	// channel by channel, as the digitizers deliver them
+	for(unsigned c=0; c<channels_per_board; c++){
+	  double& t=next[b*channels_per_board+c];
+	  for(; t<end; t+=gap(rng)){
+	    Hit hit;
+	    hit.time=Time(static_cast<long double>(t));
+	    hit.channel=c | b<<4;
+	    hit.charge_short=100;
+	    hit.charge_long=400;
+	    hit.baseline=0;
+	    readout.hits.push_back(hit);
+	  }
+	}
+      }
+    }
+    return readouts;
+  }
+
+  struct Ingest{
+    std::mutex mutex;
+    std::condition_variable ready;
+    std::deque<Readout*> readouts;
+    bool running=true;
+    std::thread thread;
+  };
+
+  struct Pool{
+    std::mutex mutex;
+    std::condition_variable ready;
+    std::deque<std::unique_ptr<std::vector<std::vector<Hit>>>> parts;
+    bool running=true;
+    std::vector<std::thread> threads;
+    std::atomic<uint64_t> hits{0};
+  };
+
+  // hits per second through ingestion, cutting and gathering
+  double Run(std::vector<Readout>& readouts, unsigned boards, unsigned threads, uint64_t& hits){
+
+    TimeBuckets buckets;
+    uint64_t width=Time(static_cast<long double>(bucket_seconds)).bits();
+    buckets.configure(threads, width);
+    std::unique_ptr<std::atomic<uint64_t>[]> binned(new std::atomic<uint64_t>[boards]);
+    for(unsigned b=0; b<boards; b++) binned[b]=0;
+
+    Clock::time_point start_time=Clock::now();
+
+    std::vector<std::unique_ptr<Ingest>> ingests;
+    for(unsigned i=0; i<threads; i++){
+      ingests.emplace_back(new Ingest);
+      Ingest& in=*ingests.back();
+      in.thread=std::thread([&in, &buckets, &binned, i](){
+	  while(true){
+	    Readout* readout;
+	    {
+	      std::unique_lock<std::mutex> lock(in.mutex);
+	      in.ready.wait(lock, [&in]{ return !in.readouts.empty() || !in.running; });
+	      if(in.readouts.empty()) return;
+	      readout=in.readouts.front();
+	      in.readouts.pop_front();
+	    }
+	    buckets.add(i, readout->hits);
+	    binned[readout->board].store(readout->end, std::memory_order_release);
+	  }
+	});
+    }
+
+    Pool pool;
+    for(unsigned i=0; i<threads; i++){
+      pool.threads.emplace_back([&pool](){
+	  while(true){
+	    std::unique_ptr<std::vector<std::vector<Hit>>> parts;
+	    {
+	      std::unique_lock<std::mutex> lock(pool.mutex);
+	      pool.ready.wait(lock, [&pool]{ return !pool.parts.empty() || !pool.running; });
+	      if(pool.parts.empty()) return;
+	      parts=std::move(pool.parts.front());
+	      pool.parts.pop_front();
+	    }
+	    // Reformatter::gather
+	    size_t size=0;
+	    for(auto& part : *parts) size+=part.size();
+	    std::vector<Hit> slice;
+	    slice.reserve(size);
+	    for(auto& part : *parts){
+	      slice.insert(slice.end(), std::make_move_iterator(part.begin()), std::make_move_iterator(part.end()));
+	      std::vector<Hit>().swap(part);
+	    }
+	    pool.hits+=slice.size();
+	  }
+	});
+    }
+
+    uint64_t first=0;
+    std::vector<Hit> late;
+    auto cut=[&](uint64_t last){
+      std::unique_ptr<std::vector<std::vector<Hit>>> parts(new std::vector<std::vector<Hit>>);
+      buckets.take(first, last, *parts, late);
+      first=last;
+      if(parts->empty()) return;
+      {
+	std::lock_guard<std::mutex> lock(pool.mutex);
+	pool.parts.push_back(std::move(parts));
+      }
+      pool.ready.notify_one();
+    };
+
+    for(auto& readout : readouts){
+      Ingest& in=*ingests[readout.board % threads];
+      {
+	std::lock_guard<std::mutex> lock(in.mutex);
+	in.readouts.push_back(&readout);
+      }
+      in.ready.notify_one();
+
+      uint64_t passed=binned[0].load(std::memory_order_acquire);
+      for(unsigned b=1; b<boards; b++) passed=std::min(passed, binned[b].load(std::memory_order_acquire));
+      while((first+buckets_per_slice)*width <= passed) cut(first+buckets_per_slice);
+    }
+
+    for(auto& in : ingests){
+      {
+	std::lock_guard<std::mutex> lock(in->mutex);
+	in->running=false;
+      }
+      in->ready.notify_one();
+      in->thread.join();
+    }
+    uint64_t next;
+    while(buckets.first(next)){
+      if(next>first) first=next;
+      cut(first+buckets_per_slice);
+    }
+
+    {
+      std::lock_guard<std::mutex> lock(pool.mutex);
+      pool.running=false;
+    }
+    pool.ready.notify_all();
+    for(auto& thread : pool.threads) thread.join();
+
+    double seconds=std::chrono::duration<double>(Clock::now()-start_time).count();
+    hits=pool.hits+late.size();
+    return hits/seconds;
+  }
+
+}
+
+int main(int argc, char* argv[]){
+
+  double seconds= argc>1 ? strtod(argv[1], 0) : 2;
+  double rate= argc>2 ? strtod(argv[2], 0) : 20000;
+  unsigned max_threads= argc>3 ? strtoul(argv[3], 0, 10) : std::thread::hardware_concurrency();
+  if(max_threads==0) max_threads=1;
+  if(max_threads>8) max_threads=8;
+
+  std::cout<<seconds<<" s of data at "<<rate<<" Hz per channel, "<<channels_per_board<<" channels per board, "
+	   <<std::thread::hardware_concurrency()<<" hardware threads"<<std::endl;
+  std::cout<<"boards threads      Mhit/s  speedup"<<std::endl;
+
+  bool ok=true;
+  for(unsigned boards=1; boards<=8; boards*=2){
+    std::vector<Readout> generated=Generate(boards, seconds, rate);
+    uint64_t expected=0;
+    for(auto& readout : generated) expected+=readout.hits.size();
+
+    double single=0;
+    for(unsigned threads=1; threads<=std::min(boards, max_threads); threads*=2){
+      std::vector<Readout> readouts=generated;
+      uint64_t hits=0;
+      double hit_rate=Run(readouts, boards, threads, hits);
+      if(threads==1) single=hit_rate;
+      std::cout<<std::setw(6)<<boards<<std::setw(8)<<threads<<std::fixed<<std::setprecision(1)
+	       <<std::setw(12)<<hit_rate/1e6<<std::setprecision(2)<<std::setw(9)<<hit_rate/single<<std::endl;
+      if(hits!=expected){
+	std::cout<<"ERROR: "<<hits<<" hits out of "<<expected<<std::endl;
+	ok=false;
+      }
+    }
+  }
+
+  return ok ? 0 : 1;
+}
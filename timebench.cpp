@@ -0,0 +1,149 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+#include <vector>
+#include <BinaryStream.h>
+#include <SerialisableObject.h>
+#include <TimeUtils.h>
+
+// Micro-benchmark of the hit time conversions, of the bulk helpers of
+// TimeUtils.h and of the sliding window scans of the TriggerEngine, on
+// synthetic sorted hits cut into slices. Each trigger condition scans the
+// slice once, so gathering the raw times pays off with more conditions; the
+// TriggerEngine gathers from TriggerEngine::gather_conditions on.
+//
+// usage: TimeBench [hits (default 10000000)] [rate per second (default 1e7)]
+//                  [hits per slice (default 100000)] [conditions (default 4)]
+
+namespace {
+
+  typedef std::chrono::steady_clock Clock;
+
+  double Elapsed(Clock::time_point start){
+    return std::chrono::duration<double>(Clock::now()-start).count();
+  }
+
+  // Time::seconds before the integer conversions
+  double LongDoubleSeconds(const Time& time){
+    return (static_cast<long double>(time.bits() >> 10) + static_cast<long double>(time.bits() & 0x3ff) / 1024.0L) * 2e-9L;
+  }
+
+  // nhits windows as the TriggerEngine ran them, comparing Time objects
+  unsigned long WindowTime(const Hit* hits, size_t n, unsigned int conditions, Time window, unsigned long threshold){
+    unsigned long fired=0;
+    for(unsigned int c=0; c<conditions; c++){
+      size_t tail=0;
+      for(size_t head=0; head<n; head++){
+	while(hits[tail].time + window <= hits[head].time) tail++;
+	if(head-tail+1>=threshold) fired++;
+      }
+    }
+    return fired;
+  }
+
+  // the same on the raw times, gathered once per slice
+  unsigned long WindowBits(const Hit* hits, size_t n, unsigned int conditions, Time window, unsigned long threshold){
+    std::vector<uint64_t> times(n);
+    hit_time_bits(hits, n, times.data());
+    uint64_t w=window.bits();
+    unsigned long fired=0;
+    for(unsigned int c=0; c<conditions; c++){
+      size_t tail=0;
+      for(size_t head=0; head<n; head++){
+	while(times[tail] + w <= times[head]) tail++;
+	if(head-tail+1>=threshold) fired++;
+      }
+    }
+    return fired;
+  }
+
+}
+
+int main(int argc, char* argv[]){
+
+  size_t n= argc>1 ? strtoul(argv[1], 0, 10) : 10000000;
+  double rate= argc>2 ? strtod(argv[2], 0) : 1e7;
+  size_t slice= argc>3 ? strtoul(argv[3], 0, 10) : 100000;
+  unsigned int conditions= argc>4 ? strtoul(argv[4], 0, 10) : 4;
+  if(!slice) slice=n;
+
+  std::mt19937_64 rng(1);
+  std::exponential_distribution<double> gap(rate);
+  std::vector<Hit> hits(n);
+  double t=0;
+  for(size_t i=0; i<n; i++){
+    t+=gap(rng);
+    hits[i].time=Time(static_cast<uint64_t>(t*512e9));
+    hits[i].channel=i%64;
+  }
+
+  std::cout<<n<<" hits at "<<rate<<" Hz, "<<slice<<" hits per slice, "<<conditions<<" conditions"<<std::endl;
+
+  Clock::time_point start=Clock::now();
+  double sum=0;
+  for(size_t i=0; i<n; i++) sum+=LongDoubleSeconds(hits[i].time);
+  double long_double=Elapsed(start);
+
+  start=Clock::now();
+  double sum2=0;
+  for(size_t i=0; i<n; i++) sum2+=hits[i].time.seconds();
+  double integer=Elapsed(start);
+
+  std::vector<uint64_t> bits(n);
+  std::vector<double> seconds(n);
+  start=Clock::now();
+  hit_time_bits(hits.data(), n, bits.data());
+  time_bits_to_seconds(bits.data(), n, seconds.data());
+  double sum3=0;
+  for(size_t i=0; i<n; i++) sum3+=seconds[i];
+  double batch=Elapsed(start);
+
+  std::cout<<"seconds, long double: "<<long_double/n*1e9<<" ns/hit"<<std::endl;
+  std::cout<<"seconds, integer:     "<<integer/n*1e9<<" ns/hit (sums differ by "<<(sum-sum2)/n<<" s/hit)"<<std::endl;
+  std::cout<<"seconds, batch:       "<<batch/n*1e9<<" ns/hit including the gather"<<std::endl;
+
+  // hits in the middle half of the run, as a window cut does
+  Time begin(hits[n/4].time.bits());
+  Time end(hits[3*n/4].time.bits());
+
+  start=Clock::now();
+  size_t in_window=0;
+  for(size_t i=0; i<n; i++) if(hits[i].time>=begin && hits[i].time<end) in_window++;
+  double time_count=Elapsed(start);
+
+  start=Clock::now();
+  size_t in_window2=count_time_bits_in_window(bits.data(), n, begin, end);
+  double bits_count=Elapsed(start);
+
+  std::cout<<"window count, Time:   "<<time_count/n*1e9<<" ns/hit"<<std::endl;
+  std::cout<<"window count, bits:   "<<bits_count/n*1e9<<" ns/hit on gathered times"<<std::endl;
+
+  Time window=Time::from_ns(200);
+  unsigned long threshold=5;
+
+  start=Clock::now();
+  unsigned long fired=0;
+  for(size_t i=0; i<n; i+=slice) fired+=WindowTime(&hits[i], std::min(slice, n-i), conditions, window, threshold);
+  double time_window=Elapsed(start);
+
+  start=Clock::now();
+  unsigned long fired2=0;
+  for(size_t i=0; i<n; i+=slice) fired2+=WindowBits(&hits[i], std::min(slice, n-i), conditions, window, threshold);
+  double bits_window=Elapsed(start);
+
+  std::cout<<"nhits windows, Time:  "<<time_window/n*1e9<<" ns/hit, "<<fired<<" windows over threshold"<<std::endl;
+  std::cout<<"nhits windows, bits:  "<<bits_window/n*1e9<<" ns/hit including the gather, "<<fired2<<" windows over threshold"<<std::endl;
+
+  if(fired!=fired2){
+    std::cout<<"ERROR: the scans disagree"<<std::endl;
+    return 1;
+  }
+  if(sum2!=sum3 || in_window!=in_window2){
+    std::cout<<"ERROR: the bulk helpers disagree"<<std::endl;
+    return 1;
+  }
+
+  return 0;
+}